@@ -0,0 +1,63 @@
+//
+// Copyright (C) [2021] Futurewei Technologies, Inc. All rights reserved.
+//
+// OpenArkCompiler is licensed underthe Mulan Permissive Software License v2.
+// You can use this software according to the terms and conditions of the MulanPSL - 2.0.
+// You may obtain a copy of MulanPSL - 2.0 at:
+//
+//   https://opensource.org/licenses/MulanPSL-2.0
+//
+// THIS SOFTWARE IS PROVIDED ON AN "AS IS" BASIS, WITHOUT WARRANTIES OF ANY KIND, EITHER
+// EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO NON-INFRINGEMENT, MERCHANTABILITY OR
+// FIT FOR A PARTICULAR PURPOSE.
+// See the MulanPSL - 2.0 for more details.
+//
+
+// Errors raised by the engine and the runtime reach the script as instances
+// of the matching error constructor, whichever operation or builtin raised
+// them, and a value the script throws through a native callback reaches the
+// outer catch unchanged. Each case runs in a loop so the reused exception
+// records are exercised too.
+
+var ROUNDS = 100;
+
+function expectError(name, ctor, f) {
+  for (var i = 0; i < ROUNDS; i++) {
+    var caught = null;
+    try {
+      f(i);
+    } catch (e) {
+      caught = e;
+    }
+    if (!(caught instanceof ctor)) {
+      $ERROR(name, " not caught as an instance of its constructor\n");
+      return;
+    }
+  }
+}
+
+var notAFunction = 1;
+expectError("TypeError", TypeError, function(i) { notAFunction(i); });
+expectError("ReferenceError", ReferenceError, function(i) { return undefinedVariable + i; });
+expectError("RangeError", RangeError, function(i) { return new Array(-1 - i); });
+expectError("SyntaxError", SyntaxError, function(i) { return new RegExp("(" + i); });
+expectError("URIError", URIError, function(i) { return decodeURI("%" + i); });
+
+var thrown = { tag: "mine" };
+for (var i = 0; i < ROUNDS; i++) {
+  var caught = null;
+  try {
+    [1, 2, 3].forEach(function(v) {
+      if (v == 2) {
+        throw thrown;
+      }
+    });
+  } catch (e) {
+    caught = e;
+  }
+  if (caught !== thrown) {
+    $ERROR("value thrown from a native callback replaced by ", caught, "\n");
+  }
+}
+
+print(" errorvalue: pass\n");
@@ -0,0 +1,73 @@
+//
+// Copyright (C) [2021] Futurewei Technologies, Inc. All rights reserved.
+//
+// OpenArkCompiler is licensed underthe Mulan Permissive Software License v2.
+// You can use this software according to the terms and conditions of the MulanPSL - 2.0.
+// You may obtain a copy of MulanPSL - 2.0 at:
+//
+//   https://opensource.org/licenses/MulanPSL-2.0
+//
+// THIS SOFTWARE IS PROVIDED ON AN "AS IS" BASIS, WITHOUT WARRANTIES OF ANY KIND, EITHER
+// EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO NON-INFRINGEMENT, MERCHANTABILITY OR
+// FIT FOR A PARTICULAR PURPOSE.
+// See the MulanPSL - 2.0 for more details.
+//
+
+// Frame locals holding references at both odd and even frame slots, mixed
+// with number locals. The prolog clears and the epilog releases only the
+// slots the frame bitmaps flag; a slot missed or misplaced leaves stale
+// stack contents in a reference local, or drops the count of a live object
+// on return, which shows up here as wrong sums or a crash.
+
+var ROUNDS = 20000;
+
+function mixed(n, keep) {
+  var a = { v: n };        // references and numbers interleaved
+  var x = n + 1;
+  var b = [n, n + 1];
+  var c = { v: n + 2 };
+  var y = n * 2;
+  var z = n * 3;
+  var d = { v: n + 3 };
+  var e = "s" + n;
+  var w = n - 1;
+  var f = { v: n + 4, next: a };
+  if (n % 2 == 0) {
+    keep.push(f);
+  } else {
+    keep.push(b);
+  }
+  return a.v + x + b[1] + c.v + y + z + d.v + e.length + w + f.next.v;
+}
+
+function clobber(n) {
+  // fills the stack area the next frame of mixed() reuses with numbers
+  var p = n, q = n + 1, r = n + 2, s = n + 3, t = n + 4, u = n + 5;
+  var g = n + 6, h = n + 7, i = n + 8, j = n + 9, k = n + 10, l = n + 11;
+  return p + q + r + s + t + u + g + h + i + j + k + l;
+}
+
+var keep = [];
+var total = 0;
+var expected = 0;
+for (var n = 0; n < ROUNDS; n++) {
+  clobber(n);
+  total += mixed(n, keep);
+  expected += n + (n + 1) + (n + 1) + (n + 2) + 2 * n + 3 * n + (n + 3) + ("s" + n).length + (n - 1) + n;
+}
+
+var kept = 0;
+for (var n = 0; n < ROUNDS; n++) {
+  kept += (n % 2 == 0) ? keep[n].next.v : keep[n][0];
+}
+var keptExpected = 0;
+for (var n = 0; n < ROUNDS; n++) {
+  keptExpected += n;
+}
+
+if (total == expected && kept == keptExpected) {
+  print(" framebitmap: pass\n");
+} else {
+  $ERROR("test failed total expect ", expected, " but get ", total,
+         ", kept expect ", keptExpected, " but get ", kept, "\n");
+}
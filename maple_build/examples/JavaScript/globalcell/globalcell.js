@@ -0,0 +1,92 @@
+//
+// Copyright (C) [2021] Futurewei Technologies, Inc. All rights reserved.
+//
+// OpenArkCompiler is licensed underthe Mulan Permissive Software License v2.
+// You can use this software according to the terms and conditions of the MulanPSL - 2.0.
+// You may obtain a copy of MulanPSL - 2.0 at:
+//
+//   https://opensource.org/licenses/MulanPSL-2.0
+//
+// THIS SOFTWARE IS PROVIDED ON AN "AS IS" BASIS, WITHOUT WARRANTIES OF ANY KIND, EITHER
+// EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO NON-INFRINGEMENT, MERCHANTABILITY OR
+// FIT FOR A PARTICULAR PURPOSE.
+// See the MulanPSL - 2.0 for more details.
+//
+
+// Global variable sites bind to the global's property cell the first time
+// they run. A write through a bound site must still respect the property:
+// a read-only global keeps its value (a TypeError in strict code) and an
+// accessor global runs its setter and getter, also when the property is
+// redefined after the site was bound.
+
+var ROUNDS = 1000;
+var global = this;
+
+var plain = 0;
+var ro = 1;
+global.acc = 0;  // configurable, so it can become an accessor
+
+function writePlain(v) { plain = v; return plain; }
+function writeRo(v) { ro = v; return ro; }
+function writeAcc(v) { acc = v; return acc; }
+function writeNaN(v) { NaN = v; return NaN; }
+function writeUndefined(v) { undefined = v; return undefined; }
+function strictWriteRo(v) { "use strict"; ro = v; return ro; }
+function strictWriteNaN(v) { "use strict"; NaN = v; return NaN; }
+
+function fail(what, expected, got) {
+  $ERROR(what, " expect ", expected, " but get ", got, "\n");
+}
+
+function expectTypeError(what, f) {
+  for (var i = 0; i < ROUNDS; i++) {
+    var caught = null;
+    try {
+      f(i);
+    } catch (e) {
+      caught = e;
+    }
+    if (!(caught instanceof TypeError)) {
+      fail(what, "TypeError", caught);
+      return;
+    }
+  }
+}
+
+// bind every site while its global is a plain writable data property
+for (var i = 0; i < ROUNDS; i++) {
+  if (writePlain(i) !== i) fail("plain global", i, plain);
+  if (writeRo(i) !== i) fail("writable global", i, ro);
+  if (writeAcc(i) !== i) fail("configurable global", i, acc);
+  if (strictWriteRo(i) !== i) fail("strict writable global", i, ro);
+}
+
+// NaN and undefined are read-only from the start
+for (var i = 0; i < ROUNDS; i++) {
+  var n = writeNaN(i);
+  if (n === n) fail("write to NaN", "NaN", n);
+  if (writeUndefined(i) !== void 0) fail("write to undefined", "undefined", undefined);
+}
+expectTypeError("strict write to NaN", strictWriteNaN);
+
+// read-only after the sites are bound
+Object.defineProperty(global, "ro", { writable: false });
+for (var i = 0; i < ROUNDS; i++) {
+  if (writeRo(i + 1) !== ROUNDS - 1) fail("write to read-only global", ROUNDS - 1, ro);
+}
+expectTypeError("strict write to read-only global", strictWriteRo);
+if (ro !== ROUNDS - 1) fail("read-only global", ROUNDS - 1, ro);
+
+// accessor after the site is bound
+var stored = 0;
+var sets = 0;
+Object.defineProperty(global, "acc", {
+  get: function() { return stored * 2; },
+  set: function(v) { sets++; stored = v; }
+});
+for (var i = 0; i < ROUNDS; i++) {
+  if (writeAcc(i) !== i * 2) fail("accessor global", i * 2, acc);
+}
+if (sets !== ROUNDS) fail("setter calls", ROUNDS, sets);
+
+print(" globalcell: pass\n");
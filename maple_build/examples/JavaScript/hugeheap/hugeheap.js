@@ -0,0 +1,50 @@
+//
+// Copyright (C) [2021] Futurewei Technologies, Inc. All rights reserved.
+//
+// OpenArkCompiler is licensed underthe Mulan Permissive Software License v2.
+// You can use this software according to the terms and conditions of the MulanPSL - 2.0.
+// You may obtain a copy of MulanPSL - 2.0 at:
+//
+//   https://opensource.org/licenses/MulanPSL-2.0
+//
+// THIS SOFTWARE IS PROVIDED ON AN "AS IS" BASIS, WITHOUT WARRANTIES OF ANY KIND, EITHER
+// EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO NON-INFRINGEMENT, MERCHANTABILITY OR
+// FIT FOR A PARTICULAR PURPOSE.
+// See the MulanPSL - 2.0 for more details.
+//
+
+// Heap backing benchmark. It builds a heap of a few hundred MB of small
+// objects and then walks it in a scattered order, so nearly every access
+// lands on a different page. Compare the TLB misses and the run time of the
+// heap backing policies, e.g.
+//   perf stat -e dTLB-load-misses,dTLB-store-misses,page-faults \
+//     "$MAPLE_BUILD_TOOLS"/run-js-app.sh hugeheap.js
+//   MAPLE_HEAP_POLICY=hugepage perf stat ... (same command)
+//   MAPLE_HEAP_POLICY=hugepage,prefault=512 perf stat ...
+// and check AnonHugePages in /proc/<pid>/smaps_rollup while it runs.
+
+var NODES = 2000000;   // about 300MB of objects, properties and arrays
+var STEPS = 20000000;
+var STRIDE = 7919;     // prime, so the walk visits every node
+
+var nodes = new Array(NODES);
+for (var i = 0; i < NODES; i++) {
+  nodes[i] = { id: i, next: null, value: i & 0xff };
+}
+for (var i = 0; i < NODES; i++) {
+  nodes[i].next = nodes[(i + STRIDE) % NODES];
+}
+
+var node = nodes[0];
+var sum = 0;
+for (var s = 0; s < STEPS; s++) {
+  sum += node.value;
+  node.value = (node.value + 1) & 0xff;
+  node = node.next;
+}
+
+if (sum > 0 && node.id == (STEPS * STRIDE) % NODES) {
+  print(" hugeheap: pass\n");
+} else {
+  $ERROR("test failed at node ", node.id, "\n");
+}
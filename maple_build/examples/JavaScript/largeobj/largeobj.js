@@ -0,0 +1,73 @@
+//
+// Copyright (C) [2021] Futurewei Technologies, Inc. All rights reserved.
+//
+// OpenArkCompiler is licensed underthe Mulan Permissive Software License v2.
+// You can use this software according to the terms and conditions of the MulanPSL - 2.0.
+// You may obtain a copy of MulanPSL - 2.0 at:
+//
+//   https://opensource.org/licenses/MulanPSL-2.0
+//
+// THIS SOFTWARE IS PROVIDED ON AN "AS IS" BASIS, WITHOUT WARRANTIES OF ANY KIND, EITHER
+// EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO NON-INFRINGEMENT, MERCHANTABILITY OR
+// FIT FOR A PARTICULAR PURPOSE.
+// See the MulanPSL - 2.0 for more details.
+//
+
+// Large-object benchmark. Every round grows a few arrays element by element
+// to tens of thousands of elements, builds long strings, and keeps a share
+// of them alive, so big blocks of many sizes are freed and reallocated
+// while others stay put. Without a large-object space the big region ends
+// up fragmented and each array growth copies its elements; run with a small
+// heap to see the difference, e.g.
+//   MAPLE_HEAP_SIZE=64 MAPLE_MEM_STATS=1 "$MAPLE_BUILD_TOOLS"/run-js-app.sh largeobj.js
+
+var ROUNDS = 200;
+var ARRAYS = 4;
+var ELEMENTS = 48000;   // divisible by 1..ARRAYS
+var KEEP = 8;         // arrays and strings kept alive across rounds
+
+var kept = new Array(KEEP);
+var keptStrings = new Array(KEEP);
+
+function grow(n, len) {
+  var arr = [];
+  for (var i = 0; i < len; i++) {
+    arr.push(i + n);
+  }
+  return arr;
+}
+
+function longString(n, len) {
+  var s = "x" + n;
+  while (s.length < len) {
+    s = s + s;
+  }
+  return s;
+}
+
+var total = 0;
+for (var n = 0; n < ROUNDS; n++) {
+  for (var a = 0; a < ARRAYS; a++) {
+    var len = ELEMENTS / (a + 1);
+    var arr = grow(n, len);
+    total += arr[len - 1] - n;
+    if (a == 0) {
+      kept[n % KEEP] = arr;
+    }
+  }
+  var s = longString(n, 50000 + (n % 7) * 10000);
+  keptStrings[n % KEEP] = s;
+  total += s.length > 0 ? 1 : 0;
+}
+
+var expected = 0;
+for (var a = 0; a < ARRAYS; a++) {
+  expected += ELEMENTS / (a + 1) - 1;
+}
+expected = (expected + 1) * ROUNDS;
+
+if (total == expected && kept[0].length == ELEMENTS && keptStrings[0].length >= 50000) {
+  print(" largeobj: pass\n");
+} else {
+  $ERROR("test failed total expect ", expected, " but get ", total, "\n");
+}
@@ -0,0 +1,45 @@
+//
+// Copyright (C) [2021] Futurewei Technologies, Inc. All rights reserved.
+//
+// OpenArkCompiler is licensed underthe Mulan Permissive Software License v2.
+// You can use this software according to the terms and conditions of the MulanPSL - 2.0.
+// You may obtain a copy of MulanPSL - 2.0 at:
+//
+//   https://opensource.org/licenses/MulanPSL-2.0
+//
+// THIS SOFTWARE IS PROVIDED ON AN "AS IS" BASIS, WITHOUT WARRANTIES OF ANY KIND, EITHER
+// EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO NON-INFRINGEMENT, MERCHANTABILITY OR
+// FIT FOR A PARTICULAR PURPOSE.
+// See the MulanPSL - 2.0 for more details.
+//
+
+// Double arithmetic sites are quickened on their first run; a zero result
+// must keep its sign on the quickened handlers, which 1/x tells apart.
+
+var ROUNDS = 1000;
+var negZero = -0;
+
+function add(a, b) { return a + b; }
+function sub(a, b) { return a - b; }
+function mul(a, b) { return a * b; }
+function div(a, b) { return a / b; }
+
+function check(name, f, a, b, expected) {
+  for (var i = 0; i < ROUNDS; i++) {
+    var r = 1 / f(a, b);
+    if (r !== expected) {
+      $ERROR(name, " of ", a, " and ", b, ": 1/result expect ", expected, " but get ", r, "\n");
+      return;
+    }
+  }
+}
+
+check("add", add, negZero, negZero, -Infinity);
+check("sub", sub, -0.5, -0.5, Infinity);
+check("add", add, 0.5, -0.5, Infinity);
+check("mul", mul, negZero, 2.5, -Infinity);
+check("mul", mul, -2.5, negZero, Infinity);
+check("div", div, negZero, 2.5, -Infinity);
+check("div", div, 1.5, -Infinity, -Infinity);
+
+print(" negzero: pass\n");
@@ -0,0 +1,57 @@
+//
+// Copyright (C) [2021] Futurewei Technologies, Inc. All rights reserved.
+//
+// OpenArkCompiler is licensed underthe Mulan Permissive Software License v2.
+// You can use this software according to the terms and conditions of the MulanPSL - 2.0.
+// You may obtain a copy of MulanPSL - 2.0 at:
+//
+//   https://opensource.org/licenses/MulanPSL-2.0
+//
+// THIS SOFTWARE IS PROVIDED ON AN "AS IS" BASIS, WITHOUT WARRANTIES OF ANY KIND, EITHER
+// EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO NON-INFRINGEMENT, MERCHANTABILITY OR
+// FIT FOR A PARTICULAR PURPOSE.
+// See the MulanPSL - 2.0 for more details.
+//
+
+// Long-running allocation benchmark for reference counts past 14 bits.
+// Every round builds an object that more than 16383 array elements refer
+// to, together with a sizable payload, and then drops all of it. When such
+// counts saturate, every round leaks its object and payload and the heap
+// grows until the engine runs out of it; run with a small heap, e.g.
+//   MAPLE_HEAP_SIZE=64 "$MAPLE_BUILD_TOOLS"/run-js-app.sh rcoverflow.js
+
+var ROUNDS = 2000;
+var REFS = 20000;     // references to the shared object, > 16383
+var PAYLOAD = 4096;   // numbers hanging off the shared object
+
+function round(n) {
+  var shared = { id: n, payload: new Array(PAYLOAD) };
+  for (var i = 0; i < PAYLOAD; i++) {
+    shared.payload[i] = i + n;
+  }
+  var refs = new Array(REFS);
+  for (var i = 0; i < REFS; i++) {
+    refs[i] = shared;
+  }
+  var sum = 0;
+  for (var i = 0; i < REFS; i += 1000) {
+    sum += refs[i].id;
+  }
+  return sum;
+}
+
+var total = 0;
+for (var n = 0; n < ROUNDS; n++) {
+  total += round(n);
+}
+
+var expected = 0;
+for (var n = 0; n < ROUNDS; n++) {
+  expected += n * (REFS / 1000);
+}
+
+if (total == expected) {
+  print(" rcoverflow: pass\n");
+} else {
+  $ERROR("test failed total expect ", expected, " but get ", total, "\n");
+}
@@ -0,0 +1,34 @@
+//
+// Copyright (C) [2021] Futurewei Technologies, Inc. All rights reserved.
+//
+// OpenArkCompiler is licensed underthe Mulan Permissive Software License v2.
+// You can use this software according to the terms and conditions of the MulanPSL - 2.0.
+// You may obtain a copy of MulanPSL - 2.0 at:
+//
+//   https://opensource.org/licenses/MulanPSL-2.0
+//
+// THIS SOFTWARE IS PROVIDED ON AN "AS IS" BASIS, WITHOUT WARRANTIES OF ANY KIND, EITHER
+// EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO NON-INFRINGEMENT, MERCHANTABILITY OR
+// FIT FOR A PARTICULAR PURPOSE.
+// See the MulanPSL - 2.0 for more details.
+//
+
+// Start-up benchmark. The script does little beyond touching the builtins,
+// so its run time is mostly VM start-up. The first run with
+// MAPLE_HEAP_IMAGE set writes a heap image with every builtin created;
+// later runs map it instead of building the builtins, e.g.
+//   perf stat -r 20 "$MAPLE_BUILD_TOOLS"/run-js-app.sh startup.js
+//   MAPLE_HEAP_IMAGE=/tmp/startup.img "$MAPLE_BUILD_TOOLS"/run-js-app.sh startup.js
+//   MAPLE_HEAP_IMAGE=/tmp/startup.img perf stat -r 20 ... (same command)
+// The image is written again whenever the runtime or the app is rebuilt.
+
+var parts = "a,b,c".split(",");
+var date = new Date(0);
+var text = JSON.stringify({ parts: parts, year: date.getUTCFullYear() });
+var check = Math.max(parts.length, 2) + Number("1") + String(true).length;
+
+if (text == '{"parts":["a","b","c"],"year":1970}' && check == 8) {
+  print(" startup: pass\n");
+} else {
+  $ERROR("test failed: ", text, " ", check, "\n");
+}
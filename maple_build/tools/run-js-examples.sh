@@ -0,0 +1,78 @@
+#!/bin/bash
+#
+# Copyright (C) [2021] Futurewei Technologies, Inc. All rights reserved.
+#
+# OpenArkCompiler is licensed underthe Mulan Permissive Software License v2.
+# You can use this software according to the terms and conditions of the MulanPSL - 2.0.
+# You may obtain a copy of MulanPSL - 2.0 at:
+#
+#   https://opensource.org/licenses/MulanPSL-2.0
+#
+# THIS SOFTWARE IS PROVIDED ON AN "AS IS" BASIS, WITHOUT WARRANTIES OF ANY KIND, EITHER
+# EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO NON-INFRINGEMENT, MERCHANTABILITY OR
+# FIT FOR A PARTICULAR PURPOSE.
+# See the MulanPSL - 2.0 for more details.
+#
+
+
+# Build and run the JavaScript examples and check that each one prints
+# "<name>: pass". The engine-path examples run with the settings that
+# exercise them: a small heap for the reference count overflow and
+# large-object examples, and a heap image written and then mapped for
+# startup.
+# using: run-js-examples.sh [-all]
+#   -all also runs hugeheap, which needs a heap of about 1GB
+
+for v in BUILD_ROOT; do
+    eval x=\$MAPLE_$v
+    [ -n "$x" ] || { echo MAPLE_$v not set. Please source envsetup.sh.; exit 1; }
+done
+
+EXAMPLES="$MAPLE_BUILD_ROOT"/examples/JavaScript
+RUN="$(cd "$(dirname -- "$0")" && pwd)"/run-js-app.sh
+WORK="$(mktemp -d)"
+trap 'rm -rf "$WORK"' EXIT
+failed=0
+
+# run_example <name> [VAR=value ...]
+run_example() {
+    name=$1
+    shift
+    mkdir -p "$WORK/$name"
+    cp "$EXAMPLES/$name/$name.js" "$WORK/$name"/
+    out="$(cd "$WORK/$name" && env "$@" "$RUN" "$name.js" 2>&1)"
+    status=$?
+    if [ $status -eq 0 ] && echo "$out" | grep -q " $name: pass"; then
+        echo "PASS $name $*"
+    else
+        echo "FAIL $name $* (exit $status)"
+        echo "$out" | tail -n 20
+        failed=$((failed + 1))
+    fi
+}
+
+run_example add
+run_example framebitmap
+run_example errorvalue
+run_example globalcell
+run_example negzero
+# counts past 14 bits must not leak: 2000 rounds of about 200KB each only
+# fit a 64MB heap when every round is freed
+run_example rcoverflow MAPLE_HEAP_SIZE=64
+run_example largeobj MAPLE_HEAP_SIZE=64 MAPLE_MEM_STATS=1
+# the first run writes the image, the second maps it
+run_example startup MAPLE_HEAP_IMAGE="$WORK/startup.img"
+if [ ! -f "$WORK/startup.img" ]; then
+    echo "FAIL startup: no heap image written"
+    failed=$((failed + 1))
+fi
+run_example startup MAPLE_HEAP_IMAGE="$WORK/startup.img"
+if [ "x$1" = "x-all" ]; then
+    run_example hugeheap MAPLE_HEAP_SIZE=1024 MAPLE_HEAP_POLICY=hugepage
+fi
+
+if [ $failed -ne 0 ]; then
+    echo "$failed example run(s) failed"
+    exit 1
+fi
+echo "all example runs passed"
@@ -127,6 +127,20 @@ namespace maple {
 // FuncAttrJSArgument = 1 << 5
 #define FUNCATTRARGUMENT 0x20
 #define MAXREGNUM 0x60
+// localWordsTypeTagged/localWordsRefCounted are inline bitmaps over the 4-byte frame words;
+// bit n describes the word at fp - (n + 1) * 4, so the 8-byte slot at fp - (i + 1) * 8 is
+// covered by bits 2i and 2i + 1. Larger frames are scanned slot by slot.
+#define FRAMEBITMAPWORDS 32
+
+    // Bookkeeping of a JS call that is run in the caller's dispatch loop
+    struct DynCallState {
+      int32_t offset;      // PassArguments offset, popped on return
+      TValue thisArg;
+      TValue oldThis;
+      TValue oldArgs;      // caller's "arguments" binding when the callee uses its own
+      bool strict;
+      void *oldFileInfo;   // plugin context to restore on return, or nullptr
+    };
 
     class DynMFunction {
       public:
@@ -141,7 +155,10 @@ namespace maple {
           uint64_t                      sp;            // evaluation stack pointer
           TValue                       *operand_stack; // for locals, return value, throw value and evaluation stack
           uint8_t                      *lib_addr;
-          TValue                        regStack[MAXREGNUM];
+          TValue                       *regStack;      // pseudo registers, laid out right below operand_stack
+          uint32_t                      regCount;      // reg_count(header)
+          DynMFunction                 *caller;        // set for frames pushed by a stackless call
+          DynCallState                  callState;
 
      public:
       bool is_strict() { // function is strict
@@ -150,6 +167,26 @@ namespace maple {
       static bool is_jsargument(DynamicMethodHeaderT * hd) { // function is using jsargument
         return hd->attribute & FUNCATTRARGUMENT;
       }
+      // pseudo registers the method uses, at most MAXREGNUM; see InterSource::RegCount
+      static uint32_t reg_count(DynamicMethodHeaderT * hd);
+      // registers followed by the evaluation stack; operand_stack[0] is a sentinel slot
+      static uint32_t stack_slots(DynamicMethodHeaderT * hd) {
+        return reg_count(hd) + hd->evalStackDepth + 1;
+      }
+      static bool has_frame_bitmap(DynamicMethodHeaderT * hd) { // frame fully described by the local bitmaps
+        return hd->frameSize <= FRAMEBITMAPWORDS * sizeof(uint32_t);
+      }
+      // 8-byte slots that may hold a reference: bit i is set when either word of
+      // slot i is flagged, i.e. bit 2i or 2i + 1 of the word bitmaps
+      static uint32_t frame_ref_slots(DynamicMethodHeaderT * hd) {
+        uint32_t words = hd->localWordsTypeTagged | hd->localWordsRefCounted;
+        uint32_t slots = (words | (words >> 1)) & 0x55555555;
+        slots = (slots | (slots >> 1)) & 0x33333333;
+        slots = (slots | (slots >> 2)) & 0x0f0f0f0f;
+        slots = (slots | (slots >> 4)) & 0x00ff00ff;
+        slots = (slots | (slots >> 8)) & 0x0000ffff;
+        return slots;
+      }
       void MarkArgumentsDeleted(uint32_t index) {
         assert(index < 32 && "arguments too much");
         argumentsDeleted |= (0x1 << index);
@@ -163,6 +200,7 @@ namespace maple {
     MValue maple_invoke_method(const method_header_t* const mir_header, const MFunction *caller);
     TValue maple_invoke_dynamic_method(DynamicMethodHeaderT* cheader, void *);
     TValue maple_invoke_dynamic_method_main(uint8_t *mPC, DynamicMethodHeaderT* cheader);
+    void maple_invalidate_prop_cache();
 
 }
 #endif // MAPLERE_MFUNCTION_H_
@@ -0,0 +1,125 @@
+/*
+ * Copyright (C) [2021] Futurewei Technologies, Inc. All rights reserved.
+ *
+ * OpenArkCompiler is licensed under the Mulan Permissive Software License v2.
+ * You can use this software according to the terms and conditions of the MulanPSL - 2.0.
+ * You may obtain a copy of MulanPSL - 2.0 at:
+ *
+ *   https://opensource.org/licenses/MulanPSL-2.0
+ *
+ * THIS SOFTWARE IS PROVIDED ON AN "AS IS" BASIS, WITHOUT WARRANTIES OF ANY KIND, EITHER
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO NON-INFRINGEMENT, MERCHANTABILITY OR
+ * FIT FOR A PARTICULAR PURPOSE.
+ * See the MulanPSL - 2.0 for more details.
+ */
+
+#ifndef MAPLERE_MISOLATE_H_
+#define MAPLERE_MISOLATE_H_
+
+#include "mshimdyn.h"
+
+namespace maple {
+
+// An isolate is one instance of the JS VM: its own heap, stack, module
+// globals, builtin objects and interpreter state.  The VM finds its state
+// in per-thread globals (gInterSource, memory_manager, jsGlobal, the
+// builtins, the property cache, ...), so entering an isolate installs its
+// state on the calling thread and exiting saves it back.  Isolates on
+// different threads run in parallel; an isolate must be entered on only
+// one thread at a time, and objects must not be passed between isolates.
+class Isolate {
+ public:
+  // Loads the module at app_path and creates the VM state for it.  The
+  // isolate is not entered; returns null if the module cannot be loaded.
+  static Isolate *New(const char *app_path);
+  // The isolate entered on the calling thread, or null.
+  static Isolate *Current() {
+    return current_;
+  }
+
+  // Make this isolate the one the VM runs on the calling thread.  The
+  // isolate entered before is saved and comes back on Exit().
+  void Enter();
+  void Exit();
+  // Run a module main function (its __jsmain symbol) on the entered isolate.
+  TValue Run(void *main_fn);
+  TValue RunMain() {
+    return Run(main_fn_);
+  }
+  // Make the module at app_path the main one, with fresh globals, keeping
+  // the heap and the builtins; the isolate must be entered and idle, and
+  // the heap must not refer to the globals of the old main module.  Modules
+  // preloaded but not yet required are kept.
+  bool ReplaceMain(const char *app_path);
+
+  // Embedding: once RunMain() has set the module up, its functions can be
+  // looked up and called any number of times on the warm heap.  The isolate
+  // must be entered.
+  // A name is looked up in module.exports, then on the global object; the
+  // result is undefined if neither has it.
+  TValue GetExport(const char *name);
+  // Call fn with this_arg and nargs arguments (at most MAXCALLARGNUM).
+  // Returns false if it threw, with the thrown value in *result.  The
+  // result is only held until the next call; Retain() it to keep it.
+  bool Call(TValue fn, TValue this_arg, TValue *args, uint32_t nargs, TValue *result);
+  bool Call(const char *name, TValue *args, uint32_t nargs, TValue *result);
+  TValue NewString(const char *str);
+  static void Retain(TValue val);
+  static void Release(TValue val);
+
+  // Heap images (see vmheapimage.h): WarmUp() creates every builtin object
+  // up front, WriteImage() saves the heap with the builtins and the module
+  // globals, and ReadImage() maps an image into an isolate that has not run
+  // anything yet instead of building the same heap again.  The isolate must
+  // be entered and idle, and must not have loaded modules with require().
+  void WarmUp();
+  bool WriteImage(const char *path);
+  bool ReadImage(const char *path);
+  // Free the heap and everything else the isolate owns.  It must not be
+  // entered on any thread.
+  void Dispose();
+
+  InterSource *GetInterSource() {
+    return inter_source_;
+  }
+  MemoryManager *GetMemoryManager() {
+    return memory_manager_;
+  }
+
+ private:
+  Isolate();
+  void InstallMain(uint16_t *mpljsMdD);
+  void Save();
+  void Load();
+  static void Unload();
+
+  char *app_path_;
+  void *handle_;    // dlopen handle of the main module
+  void *main_fn_;   // its __jsmain
+  bool entered_;
+  Isolate *prev_;   // entered before this one on the same thread
+
+  // The per-thread VM state while the isolate is not entered.
+  InterSource *inter_source_;
+  MemoryManager *memory_manager_;
+  JavaScriptGlobal *js_global_;
+  uint32_t *js_global_memmap_;
+  TValue global_this_binding_;
+  TValue this_binding_;
+  TValue outer_binding_;
+  bool global_strict_;
+  __jsobject *builtins_[JSBUILTIN_LAST_OBJECT];
+#ifdef MARK_CYCLE_ROOTS
+  CycleRoot *cycle_roots_;
+  CycleRoot *garbage_roots_;
+#else
+  __jsobject *obj_list_;
+#endif
+  bool is_sweep_;
+
+  static thread_local Isolate *current_;
+};
+
+}  // namespace maple
+
+#endif  // MAPLERE_MISOLATE_H_
@@ -19,7 +19,10 @@
 #include "mval.h"
 #include "mvalue.h"
 #include "jsplugin.h"
+#include <map>
+#include <unordered_map>
 
+struct __jsprop;
 
 namespace maple {
 
@@ -29,6 +32,34 @@ namespace maple {
 #define JSEHOP_jscatch 0x3
 #define JSEHOP_finally 0x4
 
+// JS-to-JS calls run in the caller's dispatch loop; their frames live in a
+// dedicated call stack and their nesting is bounded by a RangeError.
+#define MAX_JS_CALL_DEPTH 10000
+#define JS_CALL_STACK_SIZE (16 * 1024 * 1024)
+// The call stack is only reserved up front; it is made writable in steps of
+// this size as calls nest.
+#define JS_CALL_STACK_GRANULE (64 * 1024)
+// Their locals and arguments go on the VM stack, which must keep this much
+// room above the heap for the calls that do not check.
+#define VM_STACK_GUARD (64 * 1024)
+
+// Global variable sites bind to a property cell the first time they run; the
+// cell index is kept in a spare 16-bit operand of the fused instruction.
+#define MAX_GLOBAL_PROP_CELLS 0xFFFF
+
+struct GlobalPropCell {
+  __jsstring *name;
+  __jsprop *prop;  // data property on the global object, reloaded when epoch changes
+  uint32_t epoch;
+};
+
+// Direct-mapped front of InterSource::regCounts, so that a call finds the
+// register count of its callee with one compare.
+#define REG_COUNT_CACHE_SIZE 1024
+struct RegCountEntry {
+  DynamicMethodHeaderT *header;
+  uint32_t count;
+};
 
 struct JavaScriptGlobal {
   uint8_t flavor;
@@ -48,6 +79,7 @@ public:
   void *memory;  // memory block for APP and VM
   uint32_t total_memory_size_;
   uint32_t heap_size_;
+  uint32_t los_size_;  // large-object space reserved right above the heap
   uint32_t stack;
   uint32_t heap;
   uint32_t sp;  // stack pointer
@@ -58,6 +90,24 @@ public:
   // AddrMap *globalRefList;   // ref used in global memory
   TValue retVal0;
   JsEh *currEH;
+  uint8_t *callStack;  // DynMFunction and register/eval stack blocks of stackless calls
+  uint32_t callStackTop;
+  uint32_t callStackSize;
+  uint32_t callStackCommitted;  // bytes of callStack that are writable
+  uint32_t callDepth;
+  uint32_t maxCallDepth;
+  uint32_t interpDepth;      // nested InvokeInterpretMethod activations
+  DynMFunction *rcScanTop;   // innermost frame of a deferred RC safe point
+  GlobalPropCell *globalCells;
+  uint32_t globalCellNum;
+  uint32_t globalCellCap;
+  uint32_t globalCellEpoch;  // bumped when a global property is freed
+  std::map<__jsstring *, uint32_t> globalCellIndex;
+  // Pseudo register counts of the methods run so far.  Keyed by header
+  // address, so ClearRegCounts() must run whenever module code may be
+  // unmapped and another module mapped in its place.
+  RegCountEntry regCountCache[REG_COUNT_CACHE_SIZE];
+  std::unordered_map<DynamicMethodHeaderT *, uint32_t> regCounts;
   JsPlugin *jsPlugin;
   uint32_t EHstackReuseSize;
   StackT<JsEh *> EHstackReuse;
@@ -68,6 +118,7 @@ public:
 
 public:
   explicit InterSource();
+  ~InterSource();
   void SetRetval0(TValue &);
   void SetRetval0Object(void *, bool);
   void SetRetval0NoInc (uint64_t);
@@ -128,16 +179,31 @@ public:
   TValue NativeFuncCall(MIRIntrinsicID, TValue *, int);
   TValue BoundFuncCall(TValue *, int);
   TValue FuncCall(void *, bool, void *, TValue *, int, int, int, bool);
+  void *FuncCallEnter(void *, bool, void *, TValue *, int, int, int, bool, DynCallState &);
+  void FuncCallExit(DynamicMethodHeaderT *, DynCallState &);
+  bool HasVMStackRoom(DynamicMethodHeaderT *, int32_t);
+  void CheckVMStackRoom(DynamicMethodHeaderT *, int32_t);
+  bool CanPushDynFrame(DynamicMethodHeaderT *, int32_t);
+  bool CommitCallStack(uint32_t);
+  DynMFunction *PushDynFrame(DynamicMethodHeaderT *, void *, DynMFunction *);
+  void PopDynFrame(DynMFunction *);
   TValue IntrinCCall(TValue *, int);
   TValue FuncCall_JS(__jsobject*, TValue &, void *, TValue *, int32_t);
   void JsTry(void *, void *, void *, DynMFunction *);
   void JSPrint(TValue);
   void IntrnError(TValue *, int);
-  void InsertProlog(uint16);
+  void InsertProlog(DynamicMethodHeaderT *);
   void InsertEplog();
+  void ReleaseFrame(DynamicMethodHeaderT *, uint8 *, uint8 *);
+  void ReconcileDeferredRC(DynMFunction *);
+  bool WriteHeapSnapshot(const char *, DynMFunction *);
+  void TakePendingHeapSnapshot(DynMFunction *);
   TValue JSopGetArgumentsObject(void *);
   void* CreateArgumentsObject(TValue *, uint32_t, TValue &);
   TValue GetOrCreateBuiltinObj(__jsbuiltin_object_id);
+  __jsbuiltin_object_id ErrorId(const char *);
+  TValue ErrorValue(const char *);
+  TValue RaiseError(__jsbuiltin_object_id);
   void JSdoubleConst(uint64_t, TValue &);
   TValue JSIsNan(TValue &);
   TValue JSDate(uint32_t, TValue *);
@@ -146,6 +212,34 @@ public:
   void JSopSetThisPropByName (TValue &, TValue &);
   void JSopInitThisPropByName(TValue &);
   TValue JSopGetThisPropByName(TValue &);
+  int32_t BindGlobalCell(__jsstring *);
+  uint32_t RegCount(DynamicMethodHeaderT *header) {
+    RegCountEntry &entry = regCountCache[((uintptr_t)header >> 3) & (REG_COUNT_CACHE_SIZE - 1)];
+    if (entry.header != header) {
+      entry.count = LookupRegCount(header);
+      entry.header = header;
+    }
+    return entry.count;
+  }
+  uint32_t LookupRegCount(DynamicMethodHeaderT *);
+  void ClearRegCounts();
+  __jsprop *RefreshGlobalCell(GlobalPropCell &);
+  // The cell index is patched into the module code, which is shared by all
+  // isolates that loaded the module, so it may name another isolate's cell.
+  inline __jsprop *GlobalCellProp(uint32_t idx, __jsstring *name) {
+    if (idx >= globalCellNum || globalCells[idx].name != name) {
+      int32_t own = BindGlobalCell(name);
+      if (own < 0) {
+        return nullptr;
+      }
+      idx = own;
+    }
+    GlobalPropCell &cell = globalCells[idx];
+    if (cell.prop && cell.epoch == globalCellEpoch) {
+      return cell.prop;
+    }
+    return RefreshGlobalCell(cell);
+  }
   void UpdateArguments(int32_t, TValue &);
   void SetCurFunc(DynMFunction *func) {
     curDynFunction = func;
@@ -237,8 +331,9 @@ inline void SetMValueValue (MValue &mv, uint64_t val) {
 inline void SetMValueTag (MValue &mv, uint32_t ptyp) {
   mv.ptyp = ptyp;
 }
-extern JavaScriptGlobal *jsGlobal;
-extern uint32_t *jsGlobalMemmap;
-extern InterSource *gInterSource;
+// The interpreter state of the isolate running on this thread.
+extern VM_TLS JavaScriptGlobal *jsGlobal;
+extern VM_TLS uint32_t *jsGlobalMemmap;
+extern VM_TLS InterSource *gInterSource;
 
 }
@@ -0,0 +1,61 @@
+/*
+ * Copyright (C) [2021] Futurewei Technologies, Inc. All rights reserved.
+ *
+ * OpenArkCompiler is licensed under the Mulan Permissive Software License v2.
+ * You can use this software according to the terms and conditions of the MulanPSL - 2.0.
+ * You may obtain a copy of MulanPSL - 2.0 at:
+ *
+ *   https://opensource.org/licenses/MulanPSL-2.0
+ *
+ * THIS SOFTWARE IS PROVIDED ON AN "AS IS" BASIS, WITHOUT WARRANTIES OF ANY KIND, EITHER
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO NON-INFRINGEMENT, MERCHANTABILITY OR
+ * FIT FOR A PARTICULAR PURPOSE.
+ * See the MulanPSL - 2.0 for more details.
+ */
+
+#ifndef MAPLERE_MZYGOTE_H_
+#define MAPLERE_MZYGOTE_H_
+
+#include <map>
+#include <sys/types.h>
+#include "misolate.h"
+
+namespace maple {
+
+// A zygote is a process holding a warm isolate, with the builtins created
+// and the preloaded modules mapped, that forks a child for each app to run.
+// The children share the zygote's pages copy-on-write, so an app costs a
+// fork and its own run instead of a VM start-up.
+//
+// mplsh serves as a zygote when MAPLE_ZYGOTE_SERVE is a socket path, and
+// as a client of the zygote listening there when MAPLE_ZYGOTE is.  A client
+// passes its app path, working directory and standard streams over the
+// local socket; the child runs the app in place of the client, and the
+// zygote sends back its exit status.  Children report their RSS and PSS
+// before exiting, which the client prints with MAPLE_MEM_STATS.  Children
+// run with the zygote's environment.
+class Zygote {
+ public:
+  explicit Zygote(Isolate *isolate);
+  // Map the modules of a colon-separated list of paths into the zygote.
+  void Preload(const char *paths);
+  // Serve requests on the socket at path.  Returns only on failure, in the
+  // zygote; the children exit when their app is done.
+  int Serve(const char *path);
+
+  // Run app_path in the zygote listening at path.  Returns false if none
+  // does; otherwise *status is the app's exit status.
+  static bool Run(const char *path, const char *app_path, int64_t *status);
+
+ private:
+  void Reap();
+  void Child(int conn);
+
+  Isolate *isolate_;
+  int listen_fd_;
+  std::map<pid_t, int> children_;  // pid to the connection of its client
+};
+
+}  // namespace maple
+
+#endif  // MAPLERE_MZYGOTE_H_
@@ -15,7 +15,14 @@
 
 #include <cstdio>
 #include <cmath>
+#include <atomic>
+#include <mutex>
 #include <climits>
+#include <cstring>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <dlfcn.h>
+#include <link.h>
 
 #include "ark_mir_emit.h"
 
@@ -39,6 +46,7 @@
 #include "jsiter.h"
 #include "jsvalueinline.h"
 #include "jsobject.h"
+#include "jsobjectinline.h"
 #include "jseh.h"
 #include "jstycnv.h"
 
@@ -303,6 +311,214 @@ static void PrintUncaughtException(__jsstring *msg) {
   }\
 }
 
+// Opcode numbering: the op byte indexes labels[], so quickened opcodes follow
+// the ones the compiler emits.
+enum QuickenedOpcode {
+  QOP_undef = 0,
+#define OPCODE(base_node,dummy1,dummy2,dummy3) QOP_base_##base_node,
+#include "mre_opcodes.def"
+#undef OPCODE
+#define QOPCODE(name) QOP_##name,
+#include "mre_quickened_opcodes.def"
+#undef QOPCODE
+  QOP_last
+};
+static_assert(QOP_last <= 256, "quickened opcodes must fit in the op byte");
+
+// Quickening rewrites the op byte of a loaded method in place. The pages of
+// a site are made writable for the store only and then get back the
+// protection the loader gave them, so module code never stays writable. If
+// that is refused every site simply stays on its generic handler.
+//
+// Module code is shared by the isolates of every thread. Rewrites are
+// serialized by quicken_lock so one thread never restores the protection
+// under another's store; threads running the code meanwhile see each byte or
+// 16-bit operand either old or new, as every store is a single atomic one
+// whose old and new values are both valid. A quickened handler checks its
+// operand types and falls back to the generic path, whichever variant it
+// reads. A cell index is checked against the name by GlobalCellProp() before
+// use, so a site seen with variant 11 but an index stored by another
+// isolate only rebinds its cell.
+static std::atomic<bool> quicken_failed(false);
+static std::mutex quicken_lock;
+
+static inline bool QuickenEnabled() {
+  return !quicken_failed.load(std::memory_order_relaxed) && !(debug_engine & kEngineDebuggerOn);
+}
+
+struct CodeSegment {
+  uintptr_t addr;
+  int prot;
+};
+
+// dl_iterate_phdr callback: the protection of the loaded segment holding
+// addr, less PROT_WRITE once the loader has made it read-only after relocation.
+static int FindCodeSegment(struct dl_phdr_info *info, size_t, void *data) {
+  CodeSegment *seg = (CodeSegment *)data;
+  bool found = false;
+  bool relro = false;
+  for (int i = 0; i < info->dlpi_phnum; i++) {
+    const ElfW(Phdr) &ph = info->dlpi_phdr[i];
+    uintptr_t start = info->dlpi_addr + ph.p_vaddr;
+    if (seg->addr < start || seg->addr >= start + ph.p_memsz) {
+      continue;
+    }
+    if (ph.p_type == PT_LOAD) {
+      seg->prot = ((ph.p_flags & PF_R) ? PROT_READ : 0) | ((ph.p_flags & PF_W) ? PROT_WRITE : 0) |
+                  ((ph.p_flags & PF_X) ? PROT_EXEC : 0);
+      found = true;
+    } else if (ph.p_type == PT_GNU_RELRO) {
+      relro = true;
+    }
+  }
+  if (found && relro) {
+    seg->prot &= ~PROT_WRITE;
+  }
+  return found;
+}
+
+// Holds quicken_lock and keeps the pages of [addr, addr + len) writable for
+// its lifetime.
+class CodePatch {
+ public:
+  CodePatch(void *addr, size_t len) : guard(quicken_lock) {
+    uintptr_t pageSize = (uintptr_t)sysconf(_SC_PAGESIZE);
+    page = (uintptr_t)addr & ~(pageSize - 1);
+    size = (((uintptr_t)addr + len + pageSize - 1) & ~(pageSize - 1)) - page;
+    CodeSegment seg = { (uintptr_t)addr, 0 };
+    ok = dl_iterate_phdr(FindCodeSegment, &seg) != 0;
+    prot = seg.prot;
+    if (ok && !(prot & PROT_WRITE)) {
+      ok = mprotect((void *)page, size, prot | PROT_WRITE) == 0;
+    }
+    if (!ok) {
+      quicken_failed.store(true, std::memory_order_relaxed);
+    }
+  }
+  ~CodePatch() {
+    if (ok && !(prot & PROT_WRITE)) {
+      mprotect((void *)page, size, prot);
+    }
+  }
+  bool ok;
+
+ private:
+  std::lock_guard<std::mutex> guard;
+  uintptr_t page;
+  size_t size;
+  int prot;
+};
+
+static void QuickenOp(uint8_t *pc, uint8_t op) {
+  CodePatch patch(pc, sizeof(uint8_t));
+  if (patch.ok) {
+    __atomic_store_n(pc, op, __ATOMIC_RELEASE);
+  }
+}
+
+// Turn a fused GET/SET_THIS_PROP_BY_NAME (variant 10) into variant 11, which
+// reads and writes the global through the property cell stored in v1. The
+// index is stored before the variant.
+#define BINDGLOBALCELL(stmt, values) \
+  if (QuickenEnabled()) { \
+    int32_t cellIdx = gInterSource->BindGlobalCell((__jsstring *)(global_pointer + values.v0)); \
+    int16_t *cellSlot = (int16_t *)((uint8_t *)&stmt + sizeof(base_node_t)) + 1; \
+    if (cellIdx >= 0) { \
+      CodePatch patch(&stmt, sizeof(base_node_t) + 2 * sizeof(int16_t)); \
+      if (patch.ok) { \
+        __atomic_store_n(cellSlot, (int16_t)cellIdx, __ATOMIC_RELEASE); \
+        __atomic_store_n(&stmt.param.value, (decltype(stmt.param.value))11, __ATOMIC_RELEASE); \
+      } \
+    } \
+  }
+
+// Type feedback for a generic arithmetic or compare-branch site: the first
+// operand pair it sees picks int32, double or (for anything else) generic.
+#define QUICKEN_SITE(name, ptyp) \
+  if (QuickenEnabled() && IsPrimitiveDyn(ptyp)) { \
+    uint64_t qv0 = func_operand_stack[func_sp - 1].x.u64; \
+    uint64_t qv1 = func_operand_stack[func_sp].x.u64; \
+    if (IS_NUMBER(qv0) && IS_NUMBER(qv1)) { \
+      QuickenOp(func_pc, QOP_##name##i32); \
+      goto label_OP_##name##i32; \
+    } else if (IS_DOUBLE(qv0) && IS_DOUBLE(qv1)) { \
+      QuickenOp(func_pc, QOP_##name##f64); \
+      goto label_OP_##name##f64; \
+    } \
+    QuickenOp(func_pc, QOP_##name##generic); \
+  }
+
+// A quickened site whose operands no longer match is deoptimized for good.
+#define DEOPTIMIZE_SITE(name) { \
+    QuickenOp(func_pc, QOP_##name##generic); \
+    goto label_OP_##name##generic; \
+  }
+
+#define QUICK_ARITH_I32(name, o) \
+label_OP_##name##i32: \
+  { \
+    DEBUGOPCODE(name##i32, Expr); \
+    TValue &op1 = func_operand_stack[func_sp]; \
+    TValue &op0 = func_operand_stack[func_sp - 1]; \
+    if (!IS_NUMBER(op0.x.u64) || !IS_NUMBER(op1.x.u64)) \
+      DEOPTIMIZE_SITE(name); \
+    int64_t r = (int64_t)op0.x.i32 o (int64_t)op1.x.i32; \
+    if (ABS(r) > INT_MAX) { \
+      op0.x.f64 = (double)r; \
+    } else { \
+      op0.x.i32 = r; \
+    } \
+    func_sp--; \
+    func_pc += sizeof(binary_node_t); \
+    goto *(labels[*func_pc]); \
+  }
+
+// results the fast path can't represent (Infinity, NaN) take the generic
+// handler without deoptimizing the site; a zero result keeps its IEEE sign,
+// -0 stays a double and +0 becomes the number 0
+#define QUICK_ARITH_F64(name, o) \
+label_OP_##name##f64: \
+  { \
+    DEBUGOPCODE(name##f64, Expr); \
+    TValue &op1 = func_operand_stack[func_sp]; \
+    TValue &op0 = func_operand_stack[func_sp - 1]; \
+    if (!IS_DOUBLE(op0.x.u64) || !IS_DOUBLE(op1.x.u64)) \
+      DEOPTIMIZE_SITE(name); \
+    double r = op0.x.f64 o op1.x.f64; \
+    if (r == 0) { \
+      op0.x.u64 = std::signbit(r) ? NEG_ZERO : POS_ZERO; \
+    } else if (ABS(r) <= NumberMaxValue) { \
+      op0.x.f64 = r; \
+    } else { \
+      goto label_OP_##name##generic; \
+    } \
+    func_sp--; \
+    func_pc += sizeof(binary_node_t); \
+    goto *(labels[*func_pc]); \
+  }
+
+#define QUICK_CMPBR(name, o, T, check) \
+label_OP_##name##T: \
+  { \
+    mre_instr_t &expr = *(reinterpret_cast<mre_instr_t *>(func_pc)); \
+    condgoto_stmt_t &stmt = *(reinterpret_cast<condgoto_stmt_t *>(func_pc)); \
+    DEBUGOPCODE(name##T, Expr); \
+    TValue &mVal1 = func_operand_stack[func_sp]; \
+    TValue &mVal0 = func_operand_stack[func_sp - 1]; \
+    if (!check(mVal0.x.u64) || !check(mVal1.x.u64)) \
+      DEOPTIMIZE_SITE(name); \
+    func_sp -= 2; \
+    if ((mVal0.x.T o mVal1.x.T) == expr.param.type.numOpnds) \
+      func_pc = (uint8_t*)&stmt.offset + stmt.offset; \
+    else \
+      func_pc += sizeof(condgoto_stmt_t); \
+    goto *(labels[*func_pc]); \
+  }
+
+#define QUICK_CMPBR_PAIR(name, o) \
+  QUICK_CMPBR(name, o, i32, IS_NUMBER) \
+  QUICK_CMPBR(name, o, f64, IS_DOUBLE)
+
 #define CHECKREFERENCEMVALUE_NO_GOTO(mv) \
     if (IS_NONE(mv.x.u64)) {\
        if (!gInterSource->currEH) {\
@@ -314,6 +530,36 @@ static void PrintUncaughtException(__jsstring *msg) {
        return;\
     }\
 
+// Leave the current frame. A frame pushed by a stackless call hands the value to its
+// caller in the same dispatch loop instead of returning to C++.
+#define RETURN_FROM_FRAME(v) { \
+    frame_ret = (v); \
+    if (!func.caller) { \
+      return frame_ret; \
+    } \
+    goto label_frame_return; \
+}
+
+// Deferred RC safe point: stack roots are only reconciled when no native
+// frame sits between this loop and the program entry.
+#ifdef RC_DEFER_STACK
+#define RC_SAFEPOINT() \
+    if (memory_manager->rc_safepoint_pending_ && gInterSource->interpDepth == 1) { \
+      func.sp = func_sp; \
+      gInterSource->ReconcileDeferredRC(cur_func); \
+    }
+#else
+#define RC_SAFEPOINT()
+#endif
+
+// Heap snapshot safe point: a snapshot requested by SIGUSR2 is written here,
+// where every live frame has its operand stack depth recorded.
+#define HEAP_SNAPSHOT_POINT() \
+    if (memory_manager->HeapSnapshotPending()) { \
+      func.sp = func_sp; \
+      gInterSource->TakePendingHeapSnapshot(cur_func); \
+    }
+
 #define THROWANDHANDLEREFERENCE() \
        if (!gInterSource->currEH) {\
          PrintReferenceErrorVND(); \
@@ -326,7 +572,7 @@ static void PrintUncaughtException(__jsstring *msg) {
          goto *(labels[*(uint8_t *)newPc]);\
        } else {\
          gInterSource->InsertEplog();\
-         return __none_value(Exec_handle_exc);\
+         RETURN_FROM_FRAME(__none_value(Exec_handle_exc));\
        }\
 
 
@@ -354,15 +600,7 @@ static void PrintUncaughtException(__jsstring *msg) {
           newPc = gInterSource->currEH->GetEHpc(&func); \
         } \
       } else { \
-        TValue m; \
-        if (!strcmp(estr, "TypeError")) { \
-          m = gInterSource->GetOrCreateBuiltinObj(JSBUILTIN_TYPEERROR_CONSTRUCTOR); \
-        } else if (!strcmp(estr, "RangeError")) { \
-          m = gInterSource->GetOrCreateBuiltinObj(JSBUILTIN_RANGEERROR_CONSTRUCTOR); \
-        } else { \
-          m = (__string_value(__jsstr_new_from_char(estr))); \
-        } \
-        gInterSource->currEH->SetThrownval(m); \
+        gInterSource->currEH->SetThrownval(gInterSource->ErrorValue(estr)); \
         gInterSource->currEH->UpdateState(OP_throw); \
         newPc = gInterSource->currEH->GetEHpc(&func); \
       } \
@@ -380,7 +618,7 @@ static void PrintUncaughtException(__jsstring *msg) {
         goto *(labels[*(uint8_t *)newPc]); \
       } else { \
         gInterSource->InsertEplog(); \
-        return __none_value(Exec_handle_exc);\
+        RETURN_FROM_FRAME(__none_value(Exec_handle_exc));\
       } \
     } \
 
@@ -398,7 +636,7 @@ static void PrintUncaughtException(__jsstring *msg) {
         goto *(labels[*(uint8_t *)newPc]); \
       } else { \
         gInterSource->InsertEplog(); \
-        return __none_value(Exec_handle_exc);\
+        RETURN_FROM_FRAME(__none_value(Exec_handle_exc));\
       } \
     } \
 
@@ -411,17 +649,7 @@ static void PrintUncaughtException(__jsstring *msg) {
       if (!strcmp(estr, "callee exception")) { \
         newPc = gInterSource->currEH->GetEHpc(&func); \
       } else { \
-        TValue m; \
-        if (!strcmp(estr, "TypeError")) { \
-          m = gInterSource->GetOrCreateBuiltinObj(JSBUILTIN_TYPEERROR_CONSTRUCTOR); \
-        } else if (!strcmp(estr, "RangeError")) { \
-          m = gInterSource->GetOrCreateBuiltinObj(JSBUILTIN_RANGEERROR_CONSTRUCTOR); \
-        } else if (!strcmp(estr, "ReferenceError")) { \
-          m = gInterSource->GetOrCreateBuiltinObj(JSBUILTIN_REFERENCEERRORCONSTRUCTOR); \
-        } else { \
-          m = (__string_value(__jsstr_new_from_char(estr))); \
-        } \
-        gInterSource->currEH->SetThrownval(m); \
+        gInterSource->currEH->SetThrownval(gInterSource->ErrorValue(estr)); \
         gInterSource->currEH->UpdateState(OP_throw); \
         newPc = gInterSource->currEH->GetEHpc(&func); \
       } \
@@ -433,7 +661,7 @@ static void PrintUncaughtException(__jsstring *msg) {
     mv0 = gInterSource->JSopUnary(mv0, (Opcode)expr.op, expr.primType); \
     MPUSH_SELF(mv0); \
 
-uint32_t __opcode_cnt_dyn = 0;
+VM_TLS uint32_t __opcode_cnt_dyn = 0;
 extern "C" uint32_t __inc_opcode_cnt_dyn() {
     return ++__opcode_cnt_dyn;
 }
@@ -473,13 +701,13 @@ extern "C" uint32_t __inc_opcode_cnt_dyn() {
   }
 
 #define PROP_CACHE_SIZE 1024
-struct prop_cache {
+VM_TLS struct prop_cache {
   uint64_t g;
   TValue o;
   TValue p;
   TValue ret;
 } prop_cache[PROP_CACHE_SIZE] = {{.g = 0}};
-uint64_t prop_cache_gen = 1;
+VM_TLS uint64_t prop_cache_gen = 1;
 #define PROP_CACHE_HASH(obj, name)   (((obj.x.u32 >> 3) ^ name.x.u32) & (PROP_CACHE_SIZE - 1))
 #define PROP_CACHE_RESET(obj, name)  (prop_cache[PROP_CACHE_HASH(obj, name)].o.x.u64 = 0)
 #define PROP_CACHE_INVALIDATE   prop_cache_gen++
@@ -502,19 +730,24 @@ inline bool PROP_CACHE_GET(TValue &obj, TValue &name, TValue &r) {
 #define SetRetval0(mv) {\
   TValue v = (mv);\
   if (IS_NEEDRC(v.x.u64))\
-    GCIncRf((void *)(v).x.c.payload);\
+    StackIncRf((void *)(v).x.c.payload);\
   if (IS_NEEDRC(gInterSource->retVal0.x.u64))\
-    GCDecRf((void *)gInterSource->retVal0.x.c.payload);\
+    StackDecRf((void *)gInterSource->retVal0.x.c.payload);\
   gInterSource->retVal0.x.u64 = v.x.u64;\
 }
 
 #define SetRetval0NoInc(v, t) {\
   if (IS_NEEDRC(gInterSource->retVal0.x.u64))\
-    GCDecRf((void *)gInterSource->retVal0.x.c.payload);\
+    StackDecRf((void *)gInterSource->retVal0.x.c.payload);\
   gInterSource->retVal0.x.u64 = (v) | t;\
 }
 
-__jsobject **__jsbuiltin_objects = NULL;
+// Entries of one isolate must not be seen by the next one run on the thread.
+void maple_invalidate_prop_cache() {
+  PROP_CACHE_INVALIDATE;
+}
+
+VM_TLS __jsobject **__jsbuiltin_objects = NULL;
 
 inline __jsobject *get_or_create_builtin(__jsbuiltin_object_id id) {
   if (id >= JSBUILTIN_LAST_OBJECT) {
@@ -533,12 +766,12 @@ inline TValue IntrinCall(MIRIntrinsicID id, TValue *args, int numArgs, bool is_s
 
   TValue funcNode = args[0];
   if (!IS_OBJECT(funcNode.x.u64) || ((__jsobject*)funcNode.x.c.payload)->object_class != JSFUNCTION) {
-    MAPLE_JS_TYPEERROR_EXCEPTION();
+    return gInterSource->RaiseError(JSBUILTIN_TYPEERROR_CONSTRUCTOR);
   }
   __jsobject *f = (__jsobject *)funcNode.x.c.payload;
   __jsfunction *func = (__jsfunction *)f->shared.fun;
   if (!func || f->object_class != JSFUNCTION) {
-    MAPLE_JS_TYPEERROR_EXCEPTION();
+    return gInterSource->RaiseError(JSBUILTIN_TYPEERROR_CONSTRUCTOR);
   }
   uint32_t attrs = func->attrs;
   if (!(attrs & 0xff & JSFUNCPROP_NATIVE))
@@ -565,7 +798,8 @@ inline TValue IntrinCall(MIRIntrinsicID id, TValue *args, int numArgs, bool is_s
     if (arg_count < (uint32_t)nargs) {
       for (uint32_t i = 0; i < arg_count; i++) {
         if (__is_none(arguments[i])) {
-          MAPLE_JS_REFERENCEERROR_EXCEPTION();
+          __js_ThisBinding = old_this;
+          return gInterSource->RaiseError(JSBUILTIN_REFERENCEERRORCONSTRUCTOR);
         }
       }
       for (uint32_t i = arg_count; i < (uint32_t)nargs; i++) {
@@ -778,7 +1012,38 @@ static inline void intrinsicop3(int intrinsicId, TValue &v0, TValue &v1, TValue
     return;
 }
 
-TValue InvokeInterpretMethod(DynMFunction &func) {
+// Reload the dispatch state after switching frames in a stackless call or return.
+#define LOADFRAMESTATE() \
+    func_pc = func.pc; \
+    func_operand_stack = func.operand_stack; \
+    func_sp = func.sp; \
+    frame_pointer = (uint8_t *)gInterSource->GetFPAddr(); \
+    global_pointer = (uint8_t *)gInterSource->GetGPAddr(); \
+    is_strict = func.is_strict(); \
+    gInterSource->SetCurFunc(&func);
+
+// Raise a RangeError for a stackless call that would exceed the call depth limit.
+#define THROWCALLSTACKOVERFLOW() \
+    if (!gInterSource->currEH) { \
+      PrintUncaughtException(__jsstr_new_from_char("RangeError: Maximum call stack size exceeded")); \
+    } \
+    gInterSource->currEH->SetThrownval(gInterSource->GetOrCreateBuiltinObj(JSBUILTIN_RANGEERROR_CONSTRUCTOR)); \
+    gInterSource->currEH->UpdateState(OP_throw); \
+    void *newPc = gInterSource->currEH->GetEHpc(&func); \
+    if (newPc) { \
+      func_pc = (uint8_t *)newPc; \
+      goto *(labels[*(uint8_t *)newPc]); \
+    } \
+    gInterSource->InsertEplog(); \
+    func.pc = func_pc; \
+    func.sp = func_sp; \
+    RETURN_FROM_FRAME(__none_value(Exec_handle_exc));
+
+// func names the frame being executed; stackless calls and returns switch cur_func.
+#define func (*cur_func)
+TValue InvokeInterpretMethod(DynMFunction &entry_func) {
+    DynMFunction *cur_func = &entry_func;
+    TValue frame_ret;
     uint8_t *func_pc = func.pc;
     TValue *func_operand_stack = func.operand_stack;
     MStack::size_type func_sp = func.sp;
@@ -791,6 +1056,9 @@ TValue InvokeInterpretMethod(DynMFunction &func) {
 #define OPCODE(base_node,dummy1,dummy2,dummy3) &&label_OP_##base_node,
 #include "mre_opcodes.def"
 #undef OPCODE
+#define QOPCODE(name) &&label_OP_##name,
+#include "mre_quickened_opcodes.def"
+#undef QOPCODE
         &&label_OP_Undef };
     bool is_strict = func.is_strict();
     if (__jsbuiltin_objects == NULL) {
@@ -803,6 +1071,42 @@ TValue InvokeInterpretMethod(DynMFunction &func) {
     // Get the first mir instruction of this method
     goto *(labels[((base_node_t *)func_pc)->op]);
 
+// enter the frame pushed by a stackless call
+label_frame_enter:
+    LOADFRAMESTATE();
+    DEBUGMETHODSYMBOL(func.header, "Running JavaScript method:", func.header->evalStackDepth);
+    PROP_CACHE_INVALIDATE;
+    goto *(labels[((base_node_t *)func_pc)->op]);
+
+// return from a frame pushed by a stackless call; frame_ret holds its result
+label_frame_return:
+  {
+    DynMFunction *callee = cur_func;
+    cur_func = callee->caller;
+    gInterSource->PopDynFrame(callee);
+    uint8_t callOp = *func.pc;
+    if (callOp == OP_call) {
+      gInterSource->sp -= callee->callState.offset;
+    } else {
+      gInterSource->FuncCallExit(callee->header, callee->callState);
+      if (callee->callState.oldFileInfo) {
+        gInterSource->RestorePluginContext((JsFileInforNode *)callee->callState.oldFileInfo);
+      }
+    }
+    LOADFRAMESTATE();
+    if (IS_NONE(frame_ret.x.u64) && GET_PAYLOAD(frame_ret) == (uint64_t) Exec_handle_exc) {
+      void *newPc = gInterSource->currEH ? gInterSource->currEH->GetEHpc(&func) : nullptr;
+      if (newPc) {
+        func_pc = (uint8_t *)newPc;
+        goto *(labels[*func_pc]);
+      }
+      gInterSource->InsertEplog();
+      RETURN_FROM_FRAME(frame_ret);
+    }
+    func_pc += (callOp == OP_call) ? sizeof(constval_node_t) : sizeof(mre_instr_t);
+    goto *(labels[*func_pc]);
+  }
+
 // handle each mir instruction
 label_OP_Undef:
     DEBUGOPCODE(Undef, Undef);
@@ -974,7 +1278,10 @@ label_OP_regread:
         break;
       }
       default: {
-        assert( idx > 0 && idx < MAXREGNUM && "NYI");
+        assert( idx > 0 && "NYI");
+        if (idx >= (int32_t)func.regCount) {
+          MIR_FATAL("regread %d past the %u registers of the method", idx, func.regCount);
+        }
         TValue tv = func.regStack[idx];
         switch (expr.primType) {
           case PTY_u1: {
@@ -1263,7 +1570,7 @@ label_OP_cvt:
             // gInterSource->FinishFunc();
           func.pc = func_pc;
           func.sp = func_sp;
-          return __none_value(Exec_handle_exc);
+          RETURN_FROM_FRAME(__none_value(Exec_handle_exc));
         }
       } else {
         goto *target;
@@ -1457,6 +1764,8 @@ label_OP_zext:
   }
 
 label_OP_add:
+    QUICKEN_SITE(add, reinterpret_cast<binary_node_t *>(func_pc)->primType);
+label_OP_addgeneric:
   {
     // Handle expression node: add
     binary_node_t &expr = *(reinterpret_cast<binary_node_t *>(func_pc));
@@ -1520,6 +1829,8 @@ label_OP_add:
   }
 
 label_OP_sub:
+    QUICKEN_SITE(sub, reinterpret_cast<binary_node_t *>(func_pc)->primType);
+label_OP_subgeneric:
   {
     // Handle expression node: sub
     binary_node_t &expr = *(reinterpret_cast<binary_node_t *>(func_pc));
@@ -1589,6 +1900,8 @@ label_OP_sub:
   }
 
 label_OP_mul:
+    QUICKEN_SITE(mul, reinterpret_cast<binary_node_t *>(func_pc)->primType);
+label_OP_mulgeneric:
   {
     // Handle expression node: mul
     binary_node_t &expr = *(reinterpret_cast<binary_node_t *>(func_pc));
@@ -1710,6 +2023,8 @@ label_OP_mul:
   }
 
 label_OP_div:
+    QUICKEN_SITE(div, reinterpret_cast<binary_node_t *>(func_pc)->primType);
+label_OP_divgeneric:
   {
     // Handle expression node: div
     binary_node_t &expr = *(reinterpret_cast<binary_node_t *>(func_pc));
@@ -1779,6 +2094,44 @@ label_OP_div:
     }
   }
 
+// Quickened arithmetic: operand tags were checked once at the site, here
+// they are only re-validated.
+QUICK_ARITH_I32(add, +)
+QUICK_ARITH_F64(add, +)
+QUICK_ARITH_I32(sub, -)
+QUICK_ARITH_F64(sub, -)
+QUICK_ARITH_I32(mul, *)
+QUICK_ARITH_F64(mul, *)
+QUICK_ARITH_F64(div, /)
+
+label_OP_divi32:
+  {
+    DEBUGOPCODE(divi32, Expr);
+    TValue &op1 = func_operand_stack[func_sp];
+    TValue &op0 = func_operand_stack[func_sp - 1];
+    if (!IS_NUMBER(op0.x.u64) || !IS_NUMBER(op1.x.u64))
+      DEOPTIMIZE_SITE(div);
+    if (op1.x.i32 == 0) {
+      goto label_OP_divgeneric;
+    }
+    int64_t q = (int64_t)op0.x.i32 / op1.x.i32;
+    if ((int64_t)op0.x.i32 % op1.x.i32 == 0 && ABS(q) <= INT_MAX) {
+      op0.x.i32 = q;
+    } else {
+      op0.x.f64 = (double)op0.x.i32 / (double)op1.x.i32;
+    }
+    func_sp--;
+    func_pc += sizeof(binary_node_t);
+    goto *(labels[*func_pc]);
+  }
+
+QUICK_CMPBR_PAIR(eqbr, ==)
+QUICK_CMPBR_PAIR(gebr, >=)
+QUICK_CMPBR_PAIR(gtbr, >)
+QUICK_CMPBR_PAIR(lebr, <=)
+QUICK_CMPBR_PAIR(ltbr, <)
+QUICK_CMPBR_PAIR(nebr, !=)
+
 label_OP_rem:
   {
     // Handle expression node: rem
@@ -1913,6 +2266,8 @@ label_OP_CG_array_elem_add:
   }
 
 label_OP_eqbr:
+    QUICKEN_SITE(eqbr, reinterpret_cast<mre_instr_t *>(func_pc)->param.type.opPtyp);
+label_OP_eqbrgeneric:
   {
     // Handle statement node: eqbr
     mre_instr_t &expr = *(reinterpret_cast<mre_instr_t *>(func_pc));
@@ -1953,6 +2308,8 @@ label_OP_eq:
   }
 
 label_OP_gebr:
+    QUICKEN_SITE(gebr, reinterpret_cast<mre_instr_t *>(func_pc)->param.type.opPtyp);
+label_OP_gebrgeneric:
   {
     // Handle statement node: gebr
     mre_instr_t &expr = *(reinterpret_cast<mre_instr_t *>(func_pc));
@@ -1993,6 +2350,8 @@ label_OP_ge:
   }
 
 label_OP_gtbr:
+    QUICKEN_SITE(gtbr, reinterpret_cast<mre_instr_t *>(func_pc)->param.type.opPtyp);
+label_OP_gtbrgeneric:
   {
     // Handle statement node: gtbr
     mre_instr_t &expr = *(reinterpret_cast<mre_instr_t *>(func_pc));
@@ -2033,6 +2392,8 @@ label_OP_gt:
   }
 
 label_OP_lebr:
+    QUICKEN_SITE(lebr, reinterpret_cast<mre_instr_t *>(func_pc)->param.type.opPtyp);
+label_OP_lebrgeneric:
   {
     // Handle statement node: lebr
     mre_instr_t &expr = *(reinterpret_cast<mre_instr_t *>(func_pc));
@@ -2073,6 +2434,8 @@ label_OP_le:
   }
 
 label_OP_ltbr:
+    QUICKEN_SITE(ltbr, reinterpret_cast<mre_instr_t *>(func_pc)->param.type.opPtyp);
+label_OP_ltbrgeneric:
   {
     // Handle statement node: ltbr
     mre_instr_t &expr = *(reinterpret_cast<mre_instr_t *>(func_pc));
@@ -2113,6 +2476,8 @@ label_OP_lt:
   }
 
 label_OP_nebr:
+    QUICKEN_SITE(nebr, reinterpret_cast<mre_instr_t *>(func_pc)->param.type.opPtyp);
+label_OP_nebrgeneric:
   {
     // Handle statement node: nebr
     mre_instr_t &expr = *(reinterpret_cast<mre_instr_t *>(func_pc));
@@ -2334,9 +2699,9 @@ label_OP_regassign:
      case -kSregRetval0: {
       TValue v = res;
       if (IS_NEEDRC(v.x.u64))
-        GCIncRf((void *)(v).x.c.payload);
+        StackIncRf((void *)(v).x.c.payload);
       if (IS_NEEDRC(gInterSource->retVal0.x.u64))
-        GCDecRf((void *)gInterSource->retVal0.x.c.payload);
+        StackDecRf((void *)gInterSource->retVal0.x.c.payload);
       gInterSource->retVal0.x.u64 = v.x.u64;
       //SetRetval0(res);
       break;
@@ -2347,7 +2712,9 @@ label_OP_regassign:
       break;
     default:
       assert(idx > 0 && "NYI");
-      assert(idx < MAXREGNUM && "regidx over MAX register number");
+      if (idx >= (int32_t)func.regCount) {
+        MIR_FATAL("regassign %d past the %u registers of the method", idx, func.regCount);
+      }
       switch(stmt.primType) {
         case PTY_u1: {
           uint8_t u8 = res.x.u8;
@@ -2407,6 +2774,10 @@ label_OP_goto32:
    //     func.try_catch_pc = nullptr;
 
     // func_pc += sizeof(mre_instr_t);
+    if (stmt.offset < 0) {
+      RC_SAFEPOINT();
+      HEAP_SNAPSHOT_POINT();
+    }
     func_pc = (uint8_t*)&stmt.offset + stmt.offset;
     goto *(labels[*func_pc]);
   }
@@ -2448,12 +2819,14 @@ label_OP_return:
     // Handle statement node: return
     DEBUGOPCODE(return, Stmt);
 
+    RC_SAFEPOINT();
+    HEAP_SNAPSHOT_POINT();
     TValue ret = __none_value();
     gInterSource->InsertEplog();
     TVALUEBITMASK(ret); // If returning void, it is set to {0x0, PTY_void}
     func.pc = func_pc;
     func.sp = func_sp;
-    return ret;
+    RETURN_FROM_FRAME(ret);
   }
 
 label_OP_rangegoto:
@@ -2481,26 +2854,23 @@ label_OP_call:
     func_sp -= numArgs;
     TValue *args = &func_operand_stack[func_sp + 1];
 
+    constval_node_t &expr = *(reinterpret_cast<constval_node_t *>(func_pc));
+    DynamicMethodHeaderT* calleeHeader = (DynamicMethodHeaderT*)((uint8_t*)expr.constVal.value + 4);
+    if (!gInterSource->CanPushDynFrame(calleeHeader, numArgs)) {
+      THROWCALLSTACKOVERFLOW();
+    }
     TValue thisVal,env;
     thisVal = env = NullPointValue();
     int32_t offset = gInterSource->PassArguments(thisVal, (void *)env.x.u64, args,
                     numArgs, -1);
     gInterSource->sp += offset;
-    constval_node_t &expr = *(reinterpret_cast<constval_node_t *>(func_pc));
-    //(call, Stmt);
-    TValue val;
-    DynamicMethodHeaderT* calleeHeader = (DynamicMethodHeaderT*)((uint8_t*)expr.constVal.value + 4);
     func.pc = func_pc;
     func.sp = func_sp;
-    val = maple_invoke_dynamic_method (calleeHeader, nullptr);
-    // __js_exit_function(&this_arg, old_this, false);
-    gInterSource->sp -= offset;
-    gInterSource->SetCurFunc(&func);
-    // func.direct_call(stmt.primType, stmt.numOpnds, func_pc);
-
-    // Skip the function name
-    func_pc += sizeof(constval_node_t);
-    goto *(labels[*func_pc]);
+    // the callee runs in this loop; label_frame_return pops the arguments and skips the function name
+    DynMFunction *callee = gInterSource->PushDynFrame(calleeHeader, nullptr, cur_func);
+    callee->callState.offset = offset;
+    cur_func = callee;
+    goto label_frame_enter;
   }
 
 label_OP_icall:
@@ -2513,23 +2883,19 @@ label_OP_icall:
     TValue *args = &func_operand_stack[func_sp + 1];
     TValue args0 = args[0];
     args[0] = __function_value((void *)args0.x.c.payload);
-    TValue retCall = gInterSource->FuncCall((void *)args0.x.c.payload, false, nullptr, args, numArgs, 2, -1, false);
-
-    if (IS_NONE(retCall.x.u64) && GET_PAYLOAD(retCall) == (uint64_t) Exec_handle_exc) {
-      void *newPc = gInterSource->currEH->GetEHpc(&func);
-      if (newPc) {
-        func_pc = (uint8_t *)newPc;
-        goto *(labels[*func_pc]);
-      }
-      gInterSource->InsertEplog();
-      func.pc = func_pc;
-      func.sp = func_sp;
-      return retCall;
-    } else {
-      // the first is the addr of callee, the second is to be ignore
-      func_pc += sizeof(mre_instr_t);
-      goto *(labels[*func_pc]);
+    void *callee = (void *)args0.x.c.payload;
+    DynamicMethodHeaderT* calleeHeader = (DynamicMethodHeaderT *)((uint8_t *)callee + 4);
+    if (!gInterSource->CanPushDynFrame(calleeHeader, numArgs)) {
+      THROWCALLSTACKOVERFLOW();
     }
+    func.pc = func_pc;
+    func.sp = func_sp;
+    // the callee runs in this loop; label_frame_return undoes FuncCallEnter
+    DynCallState state;
+    void *argsObj = gInterSource->FuncCallEnter(callee, false, nullptr, args, numArgs, 2, -1, false, state);
+    cur_func = gInterSource->PushDynFrame(calleeHeader, argsObj, cur_func);
+    cur_func->callState = state;
+    goto label_frame_enter;
   }
 
 label_OP_getpropbyname:
@@ -2585,6 +2951,7 @@ label_OP_getpropbyname:
         break;
       }
       case 10: { // intrinsiccall GET_THIS_PROP_BY_NAME (add(regread %%GP, constval))
+        BINDGLOBALCELL(stmt, values);
         v0.x.u64 = (uint64_t)(global_pointer + values.v0) | NAN_GPBASE;
         if (!PROP_CACHE_GET(__js_Global_ThisBinding, v0, v0)) {
           v0 = gInterSource->JSopGetThisPropByName(v0);
@@ -2594,6 +2961,18 @@ label_OP_getpropbyname:
         func_pc += sizeof(mre_instr_t);
         goto *(labels[*func_pc]);
       }
+      case 11: { // GET_THIS_PROP_BY_NAME bound to global property cell v1
+        __jsprop *p = gInterSource->GlobalCellProp((uint16_t)values.v1, (__jsstring *)(global_pointer + values.v0));
+        if (p && __has_value(p->desc) && !__has_get_or_set(p->desc)) {  // plain data properties only
+          v0 = p->desc.named_data_property.value;
+        } else {
+          v0.x.u64 = (uint64_t)(global_pointer + values.v0) | NAN_GPBASE;
+          v0 = gInterSource->JSopGetThisPropByName(v0);
+        }
+        MPUSH(v0);
+        func_pc += sizeof(mre_instr_t);
+        goto *(labels[*func_pc]);
+      }
       default:
         MASSERT(false, "Not supported OP_getpropbyname variation");
     }
@@ -2612,10 +2991,10 @@ label_OP_getpropbyname:
       uint8 *addr = frame_pointer + values.v3;
       TValue oldV = *((TValue*)addr);
       if (IS_NEEDRC(retMv.x.u64)) {
-        GCIncRf((void *)retMv.x.c.payload);
+        StackIncRf((void *)retMv.x.c.payload);
       }
       if (IS_NEEDRC(oldV.x.u64)) {
-        GCDecRf((void *)oldV.x.c.payload);
+        StackDecRf((void *)oldV.x.c.payload);
       }
       *(uint64_t *)addr = retMv.x.u64;
       if (!is_strict && (int32_t)values.v3 > 0 && DynMFunction::is_jsargument(func.header)) {
@@ -2632,7 +3011,7 @@ label_OP_getpropbyname:
       gInterSource->InsertEplog();
       func.pc = func_pc;
       func.sp = func_sp;
-      return __none_value(Exec_handle_exc);
+      RETURN_FROM_FRAME(__none_value(Exec_handle_exc));
     }
 
     func_pc += sizeof(mre_instr_t);
@@ -2672,7 +3051,24 @@ label_OP_setpropbyname:
         v1.x.u64 = (uint64_t)(global_pointer + values.v2) | NAN_GPBASE;
         break;
       }
+      case 11: { // SET_THIS_PROP_BY_NAME bound to global property cell v1
+        __jsstring *s1 = (__jsstring *)(global_pointer + values.v0);
+        __jsprop *p = gInterSource->GlobalCellProp((uint16_t)values.v1, s1);
+        // read-only globals (NaN, undefined, frozen ones) and accessors take the generic path,
+        // which ignores the write or throws in strict code
+        if (!IS_NONE(v2.x.u64) && p && __has_value(p->desc) && !__has_get_or_set(p->desc) &&
+            __writable(p->desc) && !(is_strict && __jsstr_throw_typeerror(s1))) {
+          __set_value_gc(&p->desc, v2);
+          v0 = __js_Global_ThisBinding;
+          v1.x.u64 = (uint64_t)s1 | NAN_GPBASE;
+          PROP_CACHE_SET(v0, v1, v2);
+          goto label_setpropbyname_check;
+        }
+        goto label_setthisprop_generic;
+      }
       case 10: { // intrinsiccall SET_THIS_PROP_BY_NAME (add(regread %%GP, constval), x)
+        BINDGLOBALCELL(stmt, values);
+label_setthisprop_generic:
         v1.x.u64 = (uint64_t)(global_pointer + values.v0) | NAN_GPBASE;
         CHECKREFERENCEMVALUE(v2);
         try {
@@ -2683,8 +3079,15 @@ label_OP_setpropbyname:
             __jsstr_throw_typeerror(s1)) {
             MAPLE_JS_TYPEERROR_EXCEPTION();
           }
-          __jsop_set_this_prop_by_name(v0, s1, v2, true);
-          PROP_CACHE_SET(v0, v1, v2);
+          __jsprop *p = __jsop_get_this_prop_cell(v0, s1);
+          if (p && (__has_get_or_set(p->desc) || (__has_value(p->desc) && __has_and_unwritable(p->desc)))) {
+            // accessors and read-only globals follow [[Put]]: the setter runs, or the
+            // write is ignored, or throws in strict code
+            __jsobj_internal_Put((__jsobject *)v0.x.c.payload, s1, v2, is_strict, is_strict);
+          } else if (is_strict || !__jsstr_throw_typeerror(s1)) {  // NaN = 1 is ignored in sloppy code
+            __jsop_set_this_prop_by_name(v0, s1, v2, true);
+            PROP_CACHE_SET(v0, v1, v2);
+          }
         }
         CATCHINTRINSICOP();
         goto label_setpropbyname_check;
@@ -2715,7 +3118,7 @@ label_setpropbyname_check:
       gInterSource->InsertEplog();
       func.pc = func_pc;
       func.sp = func_sp;
-      return __none_value(Exec_handle_exc);
+      RETURN_FROM_FRAME(__none_value(Exec_handle_exc));
     }
     func_pc += sizeof(mre_instr_t);
     goto *(labels[*func_pc]);
@@ -3017,7 +3420,7 @@ label_OP_intrinsiccall:
         TValue &envVal = MPOP();
         TValue &fpVal = MPOP();
         TValue ret = (__js_new_function((void *)fpVal.x.c.payload, (void *)envVal.x.c.payload,
-                                   attrsVal.x.u32, gInterSource->jsPlugin->fileIndex, true));
+                                   attrsVal.x.u32, gInterSource->jsPlugin->formalFileInfo->fileIndex, true));
         SetRetval0(ret);
       }
       break;
@@ -3126,6 +3529,31 @@ label_OP_intrinsiccall:
         TValue *args = &func_operand_stack[func_sp + 1];
 
         CHECKREFERENCEMVALUE(args[0]);
+        if ((MIRIntrinsicID)stmt.param.intrinsic.intrinsicId == INTRN_JSOP_CALL && IS_OBJECT(args[0].x.u64)) {
+          // plain JS callees run in this loop; natives, bound functions and constructors still go through IntrinCall
+          __jsobject *f = (__jsobject *)args[0].x.c.payload;
+          __jsfunction *jsFunc = f->object_class == JSFUNCTION ? f->shared.fun : nullptr;
+          if (jsFunc && jsFunc->fp && !(jsFunc->attrs & 0xff & (JSFUNCPROP_NATIVE | JSFUNCPROP_BOUND))) {
+            DynamicMethodHeaderT* calleeHeader = (DynamicMethodHeaderT *)((uint8_t *)jsFunc->fp + 4);
+            if (!gInterSource->CanPushDynFrame(calleeHeader, numArgs)) {
+              THROWCALLSTACKOVERFLOW();
+            }
+            func.pc = func_pc;
+            func.sp = func_sp;
+            void *oldFileInfo = nullptr;
+            if (jsFunc->fileIndex != -1 && ((uint32_t)jsFunc->fileIndex != gInterSource->jsPlugin->formalFileInfo->fileIndex)) {
+              oldFileInfo = gInterSource->jsPlugin->formalFileInfo;
+              gInterSource->SwitchPluginContext(gInterSource->jsPlugin->FindJsFile((uint32_t)jsFunc->fileIndex));
+            }
+            DynCallState state;
+            void *argsObj = gInterSource->FuncCallEnter(jsFunc->fp, true, jsFunc->env, args, numArgs, 2,
+                                                        jsFunc->attrs >> 16 & 0xff, jsFunc->attrs & 0xff & JSFUNCPROP_STRICT, state);
+            state.oldFileInfo = oldFileInfo;
+            cur_func = gInterSource->PushDynFrame(calleeHeader, argsObj, cur_func);
+            cur_func->callState = state;
+            goto label_frame_enter;
+          }
+        }
         TValue retCall;
         bool is_setRetVal = false;
         try {
@@ -3138,52 +3566,21 @@ label_OP_intrinsiccall:
             // return retCall; // continue to unwind
           }
         } catch(const char *estr) {
-          TValue m;
+          // errors raised deep inside runtime builtins still arrive as C++ throws
           isEhHappend = true;
-          bool isTypeError = false;
-          bool isRangeError = false;
-          bool isUriError = false;
-          bool isSyntaxError = false;
-          bool isRefError = false;
-          if (!strcmp(estr, "TypeError")) {
-            m = gInterSource->GetOrCreateBuiltinObj(JSBUILTIN_TYPEERROR_CONSTRUCTOR);
-            isTypeError = true;
-          } else if (!strcmp(estr, "RangeError")) {
-            m = gInterSource->GetOrCreateBuiltinObj(JSBUILTIN_RANGEERROR_CONSTRUCTOR);
-            isRangeError = true;
-          } else if (!strcmp(estr, "SyntaxError")) {
-            m = gInterSource->GetOrCreateBuiltinObj(JSBUILTIN_SYNTAXERROR_CONSTRUCTOR);
-            isSyntaxError = true;
-          } else if (!strcmp(estr, "UriError")) {
-            m = gInterSource->GetOrCreateBuiltinObj(JSBUILTIN_URIERROR_CONSTRUCTOR);
-            isUriError = true;
-          } else if (!strcmp(estr, "ReferenceError")) {
-            m = gInterSource->GetOrCreateBuiltinObj(JSBUILTIN_REFERENCEERRORCONSTRUCTOR);
-            isRefError = true;
-          } else if (!strcmp(estr, "callee exception")) { // exception is thrown by user code
-            // do nothing because the exception object is already in gInterSource
-          } else {
-            m = (__string_value(__jsstr_new_from_char(estr)));
-          }
+          bool isCallee = !strcmp(estr, "callee exception"); // thrown val is already in currEH
           if (!gInterSource->currEH) {
-            if (isTypeError) {
-              fprintf(stderr, "TypeError:  not a function");
-            } else if (isRangeError) {
-              fprintf(stderr, "RangeError:  not a function");
-            } else if (isSyntaxError) {
-              fprintf(stderr, "SyntaxError:  not a function");
-            } else if (isUriError) {
-              fprintf(stderr, "UriError:  not a catched");
-            } else if (isRefError) {
-              fprintf(stderr, "ReferenceError: not defined");
-            } else {
+            if (isCallee) {
               fprintf(stderr, "eh thown but never catched");
+            } else {
+              fprintf(stderr, "%s:  not catched", estr);
             }
             exit(3);
           }
-
-          if (isTypeError || isRangeError || isSyntaxError || isUriError || GET_PAYLOAD(gInterSource->currEH->GetThrownval()) == 0) { // ToDo: GetThrownval() == 0 is wrong
-            gInterSource->currEH->SetThrownval(m);
+          // a bare string does not replace a value the script has already thrown
+          if (!isCallee && (gInterSource->ErrorId(estr) != JSBUILTIN_LAST_OBJECT ||
+                            GET_PAYLOAD(gInterSource->currEH->GetThrownval()) == 0)) {
+            gInterSource->currEH->SetThrownval(gInterSource->ErrorValue(estr));
           }
           gInterSource->currEH->UpdateState(OP_throw);
           newPc = gInterSource->currEH->GetEHpc(&func);
@@ -3230,7 +3627,7 @@ label_OP_intrinsiccall:
       gInterSource->InsertEplog();
       func.pc = func_pc;
       func.sp = func_sp;
-      return __none_value(Exec_handle_exc);
+      RETURN_FROM_FRAME(__none_value(Exec_handle_exc));
     }
     func_pc += sizeof(mre_instr_t);
     goto *(labels[*func_pc]);
@@ -3274,7 +3671,7 @@ label_OP_throw:
       // gInterSource->FinishFunc();
       func.pc = func_pc;
       func.sp = func_sp;
-      return __none_value(Exec_handle_exc);
+      RETURN_FROM_FRAME(__none_value(Exec_handle_exc));
     }
   }
 
@@ -3731,7 +4128,7 @@ label_OP_intrinsicopireadfpoff:
           gInterSource->InsertEplog();
           func.pc = func_pc;
           func.sp = func_sp;
-          return __none_value(Exec_handle_exc);
+          RETURN_FROM_FRAME(__none_value(Exec_handle_exc));
         }
       }
     }
@@ -3760,7 +4157,7 @@ label_OP_intrinsicopconstval:
       gInterSource->InsertEplog();
       func.pc = func_pc;
       func.sp = func_sp;
-      return __none_value(Exec_handle_exc);
+      RETURN_FROM_FRAME(__none_value(Exec_handle_exc));
     }
     MPUSH(v0);
     func_pc += sizeof(mre_instr_t);
@@ -3812,7 +4209,7 @@ label_OP_intrinsicop:
       gInterSource->InsertEplog();
       func.pc = func_pc;
       func.sp = func_sp;
-      return __none_value(Exec_handle_exc);
+      RETURN_FROM_FRAME(__none_value(Exec_handle_exc));
     }
     func_pc += sizeof(mre_instr_t);
     goto *(labels[*func_pc]);
@@ -3874,7 +4271,7 @@ label_OP_iassignfpoffconstval:
           TValue rVal  = __number_value(u64Val);
           TValue oldV = *((TValue*)addr);
           if (IS_NEEDRC(oldV.x.u64)) {
-            memory_manager->GCDecRf((void *)oldV.x.c.payload);
+            StackDecRf((void *)oldV.x.c.payload);
           }
           *(uint64_t *)addr = rVal.x.u64;
           if (!is_strict && offset > 0 && DynMFunction::is_jsargument(func.header)) {
@@ -3928,10 +4325,10 @@ label_OP_iassignfpoffregread:
       }
       default: {
         if (IS_NEEDRC(rVal.x.u64)) {
-          GCIncRf((void *)rVal.x.c.payload);
+          StackIncRf((void *)rVal.x.c.payload);
         }
         if (IS_NEEDRC(oldV.x.u64)) {
-          GCDecRf((void *)oldV.x.c.payload);
+          StackDecRf((void *)oldV.x.c.payload);
         }
         *(uint64_t *)addr = rVal.x.u64;
         if (!is_strict && (int32_t)stmt.param.offset > 0 && DynMFunction::is_jsargument(func.header)) {
@@ -3993,10 +4390,10 @@ label_OP_iassignfpoff:
       #endif
         {
           if (IS_NEEDRC(rVal.x.u64)) {
-            GCIncRf((void *)rVal.x.c.payload);
+            StackIncRf((void *)rVal.x.c.payload);
           }
           if (IS_NEEDRC(oldV.x.u64)) {
-            GCDecRf((void *)oldV.x.c.payload);
+            StackDecRf((void *)oldV.x.c.payload);
           }
           //oldV.x.u64 = rVal.x.u64;
           *(uint64_t *)addr = rVal.x.u64;
@@ -4071,7 +4468,7 @@ label_OP_retsub:
         // gInterSource->FinishFunc();
         func.pc = func_pc;
         func.sp = func_sp;
-        return __none_value(Exec_handle_exc);
+        RETURN_FROM_FRAME(__none_value(Exec_handle_exc));
       }
     } else {
       func_pc = (uint8_t *)gInterSource->currEH->PopGosub();
@@ -4426,24 +4823,82 @@ label_OP_iassignfpoff32:
 
 }
 
+#undef func
+
+// The method header does not record how many pseudo registers a method
+// uses, so the count is found by scanning its code for regread and
+// regassign.  Every instruction is a multiple of 4 bytes long, so a scan in
+// 4-byte steps sees every instruction; immediate data that happens to look
+// like a register access can only raise the count.  The code ends with the
+// ELF symbol of the function, which starts 4 bytes before the header; a
+// function without a sized symbol gets MAXREGNUM registers.
+static uint32_t ScanRegCount(DynamicMethodHeaderT *header) {
+  uint8_t *fn = (uint8_t *)header - 4;
+  Dl_info info;
+  const ElfW(Sym) *sym = nullptr;
+  if (!dladdr1(fn, &info, (void **)&sym, RTLD_DL_SYMENT) || !sym || info.dli_saddr != fn || sym->st_size == 0) {
+    return MAXREGNUM;
+  }
+  uint8_t *end = fn + sym->st_size;
+  uint32_t count = 1;  // register 0 is never used
+  for (uint8_t *p = (uint8_t *)header + header->header_size; p + sizeof(mre_instr_t) <= end; p += 4) {
+    if (*p != QOP_base_regread && *p != QOP_base_regassign) {
+      continue;
+    }
+    int32_t idx = (int32_t)reinterpret_cast<mre_instr_t *>(p)->param.frameIdx;
+    if (idx >= MAXREGNUM) {
+      return MAXREGNUM;
+    }
+    if (idx >= (int32_t)count) {
+      count = idx + 1;
+    }
+  }
+  return count;
+}
+
+uint32_t InterSource::LookupRegCount(DynamicMethodHeaderT *header) {
+  std::unordered_map<DynamicMethodHeaderT *, uint32_t>::iterator it = regCounts.find(header);
+  if (it != regCounts.end()) {
+    return it->second;
+  }
+  uint32_t count = ScanRegCount(header);
+  regCounts[header] = count;
+  return count;
+}
+
+void InterSource::ClearRegCounts() {
+  memset(regCountCache, 0, sizeof(regCountCache));
+  regCounts.clear();
+}
+
+uint32_t DynMFunction::reg_count(DynamicMethodHeaderT *hd) {
+  return gInterSource->RegCount(hd);
+}
+
 TValue maple_invoke_dynamic_method(DynamicMethodHeaderT *header, void *obj) {
-    TValue stack[header->frameSize/sizeof(void *) + header->evalStackDepth];
+    TValue stack[DynMFunction::stack_slots(header)];
     DynMFunction func(header, obj, stack);
-    gInterSource->InsertProlog(header->frameSize);
-    return InvokeInterpretMethod(func);
+    gInterSource->InsertProlog(header);
+    gInterSource->interpDepth++;
+    TValue ret = InvokeInterpretMethod(func);
+    gInterSource->interpDepth--;
+    return ret;
 }
 
 TValue maple_invoke_dynamic_method_main(uint8_t *mPC, DynamicMethodHeaderT* cheader) {
-    TValue stack[cheader->frameSize/sizeof(void *) + cheader->evalStackDepth];
+    TValue stack[DynMFunction::stack_slots(cheader)];
     DynMFunction func(mPC, cheader, stack);
-    gInterSource->InsertProlog(cheader->frameSize);
+    gInterSource->InsertProlog(cheader);
 #ifdef MEMORY_LEAK_CHECK
     memory_manager->mainSP = gInterSource->GetSPAddr();
     memory_manager->mainFP = gInterSource->GetFPAddr();
     memory_manager->mainGP = gInterSource->gp;
     memory_manager->mainTopGP = gInterSource->topGp;
 #endif
-    return InvokeInterpretMethod(func);
+    gInterSource->interpDepth++;
+    TValue ret = InvokeInterpretMethod(func);
+    gInterSource->interpDepth--;
+    return ret;
 }
 
 DynMFunction::DynMFunction(DynamicMethodHeaderT * cheader, void *obj, TValue *stack):
@@ -4452,16 +4907,32 @@ DynMFunction::DynMFunction(DynamicMethodHeaderT * cheader, void *obj, TValue *st
     argumentsObj = obj;
     pc = (uint8_t *)header + *(int32_t*)header;
     sp = 0;
-    operand_stack = stack;
+    caller = nullptr;
+    regStack = stack;
+    regCount = reg_count(header);
+    operand_stack = stack + regCount;
     operand_stack[sp] = {.x.a64 = (uint8_t*)0x7ff9f00ddeadbeef};
+#ifdef RC_DEFER_STACK
+    // registers and the saved call state are scanned as roots at safe points
+    memset(regStack, 0, regCount * sizeof(TValue));
+    memset(&callState, 0, sizeof(callState));
+#endif
 }
 DynMFunction::DynMFunction(uint8_t *argPC, DynamicMethodHeaderT *cheader, TValue *stack):header(cheader) {
     pc = argPC;
     argumentsDeleted = 0;
     argumentsObj = nullptr;
     sp = 0;
-    operand_stack = stack;
+    caller = nullptr;
+    regStack = stack;
+    regCount = reg_count(header);
+    operand_stack = stack + regCount;
     operand_stack[sp] = {.x.a64 = (uint8_t*)0x7ff9f00ddeadbeef};
+#ifdef RC_DEFER_STACK
+    // registers and the saved call state are scanned as roots at safe points
+    memset(regStack, 0, regCount * sizeof(TValue));
+    memset(&callState, 0, sizeof(callState));
+#endif
 }
 
 
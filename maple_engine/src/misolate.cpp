@@ -0,0 +1,390 @@
+/*
+ * Copyright (C) [2021] Futurewei Technologies, Inc. All rights reserved.
+ *
+ * OpenArkCompiler is licensed under the Mulan Permissive Software License v2.
+ * You can use this software according to the terms and conditions of the MulanPSL - 2.0.
+ * You may obtain a copy of MulanPSL - 2.0 at:
+ *
+ *   https://opensource.org/licenses/MulanPSL-2.0
+ *
+ * THIS SOFTWARE IS PROVIDED ON AN "AS IS" BASIS, WITHOUT WARRANTIES OF ANY KIND, EITHER
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO NON-INFRINGEMENT, MERCHANTABILITY OR
+ * FIT FOR A PARTICULAR PURPOSE.
+ * See the MulanPSL - 2.0 for more details.
+ */
+
+#include <cstdlib>
+#include <cstring>
+#include <dlfcn.h>
+
+#include "misolate.h"
+#include "massert.h"
+#include "mfunction.h"
+#include "jscontext.h"
+#include "jseh.h"
+#include "jsvalueinline.h"
+#include "vmheapimage.h"
+
+namespace maple {
+
+thread_local Isolate *Isolate::current_ = nullptr;
+
+Isolate::Isolate() {
+  app_path_ = nullptr;
+  handle_ = nullptr;
+  main_fn_ = nullptr;
+  entered_ = false;
+  prev_ = nullptr;
+  inter_source_ = nullptr;
+  memory_manager_ = nullptr;
+  js_global_ = nullptr;
+  js_global_memmap_ = nullptr;
+  global_this_binding_.x.u64 = 0;
+  this_binding_.x.u64 = 0;
+  outer_binding_.x.u64 = 0;
+  global_strict_ = false;
+  memset(builtins_, 0, sizeof(builtins_));
+#ifdef MARK_CYCLE_ROOTS
+  cycle_roots_ = nullptr;
+  garbage_roots_ = nullptr;
+#else
+  obj_list_ = nullptr;
+#endif
+  is_sweep_ = false;
+}
+
+// Open the module at app_path; returns its handle, or null if it is not a
+// JS module.
+static void *OpenModule(const char *app_path, uint16_t **mpljsMdD) {
+  void *handle = dlopen(app_path, RTLD_LOCAL | RTLD_LAZY);
+  if (!handle) {
+    fprintf(stderr, "failed to open %s\n", app_path);
+    return nullptr;
+  }
+  *mpljsMdD = (uint16_t *)dlsym(handle, "__mpljs_module_decl__");
+  if (!*mpljsMdD) {
+    fprintf(stderr, "failed to open __mpljs_module_decl__ %s\n", app_path);
+    dlclose(handle);
+    return nullptr;
+  }
+  return handle;
+}
+
+Isolate *Isolate::New(const char *app_path) {
+  uint16_t *mpljsMdD;
+  void *handle = OpenModule(app_path, &mpljsMdD);
+  if (!handle) {
+    return nullptr;
+  }
+  Isolate *isolate = new Isolate();
+  isolate->app_path_ = strdup(app_path);
+  isolate->handle_ = handle;
+  isolate->main_fn_ = dlsym(handle, "__jsmain");
+
+  // The VM state is built in the thread's globals, so the isolate entered
+  // on this thread is put aside meanwhile.
+  Isolate *current = current_;
+  if (current) {
+    current->Save();
+  }
+  Unload();
+  new InterSource();  // installs itself as gInterSource
+  jsGlobal = new JavaScriptGlobal();
+  jsGlobal->flavor = 0;
+  jsGlobal->srcLang = 2;
+  jsGlobal->id = 0;
+  isolate->InstallMain(mpljsMdD);
+  isolate->Save();
+  if (current) {
+    current->Load();
+  } else {
+    Unload();
+  }
+  return isolate;
+}
+
+// Give the loaded VM state the globals of the module declared by mpljsMdD.
+void Isolate::InstallMain(uint16_t *mpljsMdD) {
+  InterSource *inter = gInterSource;
+  uint16_t globalMemSize = mpljsMdD[0];
+  inter->gp = (uint8_t *)malloc(globalMemSize);
+  memcpy(inter->gp, mpljsMdD + 1, globalMemSize);
+  inter->topGp = inter->gp + globalMemSize;
+  inter->CreateJsPlugin(app_path_);
+  jsGlobal->globalmemsize = globalMemSize;
+  jsGlobal->globalwordstypetagged = *((uint8_t *)mpljsMdD + 2 + globalMemSize + 2);
+  jsGlobal->globalwordsrefcounted = *((uint8_t *)mpljsMdD + 2 + globalMemSize + 6);
+}
+
+bool Isolate::ReplaceMain(const char *app_path) {
+  MASSERT(current_ == this, "replacing the main module of an isolate that is not entered");
+  InterSource *inter = gInterSource;
+  if (inter->currEH || inter->callDepth > 0 || inter->jsPlugin->HasRequiredFiles()) {
+    fprintf(stderr, "cannot replace the main module of a running isolate with %s\n", app_path);
+    return false;
+  }
+  uint16_t *mpljsMdD;
+  void *handle = OpenModule(app_path, &mpljsMdD);
+  if (!handle) {
+    return false;
+  }
+  free(inter->gp);
+  // the cells are keyed by the names in the old globals
+  inter->globalCellNum = 0;
+  inter->globalCellIndex.clear();
+  inter->globalCellEpoch++;
+  dlclose(handle_);
+  // the old module's code may be unmapped and the new one mapped over it
+  inter->ClearRegCounts();
+  free(app_path_);
+  app_path_ = strdup(app_path);
+  handle_ = handle;
+  main_fn_ = dlsym(handle, "__jsmain");
+  InstallMain(mpljsMdD);
+  maple_invalidate_prop_cache();
+  return true;
+}
+
+void Isolate::Enter() {
+  MASSERT(!entered_, "isolate is already entered");
+  prev_ = current_;
+  if (prev_) {
+    prev_->Save();
+  }
+  Load();
+  entered_ = true;
+  current_ = this;
+}
+
+void Isolate::Exit() {
+  MASSERT(current_ == this, "exiting an isolate that is not the current one");
+  Save();
+  entered_ = false;
+  current_ = prev_;
+  if (prev_) {
+    prev_->Load();
+  } else {
+    Unload();
+  }
+  prev_ = nullptr;
+}
+
+TValue Isolate::Run(void *main_fn) {
+  MASSERT(current_ == this, "running an isolate that is not entered");
+  MASSERT(main_fn, "%s has no __jsmain", app_path_);
+  uint8_t *addr = (uint8_t *)main_fn + 4;  // skip signature
+  DynamicMethodHeaderT *header = (DynamicMethodHeaderT *)(addr);
+  assert(header->upFormalSize == 0 && "main function got a frame size?");
+  addr += *(int32_t *)addr;  // skip to 1st instruction
+  return maple_invoke_dynamic_method_main(addr, header);
+}
+
+TValue Isolate::GetExport(const char *name) {
+  MASSERT(current_ == this, "looking up an export of an isolate that is not entered");
+  __jsstring *str = __jsstr_new_from_char(name);
+  TValue val = __undefined_value();
+  __jsobject *module = __jsobj_get_jsbuiltin_objects()[JSBUILTIN_MODULE];
+  if (module) {
+    TValue moduleVal = __object_value(module);
+    TValue exports = __jsop_getprop_by_name(moduleVal, __jsstr_get_builtin(JSBUILTIN_STRING_EXPORTS));
+    if (__is_js_object(exports)) {
+      val = __jsop_getprop_by_name(exports, str);
+    }
+  }
+  if (__is_undefined(val)) {
+    TValue global = __object_value(__jsobj_get_or_create_builtin(JSBUILTIN_GLOBALOBJECT));
+    val = __jsop_getprop_by_name(global, str);
+  }
+  memory_manager->RecallString(str);
+  return val;
+}
+
+bool Isolate::Call(TValue fn, TValue this_arg, TValue *args, uint32_t nargs, TValue *result) {
+  MASSERT(current_ == this, "calling into an isolate that is not entered");
+  MASSERT(nargs <= MAXCALLARGNUM, "too many arguments: %u", nargs);
+  InterSource *inter = gInterSource;
+  uint32_t sp = inter->sp;
+  uint32_t fp = inter->fp;
+  uint32_t callStackTop = inter->callStackTop;
+  uint32_t callDepth = inter->callDepth;
+  uint32_t interpDepth = inter->interpDepth;
+  DynMFunction *curFunc = inter->GetCurFunc();
+  TValue thisBinding = __js_ThisBinding;
+  // A handler that belongs to no frame: an exception the callee does not
+  // catch unwinds to here instead of ending the process as uncaught.
+  inter->JsTry(nullptr, (void *)this, nullptr, nullptr);
+  JsEh *boundary = inter->currEH;
+  bool ok = true;
+  try {
+    *result = __jsop_call(fn, this_arg, args, nargs);
+  } catch (const char *estr) {
+    ok = false;
+    if (!strcmp(estr, "callee exception")) {
+      *result = boundary->GetThrownval();
+    } else {
+      *result = inter->ErrorValue(estr);
+    }
+  }
+  while (inter->currEH && inter->currEH != boundary) {
+    inter->currEH->FreeEH();
+  }
+  boundary->FreeEH();
+  if (!ok) {
+    inter->sp = sp;
+    inter->fp = fp;
+    inter->callStackTop = callStackTop;
+    inter->callDepth = callDepth;
+    inter->interpDepth = interpDepth;
+    inter->SetCurFunc(curFunc);
+    __js_ThisBinding = thisBinding;
+  }
+  return ok;
+}
+
+bool Isolate::Call(const char *name, TValue *args, uint32_t nargs, TValue *result) {
+  TValue fn = GetExport(name);
+  TValue undefined = __undefined_value();
+  return Call(fn, undefined, args, nargs, result);
+}
+
+TValue Isolate::NewString(const char *str) {
+  MASSERT(current_ == this, "allocating in an isolate that is not entered");
+  return __string_value(__jsstr_new_from_char(str));
+}
+
+void Isolate::Retain(TValue val) {
+  if (IS_NEEDRC(val.x.u64)) {
+    GCIncRf((void *)val.x.c.payload);
+  }
+}
+
+void Isolate::Release(TValue val) {
+  if (IS_NEEDRC(val.x.u64)) {
+    GCDecRf((void *)val.x.c.payload);
+  }
+}
+
+void Isolate::WarmUp() {
+  MASSERT(current_ == this, "warming up an isolate that is not entered");
+  __jsobj_create_all_builtins();
+}
+
+bool Isolate::WriteImage(const char *path) {
+  MASSERT(current_ == this, "writing the image of an isolate that is not entered");
+  InterSource *inter = gInterSource;
+  if (inter->currEH || inter->callDepth > 0 || inter->jsPlugin->HasRequiredFiles()) {
+    fprintf(stderr, "heap image %s: the isolate is running or has loaded modules\n", path);
+    return false;
+  }
+#ifdef RC_DEFER_STACK
+  inter->ReconcileDeferredRC(nullptr);
+#endif
+  HeapImage image;
+  image.SetModule(main_fn_);
+  image.SetGlobals(inter->gp, inter->topGp - inter->gp);
+  if (!image.Write(path)) {
+    fprintf(stderr, "failed to write heap image %s: %s\n", path, image.Error());
+    return false;
+  }
+  return true;
+}
+
+bool Isolate::ReadImage(const char *path) {
+  MASSERT(current_ == this, "reading an image into an isolate that is not entered");
+  InterSource *inter = gInterSource;
+  if (inter->currEH || inter->callDepth > 0 || inter->jsPlugin->HasRequiredFiles()) {
+    fprintf(stderr, "heap image %s: the isolate is running or has loaded modules\n", path);
+    return false;
+  }
+  HeapImage image;
+  image.SetModule(main_fn_);
+  image.SetGlobals(inter->gp, inter->topGp - inter->gp);
+  if (!image.Read(path)) {
+    fprintf(stderr, "failed to read heap image %s: %s\n", path, image.Error());
+    return false;
+  }
+  maple_invalidate_prop_cache();
+  return true;
+}
+
+// The heap goes away as a whole; objects are not finalized one by one.
+void Isolate::Dispose() {
+  MASSERT(!entered_, "disposing an entered isolate");
+  // the InterSource gives its EH stack nodes back to its memory manager
+  Isolate *current = current_;
+  if (current) {
+    current->Save();
+  }
+  Load();
+  delete inter_source_;
+  delete memory_manager_;
+  delete js_global_;
+  if (current) {
+    current->Load();
+  } else {
+    Unload();
+  }
+  dlclose(handle_);
+  free(app_path_);
+  delete this;
+}
+
+void Isolate::Save() {
+  inter_source_ = gInterSource;
+  memory_manager_ = memory_manager;
+  js_global_ = jsGlobal;
+  js_global_memmap_ = jsGlobalMemmap;
+  global_this_binding_ = __js_Global_ThisBinding;
+  this_binding_ = __js_ThisBinding;
+  outer_binding_ = __js_OuterBinding;
+  global_strict_ = __is_global_strict;
+  memcpy(builtins_, __jsobj_get_jsbuiltin_objects(), sizeof(builtins_));
+#ifdef MARK_CYCLE_ROOTS
+  cycle_roots_ = cycle_roots;
+  garbage_roots_ = garbage_roots;
+#else
+  obj_list_ = obj_list;
+#endif
+  is_sweep_ = is_sweep;
+}
+
+void Isolate::Load() {
+  gInterSource = inter_source_;
+  memory_manager = memory_manager_;
+  jsGlobal = js_global_;
+  jsGlobalMemmap = js_global_memmap_;
+  __js_Global_ThisBinding = global_this_binding_;
+  __js_ThisBinding = this_binding_;
+  __js_OuterBinding = outer_binding_;
+  __is_global_strict = global_strict_;
+  memcpy(__jsobj_get_jsbuiltin_objects(), builtins_, sizeof(builtins_));
+#ifdef MARK_CYCLE_ROOTS
+  cycle_roots = cycle_roots_;
+  garbage_roots = garbage_roots_;
+#else
+  obj_list = obj_list_;
+#endif
+  is_sweep = is_sweep_;
+  maple_invalidate_prop_cache();
+}
+
+void Isolate::Unload() {
+  gInterSource = nullptr;
+  memory_manager = nullptr;
+  jsGlobal = nullptr;
+  jsGlobalMemmap = nullptr;
+  __js_Global_ThisBinding.x.u64 = 0;
+  __js_ThisBinding.x.u64 = 0;
+  __js_OuterBinding.x.u64 = 0;
+  __is_global_strict = false;
+  memset(__jsobj_get_jsbuiltin_objects(), 0, sizeof(__jsobject *) * JSBUILTIN_LAST_OBJECT);
+#ifdef MARK_CYCLE_ROOTS
+  cycle_roots = nullptr;
+  garbage_roots = nullptr;
+#else
+  obj_list = nullptr;
+#endif
+  is_sweep = false;
+}
+
+}  // namespace maple
@@ -0,0 +1,348 @@
+/*
+ * Copyright (C) [2021] Futurewei Technologies, Inc. All rights reserved.
+ *
+ * OpenArkCompiler is licensed under the Mulan Permissive Software License v2.
+ * You can use this software according to the terms and conditions of the MulanPSL - 2.0.
+ * You may obtain a copy of MulanPSL - 2.0 at:
+ *
+ *   https://opensource.org/licenses/MulanPSL-2.0
+ *
+ * THIS SOFTWARE IS PROVIDED ON AN "AS IS" BASIS, WITHOUT WARRANTIES OF ANY KIND, EITHER
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO NON-INFRINGEMENT, MERCHANTABILITY OR
+ * FIT FOR A PARTICULAR PURPOSE.
+ * See the MulanPSL - 2.0 for more details.
+ */
+
+#include <cerrno>
+#include <climits>
+#include <csignal>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <dlfcn.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <string>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "mzygote.h"
+#include "jsvalueinline.h"
+
+namespace maple {
+
+// Requests and replies are single messages on a SOCK_SEQPACKET socket.  A
+// request is the app path and the working directory, each ended by a NUL,
+// with the client's stdin, stdout and stderr attached.  The replies are
+// text: "mem rss=<kB> pss=<kB> shared=<kB> private=<kB>" from the child and
+// then "exit <status>" or "signal <number>" from the zygote.
+#define ZYGOTE_REQUEST_SIZE (2 * PATH_MAX + 2)
+#define ZYGOTE_REPLY_SIZE 128
+#define ZYGOTE_STREAMS 3
+
+static int sigchld_pipe[2] = { -1, -1 };
+
+static void ZygoteSigchld(int) {
+  int saved = errno;
+  char c = 0;
+  if (write(sigchld_pipe[1], &c, 1) < 0) {
+    // the pipe is full, so the zygote is going to reap anyway
+  }
+  errno = saved;
+}
+
+static bool SetSocketPath(sockaddr_un *addr, const char *path) {
+  if (strlen(path) >= sizeof(addr->sun_path)) {
+    fprintf(stderr, "zygote socket path is too long: %s\n", path);
+    return false;
+  }
+  memset(addr, 0, sizeof(*addr));
+  addr->sun_family = AF_UNIX;
+  strcpy(addr->sun_path, path);
+  return true;
+}
+
+static void SendReply(int fd, const char *reply) {
+  send(fd, reply, strlen(reply), MSG_NOSIGNAL);
+}
+
+// Memory of the calling process in kB, from /proc/self/smaps_rollup.  The
+// shared part is what the process shares with the zygote and its siblings;
+// PSS charges it to them in equal parts.
+static void ReadMemoryUse(unsigned long *rss, unsigned long *pss, unsigned long *shared, unsigned long *priv) {
+  *rss = *pss = *shared = *priv = 0;
+  FILE *file = fopen("/proc/self/smaps_rollup", "r");
+  if (!file) {
+    return;
+  }
+  char line[256];
+  unsigned long kb;
+  while (fgets(line, sizeof(line), file)) {
+    if (sscanf(line, "Rss: %lu kB", &kb) == 1) {
+      *rss = kb;
+    } else if (sscanf(line, "Pss: %lu kB", &kb) == 1) {
+      *pss = kb;
+    } else if (sscanf(line, "Shared_Clean: %lu kB", &kb) == 1 || sscanf(line, "Shared_Dirty: %lu kB", &kb) == 1) {
+      *shared += kb;
+    } else if (sscanf(line, "Private_Clean: %lu kB", &kb) == 1 || sscanf(line, "Private_Dirty: %lu kB", &kb) == 1) {
+      *priv += kb;
+    }
+  }
+  fclose(file);
+}
+
+Zygote::Zygote(Isolate *isolate) : isolate_(isolate), listen_fd_(-1) {}
+
+// The modules stay mapped for the zygote's life, so a child's require()
+// finds them loaded and only sets up their globals.
+void Zygote::Preload(const char *paths) {
+  std::string list(paths);
+  size_t start = 0;
+  while (start <= list.size()) {
+    size_t end = list.find(':', start);
+    if (end == std::string::npos) {
+      end = list.size();
+    }
+    std::string path = list.substr(start, end - start);
+    if (!path.empty() && !dlopen(path.c_str(), RTLD_NOW)) {
+      fprintf(stderr, "zygote: failed to preload %s: %s\n", path.c_str(), dlerror());
+    }
+    start = end + 1;
+  }
+}
+
+int Zygote::Serve(const char *path) {
+  sockaddr_un addr;
+  if (!SetSocketPath(&addr, path)) {
+    return 1;
+  }
+  listen_fd_ = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0);
+  if (listen_fd_ < 0) {
+    perror("zygote: socket");
+    return 1;
+  }
+  unlink(path);  // left by an earlier zygote
+  // a request runs code as this user, so only this user may connect: the
+  // socket is created mode 0600, and peers are checked again on accept
+  mode_t old_mask = umask(0177);
+  int bound = bind(listen_fd_, (sockaddr *)&addr, sizeof(addr));
+  umask(old_mask);
+  if (bound != 0 || listen(listen_fd_, SOMAXCONN) != 0) {
+    fprintf(stderr, "zygote: cannot listen on %s: %s\n", path, strerror(errno));
+    close(listen_fd_);
+    return 1;
+  }
+  if (pipe2(sigchld_pipe, O_CLOEXEC | O_NONBLOCK) != 0) {
+    perror("zygote: pipe");
+    close(listen_fd_);
+    return 1;
+  }
+  struct sigaction action;
+  memset(&action, 0, sizeof(action));
+  action.sa_handler = ZygoteSigchld;
+  action.sa_flags = SA_RESTART | SA_NOCLDSTOP;
+  sigaction(SIGCHLD, &action, nullptr);
+
+  unsigned long rss, pss, shared, priv;
+  ReadMemoryUse(&rss, &pss, &shared, &priv);
+  fprintf(stderr, "zygote: serving %s, rss %lu kB, pss %lu kB\n", path, rss, pss);
+  for (;;) {
+    pollfd fds[2] = { { listen_fd_, POLLIN, 0 }, { sigchld_pipe[0], POLLIN, 0 } };
+    if (poll(fds, 2, -1) < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      perror("zygote: poll");
+      return 1;
+    }
+    if (fds[1].revents & POLLIN) {
+      char buf[64];
+      while (read(sigchld_pipe[0], buf, sizeof(buf)) > 0) {
+      }
+      Reap();
+    }
+    if (!(fds[0].revents & POLLIN)) {
+      continue;
+    }
+    int conn = accept4(listen_fd_, nullptr, nullptr, SOCK_CLOEXEC);
+    if (conn < 0) {
+      continue;
+    }
+    ucred cred;
+    socklen_t cred_len = sizeof(cred);
+    if (getsockopt(conn, SOL_SOCKET, SO_PEERCRED, &cred, &cred_len) != 0) {
+      cred.uid = (uid_t)-1;
+    }
+    if (cred.uid != geteuid()) {
+      fprintf(stderr, "zygote: refused a request from uid %d\n", (int)cred.uid);
+      close(conn);
+      continue;
+    }
+    // nothing buffered may be written twice
+    fflush(nullptr);
+    pid_t pid = fork();
+    if (pid == 0) {
+      Child(conn);
+    }
+    if (pid < 0) {
+      SendReply(conn, "exit 1");
+      close(conn);
+    } else {
+      children_[pid] = conn;
+    }
+  }
+}
+
+void Zygote::Reap() {
+  int status;
+  pid_t pid;
+  while ((pid = waitpid(-1, &status, WNOHANG)) > 0) {
+    auto it = children_.find(pid);
+    if (it == children_.end()) {
+      continue;
+    }
+    char reply[ZYGOTE_REPLY_SIZE];
+    if (WIFSIGNALED(status)) {
+      snprintf(reply, sizeof(reply), "signal %d", WTERMSIG(status));
+    } else {
+      snprintf(reply, sizeof(reply), "exit %d", WEXITSTATUS(status));
+    }
+    SendReply(it->second, reply);
+    close(it->second);
+    children_.erase(it);
+  }
+}
+
+// Runs in the child: take over the client's streams and directory and run
+// its app on the warm isolate.  Never returns.
+void Zygote::Child(int conn) {
+  close(listen_fd_);
+  close(sigchld_pipe[0]);
+  close(sigchld_pipe[1]);
+  signal(SIGCHLD, SIG_DFL);
+  for (auto &it : children_) {
+    close(it.second);
+  }
+  children_.clear();
+
+  char request[ZYGOTE_REQUEST_SIZE + 1];
+  char control[CMSG_SPACE(ZYGOTE_STREAMS * sizeof(int))];
+  iovec iov = { request, ZYGOTE_REQUEST_SIZE };
+  msghdr msg;
+  memset(&msg, 0, sizeof(msg));
+  msg.msg_iov = &iov;
+  msg.msg_iovlen = 1;
+  msg.msg_control = control;
+  msg.msg_controllen = sizeof(control);
+  ssize_t len = recvmsg(conn, &msg, MSG_CMSG_CLOEXEC);
+  cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+  if (len <= 0 || !cmsg || cmsg->cmsg_type != SCM_RIGHTS ||
+      cmsg->cmsg_len != CMSG_LEN(ZYGOTE_STREAMS * sizeof(int))) {
+    _exit(1);
+  }
+  int streams[ZYGOTE_STREAMS];
+  memcpy(streams, CMSG_DATA(cmsg), sizeof(streams));
+  for (int i = 0; i < ZYGOTE_STREAMS; i++) {
+    dup2(streams[i], i);
+    close(streams[i]);
+  }
+  request[len] = '\0';
+  const char *app_path = request;
+  size_t app_len = strlen(app_path);
+  const char *cwd = (size_t)len > app_len + 1 ? request + app_len + 1 : "";
+  if (*cwd && chdir(cwd) != 0) {
+    fprintf(stderr, "zygote: cannot change to %s: %s\n", cwd, strerror(errno));
+  }
+  if (!isolate_->ReplaceMain(app_path)) {
+    exit(1);
+  }
+  TValue val = isolate_->RunMain();
+#ifdef MM_DEBUG
+  memory_manager->DumpMMStats();
+#endif
+  if (memory_manager->stats_dump_enabled_) {
+    memory_manager->DumpMemStats(stderr);
+  }
+  unsigned long rss, pss, shared, priv;
+  ReadMemoryUse(&rss, &pss, &shared, &priv);
+  char reply[ZYGOTE_REPLY_SIZE];
+  snprintf(reply, sizeof(reply), "mem rss=%lu pss=%lu shared=%lu private=%lu", rss, pss, shared, priv);
+  SendReply(conn, reply);
+  exit((int)GET_PAYLOAD(val));
+}
+
+bool Zygote::Run(const char *path, const char *app_path, int64_t *status) {
+  sockaddr_un addr;
+  if (!SetSocketPath(&addr, path)) {
+    return false;
+  }
+  int fd = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0);
+  if (fd < 0) {
+    return false;
+  }
+  if (connect(fd, (sockaddr *)&addr, sizeof(addr)) != 0) {
+    close(fd);
+    return false;
+  }
+  // the child resolves the app and its requires from the client's directory
+  char *app = realpath(app_path, nullptr);
+  char *cwd = get_current_dir_name();
+  std::string request(app ? app : app_path);
+  request.push_back('\0');
+  if (cwd) {
+    request.append(cwd);
+  }
+  request.push_back('\0');
+  free(app);
+  free(cwd);
+
+  int streams[ZYGOTE_STREAMS] = { STDIN_FILENO, STDOUT_FILENO, STDERR_FILENO };
+  char control[CMSG_SPACE(sizeof(streams))];
+  memset(control, 0, sizeof(control));
+  iovec iov = { (void *)request.data(), request.size() };
+  msghdr msg;
+  memset(&msg, 0, sizeof(msg));
+  msg.msg_iov = &iov;
+  msg.msg_iovlen = 1;
+  msg.msg_control = control;
+  msg.msg_controllen = sizeof(control);
+  cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+  cmsg->cmsg_level = SOL_SOCKET;
+  cmsg->cmsg_type = SCM_RIGHTS;
+  cmsg->cmsg_len = CMSG_LEN(sizeof(streams));
+  memcpy(CMSG_DATA(cmsg), streams, sizeof(streams));
+  fflush(nullptr);
+  if (request.size() > ZYGOTE_REQUEST_SIZE || sendmsg(fd, &msg, MSG_NOSIGNAL) < 0) {
+    close(fd);
+    return false;
+  }
+
+  // The zygote has the request; from here on the app's status is the
+  // answer, and a zygote that goes away counts as a failed run.
+  *status = 1;
+  char reply[ZYGOTE_REPLY_SIZE + 1];
+  ssize_t len;
+  while ((len = recv(fd, reply, ZYGOTE_REPLY_SIZE, 0)) > 0 || (len < 0 && errno == EINTR)) {
+    if (len < 0) {
+      continue;
+    }
+    reply[len] = '\0';
+    int value;
+    if (!strncmp(reply, "mem ", 4)) {
+      if (getenv("MAPLE_MEM_STATS")) {
+        fprintf(stderr, "zygote child: %s (kB)\n", reply + 4);
+      }
+    } else if (sscanf(reply, "exit %d", &value) == 1) {
+      *status = value;
+    } else if (sscanf(reply, "signal %d", &value) == 1) {
+      *status = 128 + value;
+    }
+  }
+  close(fd);
+  return true;
+}
+
+}  // namespace maple
@@ -14,12 +14,19 @@
  */
 
 #include <cstdarg>
+#include <climits>
 #include <cstring>
+#include <new>
+#include <sys/mman.h>
+#include <unistd.h>
 
 #include "mfunction.h"
 #include "massert.h" // for MASSERT
 #include "mshimdyn.h"
+#include "misolate.h"
+#include "mzygote.h"
 #include "vmmemory.h"
+#include "vmheapsnapshot.h"
 #include "jsvalueinline.h"
 #include "jstycnv.h"
 #include "jsiter.h"
@@ -33,9 +40,9 @@
 
 namespace maple {
 
-JavaScriptGlobal *jsGlobal = NULL;
-uint32_t *jsGlobalMemmap = NULL;
-InterSource *gInterSource = NULL;
+VM_TLS JavaScriptGlobal *jsGlobal = NULL;
+VM_TLS uint32_t *jsGlobalMemmap = NULL;
+VM_TLS InterSource *gInterSource = NULL;
 
 
 uint8 InterSource::ptypesizetable[kPtyDerived] = {
@@ -75,59 +82,114 @@ uint8 InterSource::ptypesizetable[kPtyDerived] = {
 };
 
 InterSource::InterSource() {
+  // MAPLE_HEAP_SIZE (in MB) bounds the heap; only the pages actually used are committed.
   const char* heap_size_env = std::getenv("MAPLE_HEAP_SIZE");
+  uint64_t heap_reserve = HEAP_MAX_RESERVE_SIZE;
   if (heap_size_env != nullptr) {
-    heap_size_ = atoi(heap_size_env) * 1024 * 1024;
-    if (heap_size_ < HEAP_SIZE)
-      heap_size_ = HEAP_SIZE;
-    else if (heap_size_ > 1024 * 1024 *1024)
-      heap_size_ = 1024 * 1024 *1024;
-
-    total_memory_size_ = heap_size_ + VM_MEMORY_SIZE;
-  } else {
-    total_memory_size_ = HEAP_SIZE + VM_MEMORY_SIZE;
-    heap_size_ = HEAP_SIZE;
-  }
-  memory = (void *)malloc(heap_size_ + VM_MEMORY_SIZE);
+    heap_reserve = (uint64_t)atoi(heap_size_env) * 1024 * 1024;
+    if (heap_reserve < HEAP_SIZE)
+      heap_reserve = HEAP_SIZE;
+    else if (heap_reserve > HEAP_MAX_RESERVE_SIZE)
+      heap_reserve = HEAP_MAX_RESERVE_SIZE;
+  }
+  // keep both halves of the heap (small and big regions) granule and huge
+  // page aligned
+  uint32_t heap_align = HEAP_COMMIT_GRANULE > HEAP_HUGE_PAGE_SIZE ? HEAP_COMMIT_GRANULE : HEAP_HUGE_PAGE_SIZE;
+  heap_size_ = (heap_reserve + 2 * heap_align - 1) / (2 * heap_align) * (2 * heap_align);
+  los_size_ = heap_size_ * LARGE_OBJECT_SPACE_RATIO;
+  total_memory_size_ = heap_size_ + los_size_ + VM_STACK_SIZE;
+  // reserve a huge page more than needed and trim it to a huge page boundary
+  uint8_t *reserve = (uint8_t *)mmap(NULL, total_memory_size_ + HEAP_HUGE_PAGE_SIZE, PROT_NONE,
+                                     MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+  if (reserve == MAP_FAILED) {
+    MIR_FATAL("failed to reserve VM memory");
+  }
+  uint8_t *aligned = (uint8_t *)(((uintptr_t)reserve + HEAP_HUGE_PAGE_SIZE - 1) & ~(uintptr_t)(HEAP_HUGE_PAGE_SIZE - 1));
+  if (aligned > reserve) {
+    munmap(reserve, aligned - reserve);
+  }
+  munmap(aligned + total_memory_size_, reserve + HEAP_HUGE_PAGE_SIZE - aligned);
+  memory = aligned;
 #ifdef COULD_BE_ADDRESS
   // to test if COULD_BE_ADDRESS(v) stands
   assert(COULD_BE_ADDRESS(memory));
 #endif
-  void * internalMemory = (void *)((char *)memory + heap_size_);
-  stack = heap_size_/*STACKOFFSET*/;
+  // The stack sits above the heap and the large-object space and is
+  // committed up front; the heap pages are committed by the memory manager
+  // on demand, and its internal memory is mapped in chunks as it grows.
+  uint32_t heap_top = heap_size_ + los_size_;
+  if (mprotect((char *)memory + heap_top, VM_STACK_SIZE, PROT_READ | PROT_WRITE) != 0) {
+    MIR_FATAL("failed to commit VM stack memory");
+  }
+  stack = heap_top + VM_STACK_SIZE/*STACKOFFSET*/;
   sp = stack;
   fp = stack;
   heap = 0;
+  gp = nullptr;
+  topGp = nullptr;
+  jsPlugin = nullptr;
   retVal0 = __null_value();
   currEH = nullptr;
   EHstackReuseSize = 0;
 
+  const char* call_depth_env = std::getenv("MAPLE_MAX_CALL_DEPTH");
+  maxCallDepth = MAX_JS_CALL_DEPTH;
+  if (call_depth_env != nullptr && atoi(call_depth_env) > 0) {
+    maxCallDepth = atoi(call_depth_env);
+  }
+  callStackSize = JS_CALL_STACK_SIZE;
+  callStack = (uint8_t *)mmap(nullptr, callStackSize, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+  if (callStack == MAP_FAILED) {
+    MIR_FATAL("failed to reserve the JS call stack");
+  }
+  callStackCommitted = 0;
+  callStackTop = 0;
+  callDepth = 0;
+  interpDepth = 0;
+  rcScanTop = nullptr;
+  globalCells = nullptr;
+  globalCellNum = 0;
+  globalCellCap = 0;
+  globalCellEpoch = 0;
+  ClearRegCounts();
+
   // retVal0.payload.asbits = 0;
   memory_manager = new MemoryManager();
-  memory_manager->Init(memory, heap_size_, internalMemory, VM_MEMORY_SIZE);
+  memory_manager->Init(memory, heap_size_, los_size_);
   gInterSource = this;
   // currEH = NULL;
   // EHstackReuseSize = 0;
 }
 
+// Frees what lives outside the memory manager and unmaps the heap, the
+// large-object space and the stack.  The memory manager must still be the
+// current one, since the EH stacks give their nodes back to it.
+InterSource::~InterSource() {
+  delete jsPlugin;
+  free(gp);
+  free(globalCells);
+  munmap(callStack, callStackSize);
+  munmap(memory, total_memory_size_);
+}
+
 void InterSource::SetRetval0 (TValue &mval) {
   if (IS_NEEDRC(mval.x.u64))
-    memory_manager->GCIncRf((void*)mval.x.c.payload);
+    StackIncRf((void*)mval.x.c.payload);
   if (IS_NEEDRC(retVal0.x.u64))
-    memory_manager->GCDecRf((void*)retVal0.x.c.payload);
+    StackDecRf((void*)retVal0.x.c.payload);
   retVal0 = mval;
 }
 
 void InterSource::SetRetval0Object (void *obj, bool isdyntype) {
-  memory_manager->GCIncRf(obj);
+  StackIncRf(obj);
   if (IS_NEEDRC(retVal0.x.u64))
-    memory_manager->GCDecRf((void*)retVal0.x.c.payload);
+    StackDecRf((void*)retVal0.x.c.payload);
   retVal0 = __object_value((__jsobject *)obj);
 }
 
 void InterSource::SetRetval0NoInc (uint64_t val) {
   if (IS_NEEDRC(retVal0.x.u64))
-    memory_manager->GCDecRf((void*)retVal0.x.c.payload);
+    StackDecRf((void*)retVal0.x.c.payload);
   retVal0.x.u64 = val;
 }
 
@@ -169,7 +231,7 @@ int32_t InterSource::PassArguments(TValue &this_arg, void *env, TValue *arg_list
 #ifndef RC_OPT_FUNC_ARGS
     // RC is increased for args and decreased after the func call, therefore, the pair of RC ops can be eliminated.
     if (IS_NEEDRC(actual.x.u64)) {
-      memory_manager->GCIncRf((void*)actual.x.c.payload);
+      StackIncRf((void*)actual.x.c.payload);
     }
 #endif
   }
@@ -184,7 +246,7 @@ int32_t InterSource::PassArguments(TValue &this_arg, void *env, TValue *arg_list
     TValue envMal = __env_value(env);
     EmulateStore(spaddr + offset + MVALSIZE, envMal);
 #ifndef RC_OPT_FUNC_ARGS
-    memory_manager->GCIncRf((void*)envMal.x.c.payload);
+    StackIncRf((void*)envMal.x.c.payload);
 #endif
   }
   // Pass the 'this'.
@@ -192,7 +254,7 @@ int32_t InterSource::PassArguments(TValue &this_arg, void *env, TValue *arg_list
 #ifndef RC_OPT_FUNC_ARGS
  // RC is increased for args and decreased after the func call, therefore, the pair of RC ops can be eliminated.
   if (IS_NEEDRC(this_arg.x.u64))
-    memory_manager->GCIncRf((void*)this_arg.x.c.payload);
+    StackIncRf((void*)this_arg.x.c.payload);
 #endif
   return offset;
 }
@@ -1339,9 +1401,9 @@ void InterSource::JSopSetProp(TValue &mv0, TValue &mv1, TValue &mv2) {
         if (index < numArgs - 1 && !curFunc->IsIndexDeleted(index)) {
           void **addrFp = (void **)((uint8 *)GetFPAddr() + (index + 1)*sizeof(void *));
           if (IS_NEEDRC(*addrFp))
-            memory_manager->GCDecRf(*addrFp);
+            StackDecRf(*addrFp);
           if (IS_NEEDRC(mv2.x.u64))
-            memory_manager->GCIncRf((void*)mv2.x.c.payload);
+            StackIncRf((void*)mv2.x.c.payload);
           EmulateStore((uint8_t *)addrFp, mv2);
         }
       }
@@ -1363,9 +1425,9 @@ void InterSource::JSopInitProp(TValue &mv0, TValue &mv1, TValue &mv2) {
         if (index < numArgs - 1 && !curFunc->IsIndexDeleted(index)) {
           void **addrFp = (void **)((uint8 *)GetFPAddr() + (index + 1)*sizeof(void *));
           if (IS_NEEDRC(*addrFp))
-            memory_manager->GCDecRf(*addrFp);
+            StackDecRf(*addrFp);
           if (IS_NEEDRC(mv2.x.u64))
-            memory_manager->GCIncRf((void*)mv2.x.c.payload);
+            StackIncRf((void*)mv2.x.c.payload);
           EmulateStore((uint8_t *)addrFp, mv2);
         }
       }
@@ -1385,14 +1447,155 @@ TValue InterSource::JSopMoreIterator(TValue &mv0) {
   return __boolean_value(__jsop_more_iterator((void *)GET_PAYLOAD(mv0)));
 }
 
-void InterSource::InsertProlog(uint16_t frameSize) {
+void InterSource::InsertProlog(DynamicMethodHeaderT *header) {
+  uint16_t frameSize = header->frameSize;
   uint8 *addrs = (uint8 *)memory + sp;
+  if (DynMFunction::has_frame_bitmap(header) && !memory_manager->ScansVMStack()) {
+    // only the slots that can hold a reference need to start out clean
+    uint32_t slots = DynMFunction::frame_ref_slots(header);
+    while (slots) {
+      uint32_t i = __builtin_ctz(slots);
+      slots &= slots - 1;
+      *(uint64_t *)(addrs - (i + 1) * sizeof(void *)) = 0;
+    }
+  } else {
+    memset(addrs - frameSize, 0, frameSize - 4);
+  }
   *(uint32_t *)(addrs - 4) = fp;
-  memset(addrs - frameSize,0,frameSize - 4);
   fp = sp;
   sp -= frameSize;
 }
 
+// RC-- for the callee frame ending at frameEnd and the args between frameEnd and argsEnd
+void InterSource::ReleaseFrame(DynamicMethodHeaderT *header, uint8 *frameEnd, uint8 *argsEnd) {
+#ifdef RC_DEFER_STACK
+  return;  // frame slots are not counted
+#endif
+  if (DynMFunction::has_frame_bitmap(header)) {
+    uint32_t slots = DynMFunction::frame_ref_slots(header);
+    while (slots) {
+      uint32_t i = __builtin_ctz(slots);
+      slots &= slots - 1;
+      TValue local = *(TValue *)(frameEnd - (i + 1) * sizeof(void *));
+      if (IS_NEEDRC(local.x.u64)) {
+        memory_manager->GCDecRf((void *)local.x.c.payload);
+      }
+    }
+  } else {
+    for (uint8 *addr = frameEnd - header->frameSize; addr < frameEnd; addr += sizeof(void *)) {
+      TValue local = *(TValue *)addr;
+      if (IS_NEEDRC(local.x.u64)) {
+        memory_manager->GCDecRf((void *)local.x.c.payload);
+      }
+    }
+  }
+  for (uint8 *addr = frameEnd; addr < argsEnd; addr += sizeof(void *)) {
+    TValue arg = *(TValue *)addr;
+    if (IS_NEEDRC(arg.x.u64)) {
+      memory_manager->GCDecRf((void *)arg.x.c.payload);
+    }
+  }
+}
+
+static void ScanDeferredRCRoots(bool count) {
+  InterSource *inter = gInterSource;
+  for (uint8 *addr = (uint8 *)inter->GetSPAddr(); addr < (uint8 *)inter->memory + inter->stack;
+       addr += sizeof(void *)) {
+    memory_manager->CountStackRoot(*(TValue *)addr, count);
+  }
+  memory_manager->CountStackRoot(inter->retVal0, count);
+  memory_manager->CountStackRoot(__js_ThisBinding, count);
+  if (inter->currEH) {
+    TValue thrown = inter->currEH->GetThrownval();
+    memory_manager->CountStackRoot(thrown, count);
+  }
+  for (DynMFunction *f = inter->rcScanTop; f; f = f->caller) {
+    for (uint32_t i = 0; i < f->regCount; i++) {
+      memory_manager->CountStackRoot(f->regStack[i], count);
+    }
+    for (uint64_t i = 1; i <= f->sp; i++) {
+      memory_manager->CountStackRoot(f->operand_stack[i], count);
+    }
+    if (f->argumentsObj) {
+      TValue args = __object_value((__jsobject *)f->argumentsObj);
+      memory_manager->CountStackRoot(args, count);
+    }
+    if (f->caller) {
+      memory_manager->CountStackRoot(f->callState.thisArg, count);
+      memory_manager->CountStackRoot(f->callState.oldThis, count);
+      memory_manager->CountStackRoot(f->callState.oldArgs, count);
+    }
+  }
+}
+
+// Deferred RC safe point: |top| is the innermost frame, whose sp must be up
+// to date.  Only valid when no native frame is active (interpDepth == 1),
+// since native code keeps uncounted references in C++ locals.
+void InterSource::ReconcileDeferredRC(DynMFunction *top) {
+  rcScanTop = top;
+  memory_manager->ReconcileZct(ScanDeferredRCRoots);
+  rcScanTop = nullptr;
+}
+
+// Write the heap reachable from the globals, the builtins and the VM stack
+// to |path|.  |top| is the innermost frame, whose sp must be up to date.
+bool InterSource::WriteHeapSnapshot(const char *path, DynMFunction *top) {
+  HeapSnapshot snapshot;
+  if (jsPlugin && jsPlugin->mainFileInfo) {
+    for (JsFileInforNode *node = jsPlugin->mainFileInfo; node; node = node->next) {
+      std::string name = std::string("(Globals) ") + (node->fileName ? node->fileName : "");
+      snapshot.BeginRoots(name.c_str());
+      snapshot.AddRoots((TValue *)node->gp, (TValue *)(node->gp + node->glbMemsize));
+    }
+  } else {
+    snapshot.BeginRoots("(Globals)");
+    snapshot.AddRoots((TValue *)gp, (TValue *)topGp);
+  }
+
+  snapshot.BeginRoots("(Builtins)");
+  __jsobject **builtins = __jsobj_get_jsbuiltin_objects();
+  for (uint32_t i = 0; i < JSBUILTIN_LAST_OBJECT; i++) {
+    if (builtins[i]) {
+      snapshot.AddRoot(nullptr, __object_value(builtins[i]));
+    }
+  }
+
+  snapshot.BeginRoots("(Stack roots)");
+  snapshot.AddStackRoots((TValue *)GetSPAddr(), (TValue *)((uint8 *)memory + stack));
+  snapshot.AddRoot("return value", retVal0);
+  snapshot.AddRoot("this", __js_ThisBinding);
+  if (currEH) {
+    snapshot.AddRoot("exception", currEH->GetThrownval());
+  }
+  for (DynMFunction *f = top; f; f = f->caller) {
+    snapshot.AddRoots(f->regStack, f->regStack + f->regCount);
+    snapshot.AddRoots(f->operand_stack + 1, f->operand_stack + f->sp + 1);
+    if (f->argumentsObj) {
+      snapshot.AddRoot("arguments", __object_value((__jsobject *)f->argumentsObj));
+    }
+    if (f->caller) {
+      snapshot.AddRoot(nullptr, f->callState.thisArg);
+      snapshot.AddRoot(nullptr, f->callState.oldThis);
+      snapshot.AddRoot(nullptr, f->callState.oldArgs);
+    }
+  }
+  return snapshot.Write(path);
+}
+
+// Heap snapshot safe point: write the snapshot requested by SIGUSR2 to
+// <MAPLE_HEAP_SNAPSHOT>.<pid>.<n>.heapsnapshot.
+void InterSource::TakePendingHeapSnapshot(DynMFunction *top) {
+  memory_manager->heap_snapshot_seen_ = mem_signal_count.load(std::memory_order_relaxed);
+  char path[PATH_MAX];
+  snprintf(path, sizeof(path), "%s.%d.%u.heapsnapshot", memory_manager->heap_snapshot_prefix_, (int)getpid(),
+           memory_manager->heap_snapshot_count_++);
+  if (WriteHeapSnapshot(path, top)) {
+    fprintf(stderr, "heap snapshot written to %s\n", path);
+  } else {
+    fprintf(stderr, "cannot write heap snapshot %s\n", path);
+  }
+}
+
 TValue InterSource::JSopBinary(MIRIntrinsicID id, TValue &mv0, TValue &mv1) {
   uint64_t u64Ret = 0;
   switch (id) {
@@ -1466,6 +1669,38 @@ TValue InterSource::JSopGetThisPropByName(TValue &mv1) {
   return (__jsop_get_this_prop_by_name(__js_Global_ThisBinding, v1));
 }
 
+// returns the cell for a global name, or -1 once the cell table is full
+int32_t InterSource::BindGlobalCell(__jsstring *name) {
+  std::map<__jsstring *, uint32_t>::iterator it = globalCellIndex.find(name);
+  if (it != globalCellIndex.end()) {
+    return it->second;
+  }
+  if (globalCellNum == MAX_GLOBAL_PROP_CELLS) {
+    return -1;
+  }
+  if (globalCellNum == globalCellCap) {
+    uint32_t cap = globalCellCap ? globalCellCap * 2 : 64;
+    GlobalPropCell *cells = (GlobalPropCell *)realloc(globalCells, cap * sizeof(GlobalPropCell));
+    if (!cells) {
+      return -1;
+    }
+    globalCells = cells;
+    globalCellCap = cap;
+  }
+  GlobalPropCell &cell = globalCells[globalCellNum];
+  cell.name = name;
+  cell.prop = nullptr;
+  cell.epoch = globalCellEpoch;
+  globalCellIndex[name] = globalCellNum;
+  return globalCellNum++;
+}
+
+__jsprop *InterSource::RefreshGlobalCell(GlobalPropCell &cell) {
+  cell.prop = __jsop_get_this_prop_cell(__js_Global_ThisBinding, cell.name);
+  cell.epoch = globalCellEpoch;
+  return cell.prop;
+}
+
 TValue InterSource::JSopGetPropByName(TValue &mv0, TValue &mv1) {
   if (__is_undefined(mv0)) {
     MAPLE_JS_TYPEERROR_EXCEPTION();
@@ -1844,7 +2079,7 @@ TValue InterSource::IntrinCall(MIRIntrinsicID id, TValue *args, int numArgs) {
   TValue mval0 = args[0];
   // 11.2.3 step 4: if args[0] is not object, throw type exception
   if (!IS_OBJECT(mval0.x.u64)) {
-    MAPLE_JS_TYPEERROR_EXCEPTION();
+    return RaiseError(JSBUILTIN_TYPEERROR_CONSTRUCTOR);
   }
   //__jsobject *f = (__jsobject *)memory_manager->GetRealAddr(GetMvalueValue(mval0));;
   __jsobject *f = (__jsobject *)GET_PAYLOAD(mval0);
@@ -1852,8 +2087,8 @@ TValue InterSource::IntrinCall(MIRIntrinsicID id, TValue *args, int numArgs) {
   TValue retCall;
   retCall.x.u64 = 0;
   if (!func || f->object_class != JSFUNCTION) {
-    // trying to call a null function, throw TypeError directly
-    MAPLE_JS_TYPEERROR_EXCEPTION();
+    // trying to call a null function, raise TypeError directly
+    return RaiseError(JSBUILTIN_TYPEERROR_CONSTRUCTOR);
   }
   if (func->attrs & 0xff & JSFUNCPROP_NATIVE || id == INTRN_JSOP_NEW) {
     retCall = NativeFuncCall(id, args, numArgs);
@@ -1916,9 +2151,9 @@ TValue InterSource::NativeFuncCall(MIRIntrinsicID id, TValue *args, int numArgs)
             if (!__is_undefined(idxValue) && isOldWritable) {
               void **addrFp = (void **)((uint8 *)GetFPAddr() + (index + 1)*sizeof(void *));
               if (IS_NEEDRC(*addrFp))
-                memory_manager->GCDecRf(*addrFp);
+                StackDecRf(*addrFp);
               if (IS_NEEDRC(idxValue.x.u64))
-                memory_manager->GCIncRf((void*)idxValue.x.c.payload);
+                StackIncRf((void*)idxValue.x.c.payload);
               EmulateStore((uint8_t *)addrFp, idxValue);
             }
             SetRetval0(arg0);
@@ -1972,6 +2207,20 @@ TValue InterSource::BoundFuncCall(TValue *args, int numArgs) {
 
 TValue InterSource::FuncCall(void *callee, bool isIntrinsiccall, void *env, TValue *args, int numArgs,
                 int start, int nargs, bool strictP) {
+  DynCallState state;
+  CheckVMStackRoom((DynamicMethodHeaderT *)((uint8_t *)callee + 4), numArgs - start);
+  void *argsObj = FuncCallEnter(callee, isIntrinsiccall, env, args, numArgs, start, nargs, strictP, state);
+  DynamicMethodHeaderT* calleeHeader = (DynamicMethodHeaderT *)((uint8_t *)callee + 4);
+  DynMFunction *oldDynFunc = GetCurFunc();
+  TValue ret = maple_invoke_dynamic_method(calleeHeader, argsObj);
+  SetCurFunc(oldDynFunc);
+  FuncCallExit(calleeHeader, state);
+  return ret;
+}
+
+// Pass the arguments and enter the callee's this-binding; returns the callee's arguments object, if it uses one.
+void *InterSource::FuncCallEnter(void *callee, bool isIntrinsiccall, void *env, TValue *args, int numArgs,
+                int start, int nargs, bool strictP, DynCallState &state) {
   int32_t passedNargs = numArgs - start;
   TValue mvArgs[MAXCALLARGNUM];
   MIR_ASSERT(passedNargs <= MAXCALLARGNUM);
@@ -1984,46 +2233,102 @@ TValue InterSource::FuncCall(void *callee, bool isIntrinsiccall, void *env, TVal
   }
   int32_t offset = PassArguments(thisval, env, mvArgs, passedNargs, nargs);
   sp += offset;
-  TValue this_arg = (thisval);
 
   DynamicMethodHeaderT* calleeHeader = (DynamicMethodHeaderT *)((uint8_t *)callee + 4);
-  TValue old_this = __js_entry_function(this_arg, (calleeHeader->attribute & FUNCATTRSTRICT) | strictP);
-  TValue ret;
-  DynMFunction *oldDynFunc = GetCurFunc();
+  state.offset = offset;
+  state.thisArg = thisval;
+  state.strict = (calleeHeader->attribute & FUNCATTRSTRICT) | strictP;
+  state.oldThis = __js_entry_function(state.thisArg, state.strict);
+  state.oldFileInfo = nullptr;
   if (DynMFunction::is_jsargument(calleeHeader)) {
-    TValue oldArgs = __jsop_get_this_prop_by_name(__js_Global_ThisBinding, __jsstr_get_builtin(JSBUILTIN_STRING_ARGUMENTS));
+    state.oldArgs = __jsop_get_this_prop_by_name(__js_Global_ThisBinding, __jsstr_get_builtin(JSBUILTIN_STRING_ARGUMENTS));
     // bool isVargs = (passedNargs > 0) && ((calleeHeader->upFormalSize/8 - 1) != passedNargs);
     // TValue ret = maple_invoke_dynamic_method(calleeHeader, !isVargs ? nullptr : CreateArgumentsObject(mvArgs, passedNargs));
-    void* argsObj = CreateArgumentsObject(mvArgs, passedNargs, args[0]);
-    ret = maple_invoke_dynamic_method(calleeHeader, argsObj);
-    __jsop_set_this_prop_by_name(__js_Global_ThisBinding, __jsstr_get_builtin(JSBUILTIN_STRING_ARGUMENTS), oldArgs, true);
-  } else {
-    ret = maple_invoke_dynamic_method(calleeHeader, NULL);
+    return CreateArgumentsObject(mvArgs, passedNargs, args[0]);
   }
+  return nullptr;
+}
 
-  __js_exit_function(this_arg, old_this, (calleeHeader->attribute & FUNCATTRSTRICT)|strictP);
+void InterSource::FuncCallExit(DynamicMethodHeaderT *calleeHeader, DynCallState &state) {
+  if (DynMFunction::is_jsargument(calleeHeader)) {
+    __jsop_set_this_prop_by_name(__js_Global_ThisBinding, __jsstr_get_builtin(JSBUILTIN_STRING_ARGUMENTS), state.oldArgs, true);
+  }
+  __js_exit_function(state.thisArg, state.oldThis, state.strict);
+  int32_t offset = state.offset;
   sp -= offset;
-  SetCurFunc(oldDynFunc);
 
   // RC-- for local vars
   // RC is increased for args and decreased after the func call, therefore, the pair of RC ops can be eliminated.
   uint8 *spaddr = (uint8 *)GetSPAddr();
   uint8 *frameEnd = spaddr + offset;  // offset is negative
-  uint8 *addr = frameEnd - calleeHeader->frameSize;
-  // frame: between addr and frameEnd; args: between frameEnd and spaddr
+  // frame: below frameEnd; args: between frameEnd and spaddr
 #ifdef RC_OPT_FUNC_ARGS
-  while(addr < frameEnd) {
+  ReleaseFrame(calleeHeader, frameEnd, frameEnd);
 #else
-  while(addr < spaddr) {
+  ReleaseFrame(calleeHeader, frameEnd, spaddr);
 #endif
-    TValue local = *(TValue *)addr;
-    if (IS_NEEDRC(local.x.u64)) {
-      memory_manager->GCDecRf((void*)local.x.c.payload);
-    }
-    addr += sizeof(void*);
+}
+
+// Whether the callee frame and nargs arguments fit in the VM stack, keeping
+// VM_STACK_GUARD bytes free above the heap and the large-object space.
+bool InterSource::HasVMStackRoom(DynamicMethodHeaderT *header, int32_t nargs) {
+  uint64_t need = header->frameSize + (uint64_t)nargs * MVALSIZE + header->upFormalSize;
+  uint8 *limit = (uint8 *)memory + heap_size_ + los_size_ + VM_STACK_GUARD;
+  uint8 *spaddr = (uint8 *)GetSPAddr();
+  return spaddr >= limit && (uint64_t)(spaddr - limit) >= need;
+}
+
+// Natives, bound functions, constructors and require re-enter the interpreter
+// through maple_invoke_dynamic_method; check the room before anything is
+// pushed so the RangeError unwinds like any other runtime error.
+void InterSource::CheckVMStackRoom(DynamicMethodHeaderT *header, int32_t nargs) {
+  if (!HasVMStackRoom(header, nargs)) {
+    MAPLE_JS_RANGEERROR_EXCEPTION();
   }
+}
 
-  return ret;
+// nargs actual arguments are passed; the callee frame and the arguments must
+// fit in the VM stack, and its DynMFunction and register block in the call stack
+bool InterSource::CanPushDynFrame(DynamicMethodHeaderT *header, int32_t nargs) {
+  uint32_t size = sizeof(DynMFunction) + DynMFunction::stack_slots(header) * sizeof(TValue);
+  if (callDepth >= maxCallDepth || callStackTop + size > callStackSize) {
+    return false;
+  }
+  if (callStackTop + size > callStackCommitted && !CommitCallStack(callStackTop + size)) {
+    return false;
+  }
+  return HasVMStackRoom(header, nargs);
+}
+
+// Make the call stack writable up to end, in JS_CALL_STACK_GRANULE steps.
+bool InterSource::CommitCallStack(uint32_t end) {
+  uint32_t committed = (end + JS_CALL_STACK_GRANULE - 1) / JS_CALL_STACK_GRANULE * JS_CALL_STACK_GRANULE;
+  if (committed > callStackSize) {
+    committed = callStackSize;
+  }
+  if (mprotect(callStack + callStackCommitted, committed - callStackCommitted, PROT_READ | PROT_WRITE) != 0) {
+    return false;
+  }
+  callStackCommitted = committed;
+  return true;
+}
+
+// Allocate the callee frame of a stackless call on the call stack and run its prolog;
+// the caller must have checked CanPushDynFrame() before passing the arguments.
+DynMFunction *InterSource::PushDynFrame(DynamicMethodHeaderT *header, void *obj, DynMFunction *caller) {
+  uint8_t *addr = callStack + callStackTop;
+  TValue *stackBlock = (TValue *)(addr + sizeof(DynMFunction));
+  DynMFunction *func = new (addr) DynMFunction(header, obj, stackBlock);
+  func->caller = caller;
+  callStackTop += sizeof(DynMFunction) + DynMFunction::stack_slots(header) * sizeof(TValue);
+  callDepth++;
+  InsertProlog(header);
+  return func;
+}
+
+void InterSource::PopDynFrame(DynMFunction *func) {
+  callStackTop = (uint32_t)((uint8_t *)func - callStack);
+  callDepth--;
 }
 
 TValue InterSource::FuncCall_JS(__jsobject *fObject, TValue &this_arg, void *env, TValue *arg_list, int32_t nargs) {
@@ -2039,6 +2344,7 @@ TValue InterSource::FuncCall_JS(__jsobject *fObject, TValue &this_arg, void *env
   }
 
   int32_t func_nargs = func->attrs >> 16 & 0xff;
+  CheckVMStackRoom((DynamicMethodHeaderT *)((uint8_t *)callee + 4), nargs);
   int32_t offset = PassArguments(this_arg, env, mvArgList, nargs, func_nargs);
   // Update sp_, set sp_ to sp_ + offset.
   sp += offset;
@@ -2069,19 +2375,12 @@ TValue InterSource::FuncCall_JS(__jsobject *fObject, TValue &this_arg, void *env
   // RC is increased for args and decreased after the func call, therefore, the pair of RC ops can be eliminated.
   uint8 *spaddr = (uint8 *)GetSPAddr();
   uint8 *frameEnd = spaddr + offset;  // offset is negative
-  uint8 *addr = frameEnd - calleeHeader->frameSize;
-  // frame: between addr and frameEnd; args: between frameEnd and spaddr
+  // frame: below frameEnd; args: between frameEnd and spaddr
 #ifdef RC_OPT_FUNC_ARGS
-  while(addr < frameEnd) {
+  ReleaseFrame(calleeHeader, frameEnd, frameEnd);
 #else
-  while(addr < spaddr) {
+  ReleaseFrame(calleeHeader, frameEnd, spaddr);
 #endif
-    TValue local = *(TValue*)addr;
-    if (IS_NEEDRC(local.x.u64)) {
-      memory_manager->GCDecRf((void*)local.x.c.payload);
-    }
-    addr += sizeof(void*);
-  }
 
   return ret;
 }
@@ -2135,6 +2434,7 @@ TValue InterSource::JSopRequire(TValue &mv0) {
    MIR_FATAL("plugin formalfile is the same with current file");
   }
   MIR_ASSERT(jsFileInfo);
+  CheckVMStackRoom((DynamicMethodHeaderT *)(jsFileInfo->mainFn), 0);
   SwitchPluginContext(jsFileInfo);
   DynMFunction *oldDynFunc = GetCurFunc();
   // DynMFunction *entryFunc = jsFileInfo->GetEntryFunction();
@@ -2145,14 +2445,7 @@ TValue InterSource::JSopRequire(TValue &mv0) {
 
   // RC-- for local vars
   uint8 *spaddr = (uint8 *)GetSPAddr();
-  uint8 *addr = spaddr - header->frameSize;
-  while(addr < spaddr) {
-    TValue* local = (TValue*)addr;
-    if (IS_NEEDRC(local->x.u64)) {
-      memory_manager->GCDecRf((void*)local->x.c.payload);
-    }
-    addr += sizeof(void*);
-  }
+  ReleaseFrame(header, spaddr, spaddr);
 
   // SetCurrFunc();
   // restore
@@ -2197,13 +2490,16 @@ void InterSource::UpdateArguments(int32_t index, TValue &mv) {
   }
 }
 
+// Creates the plugin, or makes fileName its main file in place of the old
+// one, keeping the files preloaded into it.
 void InterSource::CreateJsPlugin(char *fileName) {
-  jsPlugin = (JsPlugin *)malloc(sizeof(JsPlugin));
-  jsPlugin->mainFileInfo = (JsFileInforNode *)malloc(sizeof(JsFileInforNode));
-  jsPlugin->fileIndex = 0;
+  if (!jsPlugin) {
+    jsPlugin = new JsPlugin();
+  }
+  JsFileInforNode *mainFileInfo = (JsFileInforNode *)malloc(sizeof(JsFileInforNode));
   uint32 i = jsPlugin->GetIndexForSo(fileName);
-  jsPlugin->mainFileInfo->Init(&fileName[i], jsPlugin->fileIndex, gp, topGp - gp, nullptr, nullptr);
-  jsPlugin->formalFileInfo = jsPlugin->mainFileInfo;
+  mainFileInfo->Init(&fileName[i], 0, gp, topGp - gp, nullptr, nullptr);
+  jsPlugin->SetMainFile(mainFileInfo, fileName);
 }
 
 TValue InterSource::JSopGetArgumentsObject(void *argumentsObject) {
@@ -2216,41 +2512,106 @@ TValue InterSource::GetOrCreateBuiltinObj(__jsbuiltin_object_id id) {
   return jsVal;
 }
 
+// map an error name thrown by the runtime to its error constructor,
+// JSBUILTIN_LAST_OBJECT if it names none
+__jsbuiltin_object_id InterSource::ErrorId(const char *estr) {
+  if (!strcmp(estr, "TypeError")) {
+    return JSBUILTIN_TYPEERROR_CONSTRUCTOR;
+  } else if (!strcmp(estr, "RangeError")) {
+    return JSBUILTIN_RANGEERROR_CONSTRUCTOR;
+  } else if (!strcmp(estr, "SyntaxError")) {
+    return JSBUILTIN_SYNTAXERROR_CONSTRUCTOR;
+  } else if (!strcmp(estr, "UriError")) {
+    return JSBUILTIN_URIERROR_CONSTRUCTOR;
+  } else if (!strcmp(estr, "ReferenceError")) {
+    return JSBUILTIN_REFERENCEERRORCONSTRUCTOR;
+  }
+  return JSBUILTIN_LAST_OBJECT;
+}
+
+// map an error name thrown by the runtime to the value the script sees: an
+// error object for each of the five error names at every catch site, so
+// `e instanceof SyntaxError` holds whichever operation threw; any other
+// name is thrown as a string
+TValue InterSource::ErrorValue(const char *estr) {
+  __jsbuiltin_object_id id = ErrorId(estr);
+  if (id != JSBUILTIN_LAST_OBJECT) {
+    return GetOrCreateBuiltinObj(id);
+  }
+  return __string_value(__jsstr_new_from_char(estr));
+}
+
+// raise an error without a C++ throw: record it in currEH and hand back the
+// Exec_handle_exc sentinel, the caller then looks up the handler via GetEHpc
+TValue InterSource::RaiseError(__jsbuiltin_object_id id) {
+  if (!currEH) {
+    switch (id) {
+      case JSBUILTIN_TYPEERROR_CONSTRUCTOR:
+        fprintf(stderr, "TypeError:  not a function");
+        break;
+      case JSBUILTIN_REFERENCEERRORCONSTRUCTOR:
+        fprintf(stderr, "ReferenceError: not defined");
+        break;
+      default:
+        fprintf(stderr, "eh thown but never catched");
+        break;
+    }
+    exit(3);
+  }
+  currEH->SetThrownval(GetOrCreateBuiltinObj(id));
+  currEH->UpdateState(OP_throw);
+  return __none_value(Exec_handle_exc);
+}
+
+// Runs the app on the isolate of the calling thread, creating and entering
+// one for the app the first time.  With MAPLE_HEAP_IMAGE set, a new isolate
+// starts from the heap image at that path, or writes one there with every
+// builtin created when there is none that fits.  MAPLE_ZYGOTE hands the app
+// to the zygote listening on that socket, if any; MAPLE_ZYGOTE_SERVE makes
+// this process a zygote, with the modules in MAPLE_ZYGOTE_PRELOAD mapped
+// (see mzygote.h).  MAPLE_MODULE_MANIFEST names a list of modules to load
+// ahead of require() (see JsPlugin::Preload).
 extern "C" int64_t EngineShimDynamic(int64_t firstArg, char *appPath) {
-  if (!jsGlobal) {
-    void *handle = dlopen(appPath, RTLD_LOCAL | RTLD_LAZY);
-    if (!handle) {
-      fprintf(stderr, "failed to open %s\n", appPath);
+  Isolate *isolate = Isolate::Current();
+  if (!isolate) {
+    const char *zygote = getenv("MAPLE_ZYGOTE");
+    int64_t status;
+    if (zygote && *zygote && Zygote::Run(zygote, appPath, &status)) {
+      return status;
+    }
+    isolate = Isolate::New(appPath);
+    if (!isolate) {
       return 1;
     }
-    uint16_t *mpljsMdD = (uint16_t *)dlsym(handle, "__mpljs_module_decl__");
-    if (!mpljsMdD) {
-      fprintf(stderr, "failed to open __mpljs_module_decl__ %s\n", appPath);
-      return 1;
+    isolate->Enter();
+    const char *image = getenv("MAPLE_HEAP_IMAGE");
+    if (image && *image && (access(image, R_OK) != 0 || !isolate->ReadImage(image))) {
+      isolate->WarmUp();
+      isolate->WriteImage(image);
+    }
+    const char *manifest = getenv("MAPLE_MODULE_MANIFEST");
+    if (manifest && *manifest) {
+      gInterSource->jsPlugin->Preload(manifest);
+    }
+    const char *serve = getenv("MAPLE_ZYGOTE_SERVE");
+    if (serve && *serve) {
+      // the zygote's own app never runs, so the heap refers to no module
+      Zygote server(isolate);
+      isolate->WarmUp();
+      const char *preload = getenv("MAPLE_ZYGOTE_PRELOAD");
+      if (preload) {
+        server.Preload(preload);
+      }
+      return server.Serve(serve);
     }
-    uint16_t globalMemSize = mpljsMdD[0];
-    gInterSource = new InterSource();
-    gInterSource->gp = (uint8_t *)malloc(globalMemSize);
-    memcpy(gInterSource->gp, mpljsMdD + 1, globalMemSize);
-    gInterSource->topGp = gInterSource->gp + globalMemSize;
-    gInterSource->CreateJsPlugin(appPath);
-    jsGlobal = new JavaScriptGlobal();
-    jsGlobal->flavor = 0;
-    jsGlobal->srcLang = 2;
-    jsGlobal->id = 0;
-    jsGlobal->globalmemsize = globalMemSize;
-    jsGlobal->globalwordstypetagged = *((uint8_t *)mpljsMdD + 2 + globalMemSize + 2);
-    jsGlobal->globalwordsrefcounted = *((uint8_t *)mpljsMdD + 2 + globalMemSize + 6);
-  }
-  TValue val;
-  uint8_t* addr = (uint8_t*)firstArg + 4; // skip signature
-  DynamicMethodHeaderT *header = (DynamicMethodHeaderT *)(addr);
-  assert(header->upFormalSize == 0 && "main function got a frame size?");
-  addr += *(int32_t*)addr; // skip to 1st instruction
-  val = maple_invoke_dynamic_method_main (addr, header);
+  }
+  TValue val = isolate->Run((void *)firstArg);
 #ifdef MM_DEBUG
   memory_manager->DumpMMStats();
 #endif
+  if (memory_manager->stats_dump_enabled_) {
+    memory_manager->DumpMemStats(stderr);
+  }
   return GET_PAYLOAD(val);
 }
 
@@ -16,19 +16,22 @@
 #ifndef JSCONTEXT_H
 #define JSCONTEXT_H
 #include "jsvalue.h"
+#include "vmconfig.h"
 #define UNCERTAIN_NARGS 0x7FFFFFFF
 
 using namespace maple;
 
-extern TValue __js_Global_ThisBinding;
-extern TValue __js_ThisBinding;
-extern bool __is_global_strict;
+extern VM_TLS TValue __js_Global_ThisBinding;
+extern VM_TLS TValue __js_ThisBinding;
+extern VM_TLS TValue __js_OuterBinding;
+extern VM_TLS bool __is_global_strict;
 
 void __js_init_context(bool);
 TValue __js_entry_function(TValue &this_arg, bool strict_p);
 void __js_exit_function(TValue &this_arg, TValue old_this, bool strict_p);
 __jsstring *__jsstr_get_builtin(__jsbuiltin_string_id id);
 __jsobject *__jsobj_get_or_create_builtin(__jsbuiltin_object_id id);
+void __jsobj_create_all_builtins();
 #ifdef MEMORY_LEAK_CHECK
 void __jsobj_release_builtin();
 #endif
@@ -59,6 +62,7 @@ void __jsop_set_this_prop_by_name(TValue &o, __jsstring *p, TValue &v, bool noTh
 void __jsop_init_this_prop_by_name(TValue &o, __jsstring *name);
 TValue __jsop_getprop_by_name(TValue &o, __jsstring *p);
 TValue __jsop_get_this_prop_by_name(TValue &o, __jsstring *p);
+struct __jsprop *__jsop_get_this_prop_cell(TValue &o, __jsstring *p);
 TValue __jsop_delprop(TValue &o, TValue &p);
 void __jsop_initprop_by_name(TValue &o, __jsstring *p, TValue &v);
 void __jsop_initprop_getter(TValue &o, TValue &p, TValue &v);
@@ -22,6 +22,9 @@
 namespace maple{
 class DynMFunction;
 
+// number of JsEh records parked for reuse so try blocks in loops don't malloc
+#define VMEH_MAXREUSESTACKSIZE 16
+
 enum EHStage {
   EHS_unknown,
   EHS_try,
@@ -262,6 +262,9 @@ void __jsobj_helper_set_length(__jsobject *obj, uint64_t length, bool throw_p);
 __jsobject *__js_new_obj_obj_0();
 // Helper function for object constructors.
 __jsprop *__create_builtin_property(__jsobject *obj, __jsstring *name);
+#ifdef USE_PROP_MAP
+void __jsobj_rebuild_prop_maps(__jsobject *obj, bool index_map, bool string_map);
+#endif
 bool __jsobj_helper_HasPropertyAndGet(__jsobject *obj, __jsbuiltin_string_id id, TValue *result);
 bool __jsobj_helper_HasPropertyAndGet(__jsobject *obj, uint32_t index, TValue *result);
 bool __jsobj_helper_HasPropertyAndGet(__jsobject *obj, __jsstring *p, TValue *result);
@@ -15,6 +15,9 @@
 
 #ifndef MAPLEENGIN_INCLUDE_JSPLUGIN_H_
 #define MAPLEENGIN_INCLUDE_JSPLUGIN_H_
+#include <string>
+#include <unordered_map>
+#include <vector>
 class InterSource;
 
 struct JsFileInforNode {  // this is the file information
@@ -24,6 +27,8 @@ struct JsFileInforNode {  // this is the file information
   uint32_t glbMemsize;
   void *mainFn;
   JsFileInforNode *next;
+  char *path;        // the canonical path of the file, null if it is not known
+  bool initialized;  // whether require() has run its main function
 
   void Init(char *name, uint32_t idx, uint8_t *newGp, uint32_t glbmemsize, void *mf, JsFileInforNode *next) {
     fileName = name;
@@ -32,28 +37,43 @@ struct JsFileInforNode {  // this is the file information
     glbMemsize = glbmemsize;
     mainFn = mf;
     this->next = next;
+    path = nullptr;
+    initialized = false;
   }
 };
 
 
 class JsPlugin {
  public:
-  JsFileInforNode *mainFileInfo;  // the link list, pointing to the main file, suppose there wouldn't be much files
-                                     // to be plugined, otherwise use hash table
+  JsFileInforNode *mainFileInfo;  // the link list of loaded files, starting with the main file
   uint16_t fileIndex;
   JsFileInforNode *formalFileInfo;
+  // The loaded files by canonical path, and by the path they were required
+  // with, so that requiring a loaded file again makes no system call.
+  std::unordered_map<std::string, JsFileInforNode *> filesByPath;
+  std::unordered_map<std::string, JsFileInforNode *> filesByRequest;
+  std::vector<JsFileInforNode *> filesByIndex;
 
  public:
-  void Init(JsFileInforNode *node) {
-    mainFileInfo = node;
-    fileIndex = 0;
-    formalFileInfo = nullptr;
-  }
+  JsPlugin() : mainFileInfo(nullptr), fileIndex(0), formalFileInfo(nullptr) {}
+  // Frees the loaded files, except the globals of the main file, which
+  // belong to the InterSource.  The memory manager must be the current one.
+  ~JsPlugin();
+
+  // Make node, with index 0, the main file in place of any previous one;
+  // path is the file it was loaded from.  Files already loaded are kept.
+  void SetMainFile(JsFileInforNode *node, const char *path);
 
-  JsFileInforNode *FindJsFile(char *);  // find by the name of the file
-  JsFileInforNode *FindJsFile(uint32_t);  // find by the file index
+  JsFileInforNode *FindJsFile(const char *);  // find by the canonical path of the file
+  JsFileInforNode *FindJsFile(uint32_t index) {  // find by the file index
+    return index < filesByIndex.size() ? filesByIndex[index] : NULL;
+  }
   JsFileInforNode *LoadRequiredFile(char *, bool &);
   void InsertJsFile(JsFileInforNode *);
   uint32_t GetIndexForSo (char *name);
+  // Load the files listed in a manifest ahead of require().
+  void Preload(const char *manifest);
+  // Whether require() has run any file besides the main one.
+  bool HasRequiredFiles();
 };
 #endif // MAPLEENGIN_INCLUDE_JSPLUGIN_H_
@@ -18,35 +18,61 @@
 
 #ifdef TEST_BENCHMARK
 #define APP_MEMORY_SIZE (12 * 1024 * 1024)       // 12M application memory
-// make sure VM_MEMORY_SIZE == VM_MEMORY_BIG_SIZE + VM_MEMORY_SMALL_SIZE
-#define VM_MEMORY_BIG_SIZE (4 * 1024 * 1024)    // 4M
-#define VM_MEMORY_SMALL_SIZE (2 * 1024 * 1024)  // 2M
-#define VM_MEMORY_SIZE (8 * 1024 * 1024)        // 8M VM internal data
-#define TOTAL_MEMORY_SIZE (APP_MEMORY_SIZE + VM_MEMORY_SIZE)
+#define VM_ARENA_CHUNK_SIZE (256 * 1024)         // VM internal data grows 256K at a time
 #define STACKOFFSET APP_MEMORY_SIZE
 
 // make sure HEAP_SIZE == HEAP_BIG_SIZE + HEAP_SMALL_SIZE
 #define HEAP_BIG_SIZE (8 * 1024 * 1024)     // 8M
 #define HEAP_SMALL_SIZE (4 * 1024 * 1024)   // 4M
 #define HEAP_SIZE (12 * 1024 * 1024)        // 12M
+#define VM_STACK_SIZE (8 * 1024 * 1024)     // 8M VM operand/frame stack
+#define HEAP_COMMIT_GRANULE (1024 * 1024)   // heap pages are committed 1M at a time
+#define HEAP_RELEASE_THRESHOLD (256 * 1024) // free runs at least this large go back to the OS
+#define SLAB_SIZE (16 * 1024)               // small blocks are carved from 16K slabs
+#define LARGE_OBJECT_SIZE (64 * 1024)       // blocks this large get their own mapping
 #define MAXCALLARGNUM 255
 #else
 #define APP_MEMORY_SIZE (17 * 1024)      // 16K application memory
-// make sure VM_MEMORY_SIZE == VM_MEMORY_BIG_SIZE + VM_MEMORY_SMALL_SIZE
-#define VM_MEMORY_BIG_SIZE (24 * 1024)   // 24k
-#define VM_MEMORY_SMALL_SIZE (8 * 1024)  // 8k
-#define VM_MEMORY_SIZE (32 * 1024)       // 32K VM internal data
-#define TOTAL_MEMORY_SIZE (APP_MEMORY_SIZE + VM_MEMORY_SIZE)
+#define VM_ARENA_CHUNK_SIZE (8 * 1024)   // VM internal data grows 8K at a time
 #define STACKOFFSET APP_MEMORY_SIZE
 
 // make sure HEAP_SIZE == HEAP_BIG_SIZE + HEAP_SMALL_SIZE
 #define HEAP_BIG_SIZE (7 * 1024)
 #define HEAP_SMALL_SIZE (6 * 1024)
 #define HEAP_SIZE (13 * 1024)
+#define VM_STACK_SIZE (8 * 1024)
+#define HEAP_COMMIT_GRANULE (4 * 1024)
+#define HEAP_RELEASE_THRESHOLD (16 * 1024)
+#define SLAB_SIZE (4 * 1024)
+#define LARGE_OBJECT_SIZE (8 * 1024)
 
 #define MAXCALLARGNUM 10
 #endif
 
+// The JS heap reserves this much address space up front (or MAPLE_HEAP_SIZE
+// megabytes when set) and commits pages on demand, so the reservation only
+// bounds the heap; it does not cost resident memory.
+#define HEAP_MAX_RESERVE_SIZE (1024 * 1024 * 1024)  // 1G
+
+// The large-object space sits right above the heap and reserves as much
+// address space as the heap itself.  Each large object is mapped on its own
+// there, so it is never limited by fragmentation of the big region.
+#define LARGE_OBJECT_SPACE_RATIO 1
+
+// Alignment of the heap reservation, and the commit step when the heap is
+// backed by transparent huge pages (MAPLE_HEAP_POLICY=hugepage).
+#define HEAP_HUGE_PAGE_SIZE (2 * 1024 * 1024)
+
+// The VM state (heap, builtins, caches, interpreter) is kept per thread, so
+// that isolates can run on several threads at once (see misolate.h).  Build
+// with VM_SINGLE_ISOLATE to make it process-wide again; isolates then take
+// turns on one thread.
+#ifdef VM_SINGLE_ISOLATE
+#define VM_TLS
+#else
+#define VM_TLS thread_local
+#endif
+
 // The stack of (pending) operands for next few (virtual) instructions
 // (expression or statements). This is for MJSVM-CMPL (v2)
 #define OPERANDS_STACK_SIZE 128
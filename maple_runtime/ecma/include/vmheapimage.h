@@ -0,0 +1,114 @@
+/*
+ * Copyright (C) [2021] Futurewei Technologies, Inc. All rights reserved.
+ *
+ * OpenArkCompiler is licensed under the Mulan Permissive Software License v2.
+ * You can use this software according to the terms and conditions of the MulanPSL - 2.0.
+ * You may obtain a copy of MulanPSL - 2.0 at:
+ *
+ *   https://opensource.org/licenses/MulanPSL-2.0
+ *
+ * THIS SOFTWARE IS PROVIDED ON AN "AS IS" BASIS, WITHOUT WARRANTIES OF ANY KIND, EITHER
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO NON-INFRINGEMENT, MERCHANTABILITY OR
+ * FIT FOR A PARTICULAR PURPOSE.
+ * See the MulanPSL - 2.0 for more details.
+ */
+
+#ifndef MAPLEBE_INCLUDE_MAPLEVM_VMHEAPIMAGE_H_
+#define MAPLEBE_INCLUDE_MAPLEVM_VMHEAPIMAGE_H_
+
+#include <string>
+#include <unordered_set>
+#include <vector>
+#include "vmmemory.h"
+
+// A heap image is the JS heap of a warmed-up VM saved to a file with the
+// allocator state, the builtin objects and the module globals, so that a
+// later process maps it in place of building the same heap again.  Blocks
+// keep their heap offsets.  The pointers in them are found by walking the
+// heap from the builtins and the globals, and are listed in a relocation
+// table with what they point to: the heap, the globals, the runtime library
+// or the module.  Read() maps the heap pages of the file copy-on-write and adds
+// the differences between the old and new bases to those slots.
+//
+// Images are tied to the exact runtime library and module files they were
+// written with, and to the heap geometry (MAPLE_HEAP_SIZE).  The heap must
+// be quiescent when written: no frames, no handlers and no large objects.
+class HeapImage {
+ public:
+  HeapImage();
+
+  // The module whose code and data the heap may refer to; addr is any
+  // address inside it, such as its main function.
+  void SetModule(const void *addr);
+  // The globals of the module, saved with the heap and their heap
+  // references relocated.
+  void SetGlobals(uint8_t *gp, uint32 size);
+  bool Write(const char *path);
+  // Loads the image into the current memory manager, which must not have
+  // allocated anything yet, and installs the builtins and the global this.
+  bool Read(const char *path);
+  const char *Error() {
+    return error_.c_str();
+  }
+
+ private:
+  enum Area { kAreaHeap, kAreaGlobals };
+  enum Target { kTargetHeap, kTargetGlobals, kTargetRuntime, kTargetModule, kTargetNum };
+
+  // Where a target was mapped; the runtime and the module are identified
+  // by their files as well.
+  struct Library {
+    uint64_t base;
+    uint64_t size;
+    int64_t mtime;
+    uint64_t ino;
+  };
+  struct Header;
+  // The 48-bit payload of the slot at offset in area points into target.
+  struct Reloc {
+    uint32 offset;
+    uint16 area;
+    uint16 target;
+  };
+  // An object whose property maps are rebuilt when read.
+  struct PropMaps {
+    uint32 offset;
+    uint32 maps;  // bit 0 for the index map, bit 1 for the string map
+  };
+  struct FreeChunk {
+    uint32 bucket;
+    uint32 offset;
+    uint32 size;
+  };
+
+  Library libs_[kTargetNum];
+  bool has_module_;
+  uint8_t *gp_;
+  uint32 gp_size_;
+  std::string error_;
+
+  std::vector<Reloc> relocs_;
+  std::vector<PropMaps> prop_maps_;
+  std::vector<FreeChunk> chunks_;
+  std::vector<std::pair<uint32, uint32>> overflow_;
+  std::unordered_set<void *> visited_;
+  std::vector<std::pair<void *, MemHeadTag>> pending_;
+
+  bool Fail(const char *fmt, ...);
+  bool IdentifyLibrary(const void *addr, Library *lib);
+  bool Classify(const void *addr, Target *target);
+  bool AddSlot(void *slot, Area area, const void *addr);
+  bool AddPointer(void *slot, Area area, void **addr = nullptr);
+  bool AddValue(void *slot, Area area);
+  bool Reach(void *addr, MemHeadTag tag);
+  bool WalkObject(__jsobject *obj);
+  bool WalkProp(__jsprop *prop);
+  bool WalkEnv(void *env);
+  bool WalkArrayByte(void *slot);
+  bool Walk();
+  bool WriteFile(const char *path, Header *header);
+  bool ReadFile(const char *path, int fd);
+  bool Map(int fd, uint64_t pos, uint32 offset, uint32 size);
+};
+
+#endif  // MAPLEBE_INCLUDE_MAPLEVM_VMHEAPIMAGE_H_
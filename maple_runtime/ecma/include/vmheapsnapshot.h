@@ -0,0 +1,91 @@
+/*
+ * Copyright (C) [2021] Futurewei Technologies, Inc. All rights reserved.
+ *
+ * OpenArkCompiler is licensed under the Mulan Permissive Software License v2.
+ * You can use this software according to the terms and conditions of the MulanPSL - 2.0.
+ * You may obtain a copy of MulanPSL - 2.0 at:
+ *
+ *   https://opensource.org/licenses/MulanPSL-2.0
+ *
+ * THIS SOFTWARE IS PROVIDED ON AN "AS IS" BASIS, WITHOUT WARRANTIES OF ANY KIND, EITHER
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO NON-INFRINGEMENT, MERCHANTABILITY OR
+ * FIT FOR A PARTICULAR PURPOSE.
+ * See the MulanPSL - 2.0 for more details.
+ */
+
+#ifndef MAPLEBE_INCLUDE_MAPLEVM_VMHEAPSNAPSHOT_H_
+#define MAPLEBE_INCLUDE_MAPLEVM_VMHEAPSNAPSHOT_H_
+
+#include <cstdio>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include "vmmemory.h"
+
+// Writes the JS heap reachable from a set of roots as a heap snapshot in the
+// JSON format of the V8 heap profiler (.heapsnapshot), so that Chrome
+// DevTools and the other viewers of that format can show retainers and
+// dominators.  The engine adds its roots (globals, builtins, stack) in
+// groups, then Write() walks the objects, strings and environments they
+// reach.  Nothing is allocated in the JS heap while walking.
+class HeapSnapshot {
+ public:
+  HeapSnapshot();
+
+  // Start a group of roots, shown as a synthetic node under "(GC roots)".
+  void BeginRoots(const char *name);
+  // Add a root to the current group, as a named edge or, without a name,
+  // as the next element.
+  void AddRoot(const char *name, TValue val);
+  void AddRoots(TValue *begin, TValue *end);
+  // Like AddRoots() for a range that may hold stale or non-value words, such
+  // as the VM stack: only references to live heap blocks are added.
+  void AddStackRoots(TValue *begin, TValue *end);
+  bool Write(const char *path);
+
+ private:
+  enum NodeType { kHidden, kArray, kString, kObject, kCode, kClosure, kRegExp, kNumber, kNative, kSynthetic };
+  enum EdgeType { kContext, kElement, kProperty, kInternal, kHiddenEdge, kShortcut, kWeak };
+  enum NodeKind { kKindSynthetic, kKindObject, kKindString, kKindEnv };
+
+  struct Node {
+    void *addr;
+    uint32 kind;
+    uint32 type;
+    uint32 name;
+    uint64_t id;
+    uint32 self_size;
+    uint32 edge_count;
+  };
+  struct Edge {
+    uint32 type;
+    uint32 name_or_index;  // string index, or element index for kElement/kHiddenEdge
+    uint32 to;             // node index
+  };
+  struct RootGroup {
+    uint32 name;
+    std::vector<std::pair<int32_t, TValue>> roots;  // string index or -1, value
+  };
+
+  std::vector<RootGroup> groups_;
+  std::vector<Node> nodes_;
+  std::vector<Edge> edges_;
+  std::vector<std::string> strings_;
+  std::unordered_map<std::string, uint32> string_index_;
+  std::unordered_map<void *, uint32> node_index_;
+  uint64_t next_synthetic_id_;
+
+  uint32 String(const std::string &s);
+  uint32 JsString(__jsstring *str, uint32 max_length);
+  int32_t NodeFor(TValue val);
+  static bool IsLiveHeapRef(TValue val);
+  uint32 AddNode(void *addr, uint32 kind);
+  void AddEdge(uint32 type, uint32 name_or_index, TValue val);
+  void AddEdgeTo(uint32 type, uint32 name_or_index, uint32 to);
+  void AddObjectEdges(__jsobject *obj);
+  void AddEnvEdges(void *env);
+  uint32 ObjectSize(__jsobject *obj);
+  void WriteJson(FILE *out);
+};
+
+#endif  // MAPLEBE_INCLUDE_MAPLEVM_VMHEAPSNAPSHOT_H_
@@ -27,6 +27,10 @@
 #include <vector>
 #include <map>
 #include <set>
+#include <unordered_map>
+#include <atomic>
+#include <csignal>
+#include <cstdio>
 #ifdef MM_DEBUG
 #include <list>
 #endif
@@ -47,11 +51,39 @@ enum MemHeadTag {
   MemHeadJSList,
   MemHeadEnv,
   MemHeadJSIter,
-#ifdef MM_DEBUG
   MemHeadLast,
-#endif
 };
 
+// Allocation and RC counters that are always compiled in, read with
+// MemoryManager::GetMemStats().  A VM runs a single mutator thread, so the
+// counters are plain fields bumped on the allocation, free and RC paths.
+struct MemStats {
+  uint64_t alloc_count[MemHeadLast];
+  uint64_t alloc_bytes[MemHeadLast];  // memory headers included
+  uint64_t free_count[MemHeadLast];
+  uint64_t free_bytes[MemHeadLast];
+  uint64_t live_bytes;
+  uint64_t peak_bytes;                // high-water mark of live_bytes
+  uint64_t rc_inc;
+  uint64_t rc_dec;
+  uint64_t crc_runs;                  // cycle collection pauses
+  uint64_t crc_freed_bytes;           // bytes swept as cyclic garbage
+  uint64_t los_objects;               // live blocks in the large-object space
+  uint64_t los_mapped_bytes;          // bytes mapped for them
+  uint64_t internal_used_bytes;       // VM internal blocks handed out (MallocInternal)
+  uint64_t internal_peak_bytes;
+  uint64_t internal_mapped_bytes;     // arena chunks and dedicated internal mappings
+  uint64_t internal_chunks;
+};
+
+// VM internal blocks up to VM_ARENA_EXACT_SIZE bytes have a free list per
+// pointer-size multiple, so each fixed-size internal structure is recycled
+// through a list of its own; larger ones up to VM_ARENA_MAX_BLOCK share
+// power-of-two lists, and anything bigger is mapped by itself.
+#define VM_ARENA_EXACT_SIZE 512
+#define VM_ARENA_MAX_BLOCK (VM_ARENA_CHUNK_SIZE / 4)
+#define VM_ARENA_FREE_LISTS (VM_ARENA_EXACT_SIZE / sizeof(void *) + 24)
+
 #ifdef MARK_CYCLE_ROOTS
 /* Enumeration flags to distinguish different management of object, prop and environment.
    DECREASE for detecting garbage reference cycles by decrement of the reference count.
@@ -108,7 +140,8 @@ struct MemHeader {
   uint8 color : 3;
   bool in_roots : 1; // is in the set of possible roots of cycles
   bool visited : 1; // for debug
-  uint16 : 10;
+  bool in_zct : 1;  // is in the zero-count table (RC_DEFER_STACK)
+  uint16 : 9;
 #else
   uint16 : 15;
 #endif
@@ -138,6 +171,32 @@ struct MemoryChunk {
 
 #define UINT14_MAX 0x3fff
 
+// Heap blocks below the MemoryHash big size are carved from SLAB_SIZE slabs
+// in the small heap region.  A slab serves a single size class and starts
+// with this header, followed by a free bitmap (one bit per block, set when
+// free) and the blocks themselves, so freeing needs no MemoryChunk.
+#define SLAB_NUM_CLASSES 48
+#define SLAB_NIL 0xffffffff
+
+struct Slab {
+  uint32 prev;  // heap offsets of the neighbouring slabs on the same list
+  uint32 next;
+  uint16 size_class;
+  uint16 num_free;
+  uint16 hint;  // lowest bitmap word that may have a free bit
+  uint16 : 16;
+};
+
+struct SlabClass {
+  uint32 size;        // block size, memory header included
+  uint32 num_blocks;  // blocks per slab
+  uint32 first;       // offset of the first block in a slab
+  uint32 partial;     // heap offset of the first slab with free blocks
+  uint32 num_slabs;
+  uint32 live_blocks;
+  uint32 live_bytes;  // bytes requested by the live blocks
+};
+
 class MemoryHash {
  public:
   MemoryChunk *table_[MEMHASHTABLESIZE];
@@ -160,6 +219,10 @@ class MemoryHash {
 #endif
 };
 
+// Bumped by SIGUSR2.  A memory manager has a request pending while the count
+// differs from the one it last handled.
+extern std::atomic<uint32> mem_signal_count;
+
 class MemoryManager {
  public:
   void *memory_;       // points to the base of the app's heap
@@ -169,7 +232,29 @@ class MemoryManager {
   uint32 total_small_size_;
   uint32 heap_free_small_offset_;
   uint32 heap_free_big_offset_;   // for gc
-  MemoryHash *heap_memory_bank_;  // for app need gc
+  uint32 heap_small_committed_;   // end offset of the read/write pages of the small region
+  uint32 heap_big_committed_;     // end offset of the read/write pages of the big region
+  uint32 heap_commit_granule_;    // page-aligned commit step
+  bool heap_hugepage_;            // MAPLE_HEAP_POLICY: back the heap with transparent huge pages
+  bool heap_prefault_;            // MAPLE_HEAP_POLICY: populate heap pages as they are committed
+  bool heap_numa_local_;          // MAPLE_HEAP_POLICY: place heap pages on the touching thread's node
+  uint32 heap_released_size_;     // bytes handed back to the OS by the last ReleaseFreeHeap()
+  uint32 heap_image_big_end_;     // end offset of the big region pages mapped from a heap image
+  uint32 *heap_big_starts_;       // one bit per 4-byte heap offset, set where an allocated big block begins
+  MemoryHash *heap_memory_bank_;  // for app need gc, big blocks only
+  uint32 los_size_;                        // bytes of address space above total_size_, 0 if none
+  std::map<uint32, uint32> los_blocks_;    // HeapOffset() of a large-object mapping to its length
+  std::map<uint32, uint32> los_free_;      // unmapped ranges of the large-object space, coalesced
+  uint32 los_mapped_;
+  SlabClass slab_classes_[SLAB_NUM_CLASSES];
+  uint8 slab_class_index_[MEMHASHTABLESIZE];  // size >> 2 to size class
+  uint32 free_slabs_;                         // empty slabs shared by all classes
+  MemStats stats_;
+  bool stats_dump_enabled_;                   // MAPLE_MEM_STATS is set
+  uint32 stats_dump_seen_;                    // mem_signal_count when the stats were last dumped
+  const char *heap_snapshot_prefix_;           // MAPLE_HEAP_SNAPSHOT, or null
+  uint32 heap_snapshot_seen_;                  // mem_signal_count when the last snapshot was taken
+  uint32 heap_snapshot_count_;
 // MemoryChunk *avail_link_;
 #ifdef MM_DEBUG                 // this macro control the debug informaiton of memory manager
   uint32 app_mem_usage;  // heap memory used by current app
@@ -210,29 +295,79 @@ class MemoryManager {
   void DumpRCStats();
 #endif                         // MM_DEBUG
 
-  // Internal VM memory management
-  void *vm_memory_;                 // points to the base of the VM's own dynamic memory space
-  uint32 vm_memory_size_;           // internal memory size
-  uint32 vm_memory_small_size_;     // internal memory small size, it's a fence before vm_memory_size_
-  uint32 vm_free_small_offset_;     // small memory offset of next free VM memory
-  uint32 vm_free_big_offset_;       // big memory offset
-  MemoryHash *vm_memory_bank_;      // for vm itself, no need gc
+  // Internal VM memory management: a chunked arena that grows on demand
+  uint8 *vm_arena_top_;                         // bump pointer in the newest chunk
+  uint8 *vm_arena_end_;
+  void *vm_free_lists_[VM_ARENA_FREE_LISTS];   // freed blocks by size class, linked through their first word
+  uint64 vm_arena_used_;
+  uint64 vm_arena_peak_;
+  uint64 vm_arena_mapped_;
+  uint32 vm_arena_chunks_;
+  std::vector<void *> vm_arena_chunk_list_;  // unmapped with the memory manager
+  std::map<void *, uint32> vm_big_blocks_;   // blocks mapped on their own, to their mapped size
   MemoryChunk *free_memory_chunk_;  // for memory chunk descriptor only, reusable
 #ifndef RC_NO_MMAP
   AddrMap *free_mmaps_;           // a link list of mmaps for reuse.
   AddrMapNode *free_mmap_nodes_;  // a link list of mmap node for reuse.
 #endif
   // for reference cycles
-  static const uint32 CRC_TRIGGER_BY_ALLOC_SIZE = 1048576; // 1MB
-  std::set<void*> crc_candidate_roots;
+  static const uint32 CRC_TRIGGER_BY_ALLOC_SIZE = 1048576; // 1MB, initial trigger
+  static const uint32 CRC_TRIGGER_MIN = 262144;            // 256KB
+  static const uint32 CRC_TRIGGER_MAX = 16777216;          // 16MB
+  static const uint32 CRC_PAUSE_BUDGET_US = 1000;          // default pause budget, MAPLE_GC_PAUSE_US overrides
+  static const uint32 CRC_SLICE_MIN = 16;                  // candidate roots per slice
+  static const uint32 CRC_SLICE_MAX = 65536;
+  static const uint32 CRC_PAUSE_BUCKETS = 16;              // log2(us) pause histogram
+  // possible roots of cycles; an object is appended once, guarded by
+  // MemHeader::in_roots, and entries of freed objects are dropped lazily.
+  // The tables below hold heap references as HeapOffset()s.
+  uint32 *crc_candidates_;
+  uint32 crc_candidate_num_;
+  uint32 crc_candidate_cap_;
+  uint32 crc_candidate_peak_;
   uint32 crc_alloc_size;  // when allocation since last collection reaches a threshold, collect cycles
+  uint32 crc_trigger_size_;     // adapted to the garbage yield of the last pauses
+  uint32 crc_pause_budget_us_;
+  uint32 crc_slice_roots_;      // adapted so that a slice takes a fraction of the budget
+  uint32 crc_freed_size_;       // bytes swept as cyclic garbage
+  bool crc_in_progress_;
+  uint32 crc_num_pauses_;
+  uint64_t crc_total_pause_us_;
+  uint32 crc_max_pause_us_;
+  uint32 crc_pause_histogram_[CRC_PAUSE_BUCKETS];
+
+  // Deferred RC (RC_DEFER_STACK): stack, frame, register and retval slots
+  // are not counted.  Objects whose count drops to zero, and new ones, wait
+  // in the zero-count table until a safe point counts the stack and frees
+  // what is still unreferenced (ReconcileZct).
+  static const uint32 ZCT_RECONCILE_SIZE = 4096;
+  uint32 *zct_;
+  uint32 zct_num_;
+  uint32 zct_cap_;
+  uint32 zct_peak_;
+  uint32 zct_limit_;           // table size that asks for a safe point
+  bool rc_safepoint_pending_;  // polled by the interpreter at safe points
+  bool crc_collect_pending_;   // a cycle collection waits for the safe point
+  bool rc_reconciling_;        // the stack is counted, zero counts are freed at once
+
+  // Counts that do not fit MemHeader::refcount.  A header at UINT14_MAX has
+  // an entry here with the references beyond UINT14_MAX, so popular objects
+  // are still freed once their count falls back to zero.
+  std::unordered_map<uint32, uint32> rc_overflow_;  // HeapOffset() to count
+  uint32 rc_overflow_peak_;
+
+  // Lazy freeing (RC_LAZY_FREE): a block whose count drops to zero is queued
+  // here, and later allocations free a few queued blocks per step; children
+  // released by a freed block are queued in turn instead of being freed
+  // recursively, so the pause no longer depends on the size of the graph.
+  static const uint32 LAZY_FREE_STEP = 16;  // blocks freed per allocation
+  uint32 *lazy_free_;
+  uint32 lazy_free_num_;
+  uint32 lazy_free_cap_;
+  uint32 lazy_free_peak_;
+  bool lazy_freeing_;
 
 #if MACHINE64
-  uint32 addrOffset;
-  // std::map<uint32, void *> addrMap;  // map the 32 bits address to 64 bits, for 64-bits machine only
-  std::vector<void *> addrMap;  // map the 32 bits address to 64 bits, for 64-bits machine only
-  std::vector<double> f64ToU32Vec;  // index to double value
-  // std::map<double, uint32_t> f64ToU32Map; // map the double value to index
   const uint32_t spBaseFlag = (__jstype)JSTYPE_SPBASE;
   const uint32_t fpBaseFlag = (__jstype)JSTYPE_FPBASE;
   const uint32_t gpBaseFlag = (__jstype)JSTYPE_GPBASE;
@@ -240,12 +375,52 @@ class MemoryManager {
 
  public:
   MemoryManager() {}  // initialization delayed to Init();
+  // Unmaps the internal memory; the heap itself is the caller's reservation.
+  ~MemoryManager();
 
-  // app_memory_ptr, app_memory_size, vm_memory_ptr, vm_memory_size
-  void Init(void *, uint32, void *, uint32);
+  bool StatsDumpPending() {
+    return stats_dump_enabled_ && mem_signal_count.load(std::memory_order_relaxed) != stats_dump_seen_;
+  }
+  bool HeapSnapshotPending() {
+    return heap_snapshot_prefix_ && mem_signal_count.load(std::memory_order_relaxed) != heap_snapshot_seen_;
+  }
+
+  // app_memory_ptr, app_memory_size, large-object space size
+  // The app memory is a PROT_NONE reservation whose pages are committed on demand.
+  void Init(void *, uint32, uint32 los_size = 0);
+  void CommitHeap(uint32 &committed, uint32 end, uint32 limit);
+  void InitHeapPolicy(uint32 reserved_size);
+  void ApplyHeapPolicy(void *addr, uint32 size);
+  void PrefaultHeap(void *addr, uint32 size);
+  void InitSlabClasses();
+  Slab *SlabAt(uint32 offset) {
+    return (Slab *)((uint8 *)memory_ + offset);
+  }
+  uint32 NewSlab(uint32);
+  void *SlabAlloc(uint32);
+  void SlabFree(uint32, uint32);
+  void DumpSlabStats();
+  void ReleaseFreeHeap();
+  uint32 CommittedHeapSize() {
+    return heap_small_committed_ + (heap_big_committed_ - total_small_size_);
+  }
+  bool IsLargeObjectSize(uint32 size) {
+    return size >= LARGE_OBJECT_SIZE && los_size_ > 0;
+  }
+  bool IsLargeObject(uint32 offset) {
+    return offset >= total_size_;
+  }
+  void *LargeAlloc(uint32);
+  void LargeFree(uint32);
+  void *LargeRealloc(void *, uint32, uint32);
+  uint32 LargeTake(uint32);
+  void LargeGive(uint32, uint32);
+  void LargeRelocate(void *, void *);
   // malloc for VM management, need to manage life-cycle by user
   void *MallocInternal(uint32);
   void FreeInternal(void *, uint32);
+  void *ArenaCarve(uint32);
+  void ArenaRecycleTail();
 
   void ReleaseVariables(uint8_t *base, uint8_t *typetagged, uint8_t *refcounted, uint32_t size, bool reversed);
   // malloc for application objects, reference counted
@@ -285,12 +460,44 @@ class MemoryManager {
   void ManageEnvironment(void *envptr, ManageType flag);
   void ManageProp(__jsprop *prop, ManageType flag);
   void ManageObject(__jsobject *obj, ManageType flag);
+  // allocation statistics, kept in every build
+  void GetMemStats(MemStats *stats);
+  void DumpMemStats(FILE *out);
+  void CountAlloc(MemHeadTag tag, uint32 size) {
+    stats_.alloc_count[tag]++;
+    stats_.alloc_bytes[tag] += size;
+    stats_.live_bytes += size;
+    if (stats_.live_bytes > stats_.peak_bytes) {
+      stats_.peak_bytes = stats_.live_bytes;
+    }
+  }
+  void CountFree(MemHeadTag tag, uint32 size) {
+    stats_.free_count[tag]++;
+    stats_.free_bytes[tag] += size;
+    stats_.live_bytes -= size;
+  }
 #ifdef MARK_CYCLE_ROOTS
   void AddCycleRootNode(CycleRoot **roots_head, __jsobject *obj);
   void DeleteCycleRootNode(CycleRoot *root);
   void ResetCycleRoots();
   void RecallRoots(CycleRoot *root);
   void RecallCycle();
+  void RecallCycleSlice(uint32 max_roots);
+  void IncrementalRecallCycle();
+  void DumpCRCStats();
+  void AddCycleCandidate(void *addr) {
+    if (crc_candidate_num_ == crc_candidate_cap_) {
+      GrowCycleCandidates();
+    }
+    crc_candidates_[crc_candidate_num_++] = HeapOffset(addr);
+    if (crc_candidate_num_ > crc_candidate_peak_) {
+      crc_candidate_peak_ = crc_candidate_num_;
+    }
+  }
+  void GrowCycleCandidates();
+  bool IsHeapBlockLive(void *addr);
+  bool IsCycleCandidate(void *addr);
+  void CompactCycleCandidates();
 #else
   void AddObjListNode(__jsobject *obj);
   void DeleteObjListNode(__jsobject *obj);
@@ -306,6 +513,41 @@ class MemoryManager {
   void UpdateGCReference(void *, Mval);
 #endif
   void GCDecRf(void *);
+  void RecallZeroCount(void *);
+  void ZctAdd(void *addr) {
+    GetMemHeader(addr).in_zct = true;
+    if (zct_num_ == zct_cap_) {
+      GrowZct();
+    }
+    zct_[zct_num_++] = HeapOffset(addr);
+    if (zct_num_ > zct_peak_) {
+      zct_peak_ = zct_num_;
+    }
+    if (zct_num_ >= zct_limit_) {
+      rc_safepoint_pending_ = true;
+    }
+  }
+  void GrowZct();
+  void LazyFree(void *addr) {
+    if (lazy_free_num_ == lazy_free_cap_) {
+      GrowLazyFree();
+    }
+    lazy_free_[lazy_free_num_++] = HeapOffset(addr);
+    if (lazy_free_num_ > lazy_free_peak_) {
+      lazy_free_peak_ = lazy_free_num_;
+    }
+  }
+  void GrowLazyFree();
+  void DrainLazyFree(uint32 budget);
+  void CountStackRoot(TValue &val, bool count);
+  void ReconcileZct(void (*scan_roots)(bool count));
+  bool CanCollect() {
+#ifdef RC_DEFER_STACK
+    return rc_reconciling_;
+#else
+    return true;
+#endif
+  }
   void GCDecRfJsvalue(TValue jsval) {
     if (TurnoffGC())
       return;
@@ -318,12 +560,40 @@ class MemoryManager {
         assert(false && "unexpected");
     }
   }
+  // Exact reference count of a heap block, the overflow table included.
+  uint32 RefCount(void *addr) {
+    uint32 rc = GetMemHeader(addr).refcount;
+    return rc == UINT14_MAX ? rc + rc_overflow_[HeapOffset(addr)] : rc;
+  }
+  void IncRefCount(void *addr) {
+    MemHeader &header = GetMemHeader(addr);
+    if (header.refcount < UINT14_MAX - 1) {
+      header.refcount++;
+    } else {
+      IncOverflowRefCount(addr);
+    }
+  }
+  // Returns true when the count drops to zero.
+  bool DecRefCount(void *addr) {
+    MemHeader &header = GetMemHeader(addr);
+    if (header.refcount == UINT14_MAX) {
+      DecOverflowRefCount(addr);
+      return false;
+    }
+    if (header.refcount == 0) {
+      return false;  // unbalanced RC--, leave it to the leak check
+    }
+    return --header.refcount == 0;
+  }
+  void IncOverflowRefCount(void *addr);
+  void DecOverflowRefCount(void *addr);
+
   // Decrease reference-counting but not recall the memory.
   // Sometimes we need inc-rf and dec-rf pairs to protect a heap-object(or string),
   // But the heap-object(or string) is still useful after dec-rf.
   void GCDecRfNoRecall(void *addr) {
     if (IsHeap(addr)) {
-      GetMemHeader(addr).refcount--;
+      DecRefCount(addr);
     }
   }
 
@@ -331,17 +601,16 @@ class MemoryManager {
     if (TurnoffGC())
       return;
     if (IsHeap(addr)) {
-      MemHeader &header = GetMemHeader(addr);
-      if(header.refcount < UINT14_MAX)
-        header.refcount++;
+      IncRefCount(addr);
+      stats_.rc_inc++;
 #ifdef MM_DEBUG
 #ifdef MM_RC_STATS
       num_rcinc++;
 #endif
 #ifdef MEMORY_LEAK_CHECK
-      if (header.refcount > live_objects[addr])
-        live_objects[addr] = header.refcount;
-//printf("addr= %p RC incto= %d  max= %d\n", true_addr, header.refcount, live_objects[true_addr]);
+      if ((int)RefCount(addr) > live_objects[addr])
+        live_objects[addr] = RefCount(addr);
+//printf("addr= %p RC incto= %d  max= %d\n", true_addr, RefCount(addr), live_objects[true_addr]);
 #endif
 #endif
     }
@@ -362,6 +631,27 @@ class MemoryManager {
   bool IsHeap(void *addr) {
     return (((void *)addr >= memory_) && ((void *)addr < heap_end));
   }
+  // Blocks of the big region carry no size, so the start bits are what tells
+  // an allocated block from a free chunk or the middle of another block.
+  void SetBigStart(uint32 offset) {
+    heap_big_starts_[offset >> 7] |= 1u << ((offset >> 2) & 31);
+  }
+  void ClearBigStart(uint32 offset) {
+    heap_big_starts_[offset >> 7] &= ~(1u << ((offset >> 2) & 31));
+  }
+  bool IsBigStart(uint32 offset) {
+    return (heap_big_starts_[offset >> 7] & (1u << ((offset >> 2) & 31))) != 0;
+  }
+  // Whether the VM stack may be read word by word, by the deferred RC scan or
+  // by a heap snapshot; stack frames must then be cleared whole, since a word
+  // the frame bitmaps do not flag can still hold a TValue of an older frame.
+  bool ScansVMStack() {
+#ifdef RC_DEFER_STACK
+    return true;
+#else
+    return heap_snapshot_prefix_ != nullptr;
+#endif
+  }
 
   uint32 Bytes4Align(uint32 size) {
     return ((size + 3) & (~0U << 2));
@@ -384,31 +674,16 @@ class MemoryManager {
 #endif
 
 
-#if MACHINE64
-  void *GetRealAddr(uint32_t a32off) {
-    assert(a32off < addrMap.size() && "wrong 32 bits address");
-    return addrMap[a32off];
-  }
-
-  uint32 MapRealAddr(void *realAddr) {
-    // create a 32bits offset to map realAddr
-    // addrMap.insert(std::pair<uint32_t, void *>(a32off, realAddr));
-    assert(addrMap.size() == addrOffset && "mismatch");
-    addrMap.push_back(realAddr);
-    return addrOffset++;
-  }
-
-  //TValue GetF64Builtin(uint32_t);
-  void SetF64Builtin();
-  double GetF64FromU32 (uint32);
-  uint64_t SetF64ToU32 (double x) {
-    union{
-      double t;
-      uint64_t t1;
-    }xx;
-    xx.t = x;
-    return xx.t1;
+  // Heap references kept by the memory manager itself are compressed to
+  // 32-bit offsets from memory_ and decoded with one add.
+  uint32 HeapOffset(void *addr) {
+    return (uint32)((uint8 *)addr - (uint8 *)memory_);
+  }
+  void *HeapAddr(uint32 offset) {
+    return (uint8 *)memory_ + offset;
   }
+
+#if MACHINE64
   void SetUpGpMemory(void *gpMem, uint8_t *gpFlagMem) {
     gpMemory = gpMem;
   }
@@ -417,12 +692,16 @@ class MemoryManager {
   bool TurnoffGC() {return false;}
 };
 
-extern MemoryManager *memory_manager;  // global instance.
+// The memory manager of the isolate running on this thread, and its cycle
+// collector state.
+extern VM_TLS MemoryManager *memory_manager;
 #ifdef MARK_CYCLE_ROOTS
-extern CycleRoot *cycle_roots;
+extern VM_TLS CycleRoot *cycle_roots;
+extern VM_TLS CycleRoot *garbage_roots;
 #else
-extern bool is_sweep;
+extern VM_TLS __jsobject *obj_list;
 #endif
+extern VM_TLS bool is_sweep;
 
 // C-style interfaces.
 void *VMMallocGC(uint32, MemHeadTag tag = MemHeadAny, bool init_p = true);
@@ -449,6 +728,19 @@ static inline void GCIncRf(void *p) {
   memory_manager->GCIncRf(p);
 }
 
+// RC for stack, frame, register and retval slots; deferred under RC_DEFER_STACK
+static inline void StackIncRf(void *p) {
+#ifndef RC_DEFER_STACK
+  GCIncRf(p);
+#endif
+}
+
+static inline void StackDecRf(void *p) {
+#ifndef RC_DEFER_STACK
+  GCDecRf(p);
+#endif
+}
+
 static inline void GCDecRfNoRecall(void *p) {
   if (memory_manager->TurnoffGC())
     return;
@@ -486,7 +778,7 @@ static inline void GCCheckAndIncRf(uint64 val, bool needrc) {
 
 #ifdef MEMORY_LEAK_CHECK
 static inline int32_t GCGetRf(void *addr) {
-  return memory_manager->GetMemHeader(addr).refcount;
+  return memory_manager->RefCount(addr);
 }
 
 #endif
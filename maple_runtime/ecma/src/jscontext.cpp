@@ -27,13 +27,13 @@
 #include "jsdate.h"
 #include "jsintl.h"
 
-TValue __js_Global_ThisBinding;
-TValue __js_ThisBinding;
-TValue __js_OuterBinding;
-bool __is_global_strict = false;
+VM_TLS TValue __js_Global_ThisBinding;
+VM_TLS TValue __js_ThisBinding;
+VM_TLS TValue __js_OuterBinding;
+VM_TLS bool __is_global_strict = false;
 
 // Assume builtin-objects' names are reserved keywords.
-static __jsobject *__jsbuiltin_objects[JSBUILTIN_LAST_OBJECT] = { NULL };
+static VM_TLS __jsobject *__jsbuiltin_objects[JSBUILTIN_LAST_OBJECT] = { NULL };
 
 __jsobject **__jsobj_get_jsbuiltin_objects(void) {
   return __jsbuiltin_objects;
@@ -358,6 +358,38 @@ __jsobject *__jsobj_get_or_create_builtin(__jsbuiltin_object_id id) {
   return obj;
 }
 
+// Create the builtin objects with all of their properties up front, as a
+// script enumerating each of them would, so that a heap image written
+// afterwards holds them all.  NaN, Infinity and undefined are values on the
+// global object, and module and exports are left to the module using them.
+void __jsobj_create_all_builtins() {
+  __jsobject *global = __jsobj_get_or_create_builtin(JSBUILTIN_GLOBALOBJECT);
+  if (__js_Global_ThisBinding.x.u64 == 0) {
+    __js_ThisBinding = __object_value(global);
+    __js_Global_ThisBinding = __js_ThisBinding;
+  }
+  for (int32_t i = 0; i < (int32_t)JSBUILTIN_LAST_OBJECT; i++) {
+    __jsbuiltin_object_id id = (__jsbuiltin_object_id)i;
+    if (id != JSBUILTIN_NAN && id != JSBUILTIN_INFINITY && id != JSBUILTIN_UNDEFINED &&
+        id != JSBUILTIN_MODULE && id != JSBUILTIN_EXPORTS) {
+      __jsobj_get_or_create_builtin(id);
+    }
+  }
+  // creating the properties may create more builtins
+  bool filled[JSBUILTIN_LAST_OBJECT] = { false };
+  bool more = true;
+  while (more) {
+    more = false;
+    for (int32_t i = 0; i < (int32_t)JSBUILTIN_LAST_OBJECT; i++) {
+      if (__jsbuiltin_objects[i] != NULL && !filled[i]) {
+        filled[i] = true;
+        more = true;
+        __create_builtin_property(__jsbuiltin_objects[i], NULL);
+      }
+    }
+  }
+}
+
 #ifdef MEMORY_LEAK_CHECK
 static bool __jsobj_check_builtin_circle(__jsobject *obj1, __jsobject *obj2) {
   __jsprop *prop = obj1->prop_list;
@@ -87,7 +87,7 @@ void JsEh::FreeEH() {
   }
 
   // park the VMEH at EHReuse to avoid too much malloc/free
-  if (gInterSource->EHstackReuseSize < 2) { // VMEH_MAXREUSESTACKSIZE
+  if (gInterSource->EHstackReuseSize < VMEH_MAXREUSESTACKSIZE) {
     gInterSource->EHstackReuse.Push(eh);
     gInterSource->EHstackReuseSize++;
   } else {
@@ -23,8 +23,8 @@
 #include "jsarray.h"
 #include "jsmath.h"
 #include "jsintl.h"
+#include "jscontext.h"
 
-extern TValue __js_ThisBinding;
 extern std::vector<std::pair<std::string,uint16_t>> kNumberingSystems;
 
 std::map<std::string,int> kCurrencyDigits = {
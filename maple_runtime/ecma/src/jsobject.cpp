@@ -159,6 +159,25 @@ __jsprop *__jsobj_helper_get_propertyByValue(__jsobject *obj, uint32_t index, bo
 #endif
 }
 
+#ifdef USE_PROP_MAP
+// Recreate the property maps of an object from its property list, for an
+// object whose maps are gone, e.g. one mapped in from a heap image.
+// index_map and string_map tell which of the maps the object had.
+void __jsobj_rebuild_prop_maps(__jsobject *obj, bool index_map, bool string_map) {
+  obj->prop_index_map = index_map ? new std::map<uint32_t, __jsprop *>() : NULL;
+  obj->prop_string_map = string_map ? new std::map<__jsstring *, __jsprop *>() : NULL;
+  for (__jsprop *prop = obj->prop_list; prop; prop = prop->next) {
+    if (prop->isIndex) {
+      if (index_map) {
+        (*(obj->prop_index_map))[prop->n.index] = prop;
+      }
+    } else if (string_map) {
+      (*(obj->prop_string_map))[prop->n.name] = prop;
+    }
+  }
+}
+#endif
+
 // insert prop into propList by increasing order
 static void InsertIndexProp(__jsprop *prop, __jsprop **propList, __jsobject *obj = NULL) {
 #ifdef USE_PROP_MAP
@@ -247,6 +266,9 @@ static void InsertIndexProp(__jsprop *prop, __jsprop **propList, __jsobject *obj
           assert(old_prop->prev->next != nullptr && "prev should not be the last one");
           old_prop->prev->next = prop;
         }
+        if (obj->object_class == JSGLOBAL) {
+          gInterSource->globalCellEpoch++;
+        }
         memory_manager->ManageProp(old_prop, RECALL);
         it->second = prop;
         return;
@@ -426,34 +448,40 @@ __jsprop *__jsobj_helper_init_value_property(__jsobject *obj, __jsbuiltin_string
   return __jsobj_helper_init_value_property(obj, __jsstr_get_builtin(id), v, attrs);
 }
 
-static __jsobject *bi_obj;
-static __jsstring *bi_name;
+static VM_TLS __jsobject *bi_obj;
+static VM_TLS __jsstring *bi_name;
+// Whether the builtin property id is to be created on bi_obj: the looked up
+// name is id, or all of the properties are created (create_all) and the
+// object does not have this one yet.  Enumerating a builtin must not reset
+// a property the script has changed, nor create it twice.
+static bool __builtin_property_wanted(__jsbuiltin_string_id id, bool create_all) {
+  if (create_all) {
+    return __jsobj_helper_get_property(bi_obj, __jsstr_get_builtin(id), false) == NULL;
+  }
+  return __jsstr_equal_to_builtin(bi_name, id);
+}
+
 __jsprop *__add_builtin_function_property(__jsbuiltin_string_id id, void *method, uint32_t attrs, bool create_all) {
   __jsobject *obj = bi_obj;
-  __jsstring *name = bi_name;
-  if (create_all) {
-    TValue v = __js_new_function((void *)method, NULL, attrs);
-    __jsobj_helper_add_value_property(obj, id, v, JSPROP_DESC_HAS_VWUEC);
-    return NULL;
-  } else if (__jsstr_equal_to_builtin(name, id)) {
-    // ecma 20.2.3 : Function Prototype Object does not have a "prototype" property.
-    bool skipprototype = (obj->is_builtin && (obj->builtin_id == JSBUILTIN_FUNCTIONPROTOTYPE ||
-                                              obj->builtin_id == JSBUILTIN_STRINGPROTOTYPE ||
-                                              obj->builtin_id == JSBUILTIN_ARRAYPROTOTYPE ||
-                                              obj->builtin_id == JSBUILTIN_DATEPROTOTYPE ||
-                                              obj->builtin_id == JSBUILTIN_REGEXPPROTOTYPE ||
-                                              obj->builtin_id == JSBUILTIN_NUMBERPROTOTYPE ||
-                                              obj->builtin_id == JSBUILTIN_INTL_DATETIMEFORMAT_PROTOTYPE ||
-                                              obj->builtin_id == JSBUILTIN_INTL_NUMBERFORMAT_PROTOTYPE ||
-                                              obj->builtin_id == JSBUILTIN_INTL_COLLATOR_PROTOTYPE ||
-                                              __jsstr_equal_to_builtin(name, JSBUILTIN_STRING_SUPPORTED_LOCALES_OF) ||
-                                              obj->builtin_id == JSBUILTIN_JSON ||
-                                              obj->builtin_id == JSBUILTIN_OBJECTPROTOTYPE));
-    TValue v = __js_new_function((void *)method, NULL, attrs, -1, (!skipprototype));
-    return __jsobj_helper_init_value_property(obj, id, v, JSPROP_DESC_HAS_VWUEC);
-  } else {
+  if (!__builtin_property_wanted(id, create_all)) {
     return NULL;
   }
+  // ecma 20.2.3 : Function Prototype Object does not have a "prototype" property.
+  bool skipprototype = (obj->is_builtin && (obj->builtin_id == JSBUILTIN_FUNCTIONPROTOTYPE ||
+                                            obj->builtin_id == JSBUILTIN_STRINGPROTOTYPE ||
+                                            obj->builtin_id == JSBUILTIN_ARRAYPROTOTYPE ||
+                                            obj->builtin_id == JSBUILTIN_DATEPROTOTYPE ||
+                                            obj->builtin_id == JSBUILTIN_REGEXPPROTOTYPE ||
+                                            obj->builtin_id == JSBUILTIN_NUMBERPROTOTYPE ||
+                                            obj->builtin_id == JSBUILTIN_INTL_DATETIMEFORMAT_PROTOTYPE ||
+                                            obj->builtin_id == JSBUILTIN_INTL_NUMBERFORMAT_PROTOTYPE ||
+                                            obj->builtin_id == JSBUILTIN_INTL_COLLATOR_PROTOTYPE ||
+                                            id == JSBUILTIN_STRING_SUPPORTED_LOCALES_OF ||
+                                            obj->builtin_id == JSBUILTIN_JSON ||
+                                            obj->builtin_id == JSBUILTIN_OBJECTPROTOTYPE));
+  TValue v = __js_new_function((void *)method, NULL, attrs, -1, (!skipprototype));
+  __jsprop *prop = __jsobj_helper_init_value_property(obj, id, v, JSPROP_DESC_HAS_VWUEC);
+  return create_all ? NULL : prop;
 }
 
 __jsprop *__add_builtin_value_property(__jsbuiltin_string_id id, __jsbuiltin_object_id builtin_obj_id,
@@ -461,6 +489,9 @@ __jsprop *__add_builtin_value_property(__jsbuiltin_string_id id, __jsbuiltin_obj
   __jsobject *obj = bi_obj;
   __jsstring *name = bi_name;
   TValue v = __object_value(__jsobj_get_or_create_builtin(builtin_obj_id));
+  // creating the builtin may have looked up builtin properties of others
+  bi_obj = obj;
+  bi_name = name;
   uint32_t attrs;
   switch(builtin_obj_id) {
       case JSBUILTIN_DATECONSTRUCTOR:
@@ -493,28 +524,21 @@ __jsprop *__add_builtin_value_property(__jsbuiltin_string_id id, __jsbuiltin_obj
       default:
           attrs = JSPROP_DESC_HAS_VUWUEUC;
   }
-  if (create_all) {
-    __jsobj_helper_add_value_property(obj, id, v, attrs);
-    return NULL;
-  } else if (__jsstr_equal_to_builtin(name, id)) {
-    return __jsobj_helper_init_value_property(obj, id, v, attrs);
-  } else {
+  if (!__builtin_property_wanted(id, create_all)) {
     return NULL;
   }
+  __jsprop *prop = __jsobj_helper_init_value_property(obj, id, v, attrs);
+  return create_all ? NULL : prop;
 }
 
 __jsprop *__add_builtin_value_property2(__jsbuiltin_string_id id, __jsbuiltin_object_id builtin_obj_id,  TValue val,
                                        bool create_all) {
   __jsobject *obj = bi_obj;
-  __jsstring *name = bi_name;
-  if (create_all) {
-    __jsobj_helper_add_value_property(obj, id, val, JSPROP_DESC_HAS_VUWUEUC);
-    return NULL;
-  } else if (__jsstr_equal_to_builtin(name, id)) {
-    return __jsobj_helper_init_value_property(obj, id, val, JSPROP_DESC_HAS_VUWUEUC);
-  } else {
+  if (!__builtin_property_wanted(id, create_all)) {
     return NULL;
   }
+  __jsprop *prop = __jsobj_helper_init_value_property(obj, id, val, JSPROP_DESC_HAS_VUWUEUC);
+  return create_all ? NULL : prop;
 }
 
 __jsprop *add_builtin_accessor_property(__jsbuiltin_string_id id, __jsbuiltin_object_id builtin_obj_id,
@@ -523,11 +547,10 @@ __jsprop *add_builtin_accessor_property(__jsbuiltin_string_id id, __jsbuiltin_ob
                                        uint32_t attrs,
                                        bool create_all) {
   __jsobject *obj = bi_obj;
-  __jsstring *name = bi_name;
   __jsobject *getObj = NULL;
   __jsobject *setObj = NULL;
 
-  if (__jsstr_equal_to_builtin(name, id)) {
+  if (__builtin_property_wanted(id, create_all)) {
     // init property
     __jsprop *prop = __jsobj_helper_create_property(obj, __jsstr_get_builtin(id));
     prop->desc.attrs = attrs; // set user defined attrs
@@ -546,7 +569,7 @@ __jsprop *add_builtin_accessor_property(__jsbuiltin_string_id id, __jsbuiltin_ob
       __set_set(&(prop->desc), fobj);
       GCIncRf(fobj);
     }
-    return prop;
+    return create_all ? NULL : prop;
   }
   return NULL;
 }
@@ -642,9 +665,11 @@ __jsprop *__create_builtin_property(__jsobject *obj, __jsstring *name) {
       ADD_FUNCTION_PROPERTY(JSBUILTIN_STRING_FROM_UL, __jsarr_pt_from, ATTRS(UNCERTAIN_NARGS, -1));
       break;
     case JSBUILTIN_ARRAYPROTOTYPE:
-      if (create_all || __jsstr_equal_to_builtin(name, JSBUILTIN_STRING_LENGTH)) {
+      if (__builtin_property_wanted(JSBUILTIN_STRING_LENGTH, create_all)) {
         TValue v = __number_value(0);
-        return __jsobj_helper_init_value_property(obj, JSBUILTIN_STRING_LENGTH, v, JSPROP_DESC_HAS_VWUEUC);
+        __jsprop *prop = __jsobj_helper_init_value_property(obj, JSBUILTIN_STRING_LENGTH, v, JSPROP_DESC_HAS_VWUEUC);
+        if (!create_all)
+          return prop;
       }
       ADD_VALUE_PROPERTY(JSBUILTIN_STRING_CONSTRUCTOR, (JSBUILTIN_ARRAYCONSTRUCTOR));
       ADD_FUNCTION_PROPERTY(JSBUILTIN_STRING_TO_STRING_UL, __jsarr_pt_toString, ATTRS(0, 0));
@@ -1829,6 +1854,9 @@ bool __jsobj_internal_Delete(__jsobject *o, __jsstring *p, bool mark_as_deleted,
               }
             }
             o->prop_string_map->erase(it);
+            if (o->object_class == JSGLOBAL) {
+              gInterSource->globalCellEpoch++;
+            }
             memory_manager->ManageProp(prop, RECALL);
           }
           return true;
@@ -1864,6 +1892,9 @@ bool __jsobj_internal_Delete(__jsobject *o, __jsstring *p, bool mark_as_deleted,
             prop->desc = __undefined_desc();
           } else {
             *prop_p = prop->next;
+            if (o->object_class == JSGLOBAL) {
+              gInterSource->globalCellEpoch++;
+            }
             memory_manager->ManageProp(prop, RECALL);
           }
           return true;
@@ -3093,6 +3124,13 @@ TValue __jsop_get_this_prop_by_name(TValue &o,  __jsstring *name) {
   }
 }
 
+// the property a global property cell binds to; it stays valid until the
+// property is deleted, which bumps gInterSource->globalCellEpoch
+__jsprop *__jsop_get_this_prop_cell(TValue &o, __jsstring *name) {
+  __jsobject *obj = __is_js_object(o) ? __jsval_to_object(o) : __js_ToObject(o);
+  return __jsobj_helper_get_property(obj, name, false);
+}
+
 // make things faster
 void __jsop_set_this_prop_by_name(TValue &o, __jsstring *name, TValue &v, bool noThrowTE) {
   __jsobject *obj = IS_OBJECT(o.x.u64) ? (__jsobject *)o.x.c.payload : __js_ToObject(o);
@@ -3114,7 +3152,12 @@ void __jsop_init_this_prop_by_name(TValue &o, __jsstring *name) {
   // __jsprop_desc desc = __new_init_desc();
   __jsprop *p = __jsop_get_prop_jsobject(obj, name);
   if (p) {
-    p->desc = __new_init_desc();
+    // a declaration leaves read-only properties such as NaN as they are, and
+    // keeps the binding it resets writable
+    if (!(__has_value(p->desc) && __has_and_unwritable(p->desc))) {
+      p->desc = __new_init_desc();
+      __set_writable(&p->desc, true);
+    }
   } else {
     __jsprop *prop = __jsobj_helper_create_property(obj, name);
     TValue jsUndf = __undefined_value();
@@ -15,12 +15,34 @@
 #include <cstdint>
 #include "jsplugin.h"
 #include <cstdio>
+#include <cctype>
+#include <climits>
 #include <unistd.h>
+#include <fcntl.h>
 #include <string>
 #include <dlfcn.h>
 #include <cstring>
+#include <algorithm>
+#include <atomic>
+#include <thread>
+#include <unordered_set>
 #include "vmmemory.h"
 
+// Upper bound on the threads loading the files of a manifest.
+static const uint32_t kMaxPreloadThreads = 8;
+
+// A file being loaded.  OpenJsFile() touches no VM state, so Preload() can
+// run it on several files at once.
+struct JsFileLoad {
+  std::string path;
+  uint8_t *gp;
+  uint16_t glbMemsize;
+  void *mainFn;
+  std::string error;
+
+  JsFileLoad() : gp(nullptr), glbMemsize(0), mainFn(nullptr) {}
+};
+
 static void GetCurrentDir(const char *name, std::string &newDir) {
   uint32_t len = strlen(name);
   int32_t i;
@@ -32,6 +54,91 @@ static void GetCurrentDir(const char *name, std::string &newDir) {
   newDir.append(name, 0, i);
 }
 
+static bool OpenJsFile(JsFileLoad *load) {
+  const char *name = load->path.c_str();
+  // have the whole file read ahead, instead of a page fault at a time
+  // while dlopen relocates it
+  int fd = open(name, O_RDONLY | O_CLOEXEC);
+  if (fd >= 0) {
+    posix_fadvise(fd, 0, 0, POSIX_FADV_WILLNEED);
+    close(fd);
+  }
+  void *handle = dlopen(name, RTLD_NOW);
+  if (!handle) {
+    load->error = std::string("failed to open ") + name + ": " + dlerror();
+    return false;
+  }
+  uint16_t *mpljsMdD = (uint16_t *)dlsym(handle, "__mpljs_module_decl__");
+  if (!mpljsMdD) {
+    load->error = std::string("failed to open __mpljs_module_decl__ ") + name;
+    dlclose(handle);
+    return false;
+  }
+  void *mainFn = dlsym(handle, "__jsmain");
+  if (!mainFn) {
+    load->error = std::string("failed to open __jsmain for plugin ") + name;
+    dlclose(handle);
+    return false;
+  }
+
+  load->glbMemsize = mpljsMdD[0];
+  load->gp = (uint8_t *)malloc(load->glbMemsize);
+  memcpy(load->gp, mpljsMdD + 1, load->glbMemsize);
+  load->mainFn = (uint8_t *)mainFn + 4;
+  return true;
+}
+
+// Make a node for an opened file and add it to the plugin.  The node comes
+// from the memory manager, so this runs on the VM thread.
+static JsFileInforNode *NewJsFile(JsPlugin *plugin, JsFileLoad *load) {
+  char *path = strdup(load->path.c_str());
+  JsFileInforNode *jsfileinfo = (JsFileInforNode *)VMMallocNOGC(sizeof(JsFileInforNode));
+  jsfileinfo->Init(path + plugin->GetIndexForSo(path), ++plugin->fileIndex, load->gp, load->glbMemsize,
+                   load->mainFn, NULL);
+  jsfileinfo->path = path;
+  plugin->InsertJsFile(jsfileinfo);
+  return jsfileinfo;
+}
+
+void JsPlugin::SetMainFile(JsFileInforNode *node, const char *path) {
+  node->path = realpath(path, NULL);
+  node->initialized = true;
+  if (mainFileInfo) {
+    node->next = mainFileInfo->next;
+    if (mainFileInfo->path) {
+      filesByPath.erase(mainFileInfo->path);
+    }
+    free(mainFileInfo->path);
+    free(mainFileInfo);
+  }
+  mainFileInfo = node;
+  formalFileInfo = node;
+  // relative requests were resolved against the old main file
+  filesByRequest.clear();
+  if (node->path) {
+    filesByPath[node->path] = node;
+  }
+  if (filesByIndex.empty()) {
+    filesByIndex.push_back(node);
+  }
+  filesByIndex[node->fileIndex] = node;
+}
+
+JsPlugin::~JsPlugin() {
+  if (!mainFileInfo) {
+    return;
+  }
+  JsFileInforNode *node = mainFileInfo->next;
+  while (node) {
+    JsFileInforNode *next = node->next;
+    free(node->gp);
+    free(node->path);
+    VMFreeNOGC(node, sizeof(JsFileInforNode));
+    node = next;
+  }
+  free(mainFileInfo->path);
+  free(mainFileInfo);
+}
 
 uint32_t JsPlugin::GetIndexForSo (char *name) {
   uint32_t len = strlen(name);
@@ -43,91 +150,140 @@ uint32_t JsPlugin::GetIndexForSo (char *name) {
   return i >= 0 ? (i + 1) : 0;
 }
 
+// A relative name is looked up next to the file requiring it, then in the
+// working directory.  Files are told apart by their canonical paths.
 JsFileInforNode *JsPlugin::LoadRequiredFile(char *name, bool &iscached) {
-  char *soName = name + GetIndexForSo(name);
-  JsFileInforNode *jsfileinfo = FindJsFile(soName);
-  if (!jsfileinfo) {
-    // std::string file_name(name);
-    // std::string file_name_save(oldIS->fileName);
-    // oldIS->fileName = file_name;  // put name of to-be-read file in module
-    // MIRParser theparser(*mirModule);
-    //if (!theparser.ParseMIR(++file_index_)) {
-    //  theparser.EmitError(file_name);
-    //  return NULL;
-    //}
-    void *handle = nullptr;
-    std::string soPath(name);
-    std::string newPath("");
-    std::string newDir("");
-    if (soPath.size() >= 1 && soPath.at(0) != 47) {
-      // this is a absolute path
-      char *filePath = get_current_dir_name();
-      newPath.append(filePath);
-      newPath.append("/");
-      newPath.append(soPath);
-      GetCurrentDir(newPath.c_str(),newDir);
-      free(filePath);
-      handle = dlopen(newPath.c_str(), RTLD_NOW);
-    } else {
-      GetCurrentDir(name,newDir);
-      handle = dlopen(name, RTLD_NOW);
-    }
-    if (chdir(newDir.c_str()) != 0) {
-      fprintf(stderr, "failed to change dir in plugin LoadRequiredFile %s", newDir.c_str());
-      exit(1);
+  JsFileInforNode *from = formalFileInfo ? formalFileInfo : mainFileInfo;
+  std::string request;
+  if (name[0] != '/' && from->path) {
+    GetCurrentDir(from->path, request);
+    request.append("/");
+  }
+  request.append(name);
+
+  JsFileInforNode *jsfileinfo = nullptr;
+  auto it = filesByRequest.find(request);
+  if (it != filesByRequest.end()) {
+    jsfileinfo = it->second;
+  } else {
+    char *path = realpath(request.c_str(), NULL);
+    if (!path) {
+      path = realpath(name, NULL);
     }
-    if (!handle) {
+    if (!path) {
       fprintf(stderr, "failed to open %s\n", name);
       exit(1);
     }
-    uint16_t *mpljsMdD = (uint16_t *)dlsym(handle, "__mpljs_module_decl__");
-    if (!mpljsMdD) {
-      fprintf(stderr, "failed to open __mpljs_module_decl__ %s\n", name);
-      exit(1);
-    }
-    void *mainFn = dlsym(handle, "__jsmain");
-    if (!mainFn) {
-      fprintf(stderr, "failed to open __jsmain for plugin %s", name);
-      exit(1);
+    jsfileinfo = FindJsFile(path);
+    if (!jsfileinfo) {
+      JsFileLoad load;
+      load.path = path;
+      if (!OpenJsFile(&load)) {
+        fprintf(stderr, "%s\n", load.error.c_str());
+        exit(1);
+      }
+      jsfileinfo = NewJsFile(this, &load);
     }
-
-    uint16_t globalMemSize = mpljsMdD[0];
-    uint8_t *newGp = (uint8_t *)malloc(globalMemSize);
-    memcpy(newGp, mpljsMdD + 1, globalMemSize);
-    // uint8_t *newTopgp = newGp + globalMemSize;
-    // mirModule->fileName = file_name_save;  // restore original file name
-    jsfileinfo = (JsFileInforNode *)VMMallocNOGC(sizeof(JsFileInforNode));
-    jsfileinfo->Init(soName, ++fileIndex, newGp, globalMemSize, (uint8_t *)mainFn + 4, NULL);
-    InsertJsFile(jsfileinfo);
-    iscached = false;
-  } else {
-    iscached = true;
+    free(path);
+    filesByRequest[request] = jsfileinfo;
   }
+  // a preloaded file has not been run yet
+  iscached = jsfileinfo->initialized;
+  jsfileinfo->initialized = true;
   return jsfileinfo;
 }
 
+JsFileInforNode *JsPlugin::FindJsFile(const char *path) {
+  auto it = filesByPath.find(path);
+  return it != filesByPath.end() ? it->second : NULL;
+}
 
-JsFileInforNode *JsPlugin::FindJsFile(char *name) {
-  JsFileInforNode *node = mainFileInfo;
-  for (; node; node = node->next) {
-    if (!strcmp(node->fileName, name)) {
-      return node;
-    }
+void JsPlugin::InsertJsFile(JsFileInforNode *node) {
+  node->next = mainFileInfo->next;
+  mainFileInfo->next = node;
+  if (node->path) {
+    filesByPath[node->path] = node;
+  }
+  if (filesByIndex.size() <= node->fileIndex) {
+    filesByIndex.resize(node->fileIndex + 1, NULL);
   }
-  return NULL;
+  filesByIndex[node->fileIndex] = node;
 }
 
-JsFileInforNode *JsPlugin::FindJsFile(uint32_t index) {
-  for (JsFileInforNode *node = mainFileInfo; node; node = node->next) {
-    if (index == node->fileIndex)
-      return node;
+bool JsPlugin::HasRequiredFiles() {
+  for (JsFileInforNode *node = mainFileInfo->next; node; node = node->next) {
+    if (node->initialized)
+      return true;
   }
-  return NULL;
+  return false;
 }
 
+// The manifest lists a file per line, by absolute path or relative to the
+// manifest.  Blank lines and lines starting with '#' are skipped.  The files
+// are opened and their globals set up by a few threads at once; dlopen
+// serializes the mapping and relocation itself, but the reads of the files
+// overlap.  require() of a preloaded file then only runs its main function.
+void JsPlugin::Preload(const char *manifest) {
+  FILE *file = fopen(manifest, "r");
+  if (!file) {
+    fprintf(stderr, "failed to open module manifest %s\n", manifest);
+    return;
+  }
+  std::string dir;
+  char *manifestPath = realpath(manifest, NULL);
+  if (manifestPath) {
+    GetCurrentDir(manifestPath, dir);
+    free(manifestPath);
+  }
+
+  std::vector<JsFileLoad> loads;
+  std::unordered_set<std::string> listed;
+  char line[PATH_MAX];
+  while (fgets(line, sizeof(line), file)) {
+    size_t len = strlen(line);
+    while (len > 0 && isspace((unsigned char)line[len - 1])) {
+      line[--len] = '\0';
+    }
+    if (len == 0 || line[0] == '#') {
+      continue;
+    }
+    std::string name = (line[0] == '/' || dir.empty()) ? std::string(line) : dir + "/" + line;
+    char *path = realpath(name.c_str(), NULL);
+    if (!path) {
+      fprintf(stderr, "failed to find module %s in %s\n", name.c_str(), manifest);
+      continue;
+    }
+    if (!FindJsFile(path) && listed.insert(path).second) {
+      loads.emplace_back();
+      loads.back().path = path;
+    }
+    free(path);
+  }
+  fclose(file);
 
+  uint32_t threads = std::max(std::thread::hardware_concurrency(), 1u);
+  threads = std::min(threads, kMaxPreloadThreads);
+  threads = std::min(threads, (uint32_t)loads.size());
+  std::atomic<size_t> next(0);
+  auto work = [&loads, &next]() {
+    for (size_t i = next++; i < loads.size(); i = next++) {
+      OpenJsFile(&loads[i]);
+    }
+  };
+  std::vector<std::thread> workers;
+  for (uint32_t i = 1; i < threads; i++) {
+    workers.emplace_back(work);
+  }
+  work();
+  for (std::thread &worker : workers) {
+    worker.join();
+  }
 
-void JsPlugin::InsertJsFile(JsFileInforNode *node) {
-  node->next = mainFileInfo->next;
-  mainFileInfo->next = node;
+  for (JsFileLoad &load : loads) {
+    if (load.error.empty()) {
+      NewJsFile(this, &load);
+    } else {
+      fprintf(stderr, "%s\n", load.error.c_str());
+    }
+  }
 }
@@ -0,0 +1,778 @@
+/*
+ * Copyright (C) [2021] Futurewei Technologies, Inc. All rights reserved.
+ *
+ * OpenArkCompiler is licensed under the Mulan Permissive Software License v2.
+ * You can use this software according to the terms and conditions of the MulanPSL - 2.0.
+ * You may obtain a copy of MulanPSL - 2.0 at:
+ *
+ *   https://opensource.org/licenses/MulanPSL-2.0
+ *
+ * THIS SOFTWARE IS PROVIDED ON AN "AS IS" BASIS, WITHOUT WARRANTIES OF ANY KIND, EITHER
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO NON-INFRINGEMENT, MERCHANTABILITY OR
+ * FIT FOR A PARTICULAR PURPOSE.
+ * See the MulanPSL - 2.0 for more details.
+ */
+
+#include <cerrno>
+#include <cstdarg>
+#include <cstddef>
+#include <cstdio>
+#include <cstring>
+#include <dlfcn.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "vmheapimage.h"
+#include "jsobject.h"
+#include "jsobjectinline.h"
+#include "jsvalueinline.h"
+#include "jscontext.h"
+#include "jsfunction.h"
+#include "jsdataview.h"
+
+#define HEAP_IMAGE_MAGIC "MPLHIMG2"
+#define HEAP_IMAGE_PAYLOAD_MASK 0x0000ffffffffffffULL
+#define IS_NATIVE_FUNCTION(V) ((V & 0x7FFF000000000000) == 0x7FFF000000000000)  // JSTYPE_FUNCTION = 15
+
+struct HeapImage::Header {
+  char magic[8];
+  uint32 header_size;
+  uint32 page_size;
+  Library libs[kTargetNum];  // as mapped by the writer
+  uint32 total_size;
+  uint32 total_small_size;
+  uint32 los_size;
+  uint32 small_end;   // heap_free_small_offset_
+  uint32 big_end;     // heap_free_big_offset_
+  uint32 small_size;  // bytes of the small region in the file, from offset 0
+  uint32 big_size;    // bytes of the big region in the file, from total_small_size
+  uint32 free_slabs;
+  uint32 gp_size;
+  uint32 reloc_num;
+  uint32 prop_map_num;
+  uint32 chunk_num;
+  uint32 overflow_num;
+  uint32 zct_num;
+  uint32 candidate_num;
+  uint32 big_start_num;  // words of the big block start bits from total_small_size
+  uint64_t small_pos;  // file offsets of the sections, page aligned
+  uint64_t big_pos;
+  uint64_t tables_pos;
+  SlabClass slab_classes[SLAB_NUM_CLASSES];
+  MemStats stats;
+  uint32 builtins[JSBUILTIN_LAST_OBJECT];  // heap offset + 1, 0 if not created
+  uint32 global_this;                      // heap offset + 1, 0 if unset
+  uint32 global_strict;
+};
+
+static uint32 RoundUp(uint32 size, uint32 page_size) {
+  return (size + page_size - 1) / page_size * page_size;
+}
+
+// words of MemoryManager::heap_big_starts_ covering the big blocks below big_end
+static uint32 BigStartWords(uint32 total_small_size, uint32 big_end) {
+  return ((big_end + 127) >> 7) - (total_small_size >> 7);
+}
+
+static bool WriteAt(int fd, const void *data, size_t size, uint64_t pos) {
+  const uint8_t *p = (const uint8_t *)data;
+  while (size > 0) {
+    ssize_t n = pwrite(fd, p, size, (off_t)pos);
+    if (n < 0 && errno == EINTR) {
+      continue;
+    }
+    if (n <= 0) {
+      return false;
+    }
+    p += n;
+    pos += n;
+    size -= n;
+  }
+  return true;
+}
+
+static bool ReadAt(int fd, void *data, size_t size, uint64_t pos) {
+  uint8_t *p = (uint8_t *)data;
+  while (size > 0) {
+    ssize_t n = pread(fd, p, size, (off_t)pos);
+    if (n < 0 && errno == EINTR) {
+      continue;
+    }
+    if (n <= 0) {
+      return false;
+    }
+    p += n;
+    pos += n;
+    size -= n;
+  }
+  return true;
+}
+
+HeapImage::HeapImage() : has_module_(false), gp_(nullptr), gp_size_(0) {
+  memset(libs_, 0, sizeof(libs_));
+}
+
+bool HeapImage::Fail(const char *fmt, ...) {
+  char buf[256];
+  va_list args;
+  va_start(args, fmt);
+  vsnprintf(buf, sizeof(buf), fmt, args);
+  va_end(args);
+  error_ = buf;
+  return false;
+}
+
+bool HeapImage::IdentifyLibrary(const void *addr, Library *lib) {
+  Dl_info info;
+  struct stat st;
+  if (dladdr(addr, &info) == 0 || !info.dli_fname) {
+    return Fail("no shared object contains %p", addr);
+  }
+  if (stat(info.dli_fname, &st) != 0) {
+    return Fail("cannot stat %s: %s", info.dli_fname, strerror(errno));
+  }
+  lib->base = (uint64_t)(uintptr_t)info.dli_fbase;
+  lib->size = (uint64_t)st.st_size;
+  lib->mtime = (int64_t)st.st_mtime;
+  lib->ino = (uint64_t)st.st_ino;
+  return true;
+}
+
+void HeapImage::SetModule(const void *addr) {
+  has_module_ = IdentifyLibrary(addr, &libs_[kTargetModule]);
+}
+
+void HeapImage::SetGlobals(uint8_t *gp, uint32 size) {
+  gp_ = gp;
+  gp_size_ = size;
+}
+
+bool HeapImage::Classify(const void *addr, Target *target) {
+  if (memory_manager->IsHeap((void *)addr)) {
+    *target = kTargetHeap;
+    return true;
+  }
+  if ((const uint8_t *)addr >= gp_ && (const uint8_t *)addr < gp_ + gp_size_) {
+    *target = kTargetGlobals;
+    return true;
+  }
+  Dl_info info;
+  if (dladdr(addr, &info) != 0) {
+    uint64_t base = (uint64_t)(uintptr_t)info.dli_fbase;
+    if (base == libs_[kTargetRuntime].base) {
+      *target = kTargetRuntime;
+      return true;
+    }
+    if (has_module_ && base == libs_[kTargetModule].base) {
+      *target = kTargetModule;
+      return true;
+    }
+  }
+  return Fail("%p is outside the heap, the globals, the runtime and the module", addr);
+}
+
+// Record that the slot holds a pointer to addr, possibly NaN-boxed.
+bool HeapImage::AddSlot(void *slot, Area area, const void *addr) {
+  Target target;
+  if (!Classify(addr, &target)) {
+    return false;
+  }
+  Reloc reloc;
+  if (area == kAreaHeap) {
+    if (!memory_manager->IsHeap(slot)) {
+      return Fail("a heap reference is held at %p, outside the heap", slot);
+    }
+    reloc.offset = memory_manager->HeapOffset(slot);
+  } else {
+    reloc.offset = (uint32)((uint8_t *)slot - gp_);
+  }
+  reloc.area = area;
+  reloc.target = target;
+  relocs_.push_back(reloc);
+  return true;
+}
+
+// The structures are packed, so slots are read with memcpy.
+bool HeapImage::AddPointer(void *slot, Area area, void **addr) {
+  void *p;
+  memcpy(&p, slot, sizeof(p));
+  if (addr) {
+    *addr = p;
+  }
+  return !p || AddSlot(slot, area, p);
+}
+
+bool HeapImage::AddValue(void *slot, Area area) {
+  uint64_t v;
+  memcpy(&v, slot, sizeof(v));
+  if (IS_DOUBLE(v)) {
+    return true;
+  }
+  void *p = (void *)(uintptr_t)(v & HEAP_IMAGE_PAYLOAD_MASK);
+  if (!p) {
+    return true;
+  }
+  if (IS_NEEDRC(v)) {
+    MemHeadTag tag = IS_STRING(v) ? MemHeadJSString : (IS_OBJECT(v) ? MemHeadJSObj : MemHeadEnv);
+    return AddSlot(slot, area, p) && Reach(p, tag);
+  }
+  // string literals in the globals and native functions
+  if (IS_GPBASE(v) || IS_NATIVE_FUNCTION(v)) {
+    return AddSlot(slot, area, p);
+  }
+  if (IS_SPBASE(v) || IS_FPBASE(v)) {
+    return Fail("a stack address is held in the %s", area == kAreaHeap ? "heap" : "globals");
+  }
+  return true;
+}
+
+// Queue a heap block whose references are to be walked.  Builtin and
+// literal strings are the only things referenced outside the heap.
+bool HeapImage::Reach(void *addr, MemHeadTag tag) {
+  MemoryManager *mm = memory_manager;
+  if (!mm->IsHeap(addr)) {
+    return tag == MemHeadJSString || Fail("%s at %p is outside the heap", tag == MemHeadEnv ? "a scope" : "an object", addr);
+  }
+  if (!visited_.insert(addr).second) {
+    return true;
+  }
+  if (!mm->IsHeapBlockLive(addr) || mm->GetMemHeader(addr).memheadtag != tag) {
+    return Fail("a reference to a free or mistyped heap block at offset %u", mm->HeapOffset(addr));
+  }
+  if (tag == MemHeadJSObj || tag == MemHeadEnv) {
+    pending_.push_back(std::make_pair(addr, tag));
+  }
+  return true;
+}
+
+bool HeapImage::WalkProp(__jsprop *prop) {
+  uint8_t *base = (uint8_t *)prop;
+  void *addr;
+  if (!prop->isIndex) {
+    if (!AddPointer(base + offsetof(__jsprop, n.name), kAreaHeap, &addr) || (addr && !Reach(addr, MemHeadJSString))) {
+      return false;
+    }
+  }
+#ifdef USE_PROP_MAP
+  if (!AddPointer(base + offsetof(__jsprop, prev), kAreaHeap)) {
+    return false;
+  }
+#endif
+  if (!AddPointer(base + offsetof(__jsprop, next), kAreaHeap)) {
+    return false;
+  }
+  uint8_t *desc = base + offsetof(__jsprop, desc);
+  __jsprop_desc d = prop->desc;
+  if (__has_value(d)) {
+    return AddValue(desc + offsetof(__jsprop_desc, named_data_property.value), kAreaHeap);
+  }
+  if (__has_get(d)) {
+    if (!AddPointer(desc + offsetof(__jsprop_desc, named_accessor_property.get), kAreaHeap, &addr) ||
+        (addr && !Reach(addr, MemHeadJSObj))) {
+      return false;
+    }
+  }
+  if (__has_set(d)) {
+    if (!AddPointer(desc + offsetof(__jsprop_desc, named_accessor_property.set), kAreaHeap, &addr) ||
+        (addr && !Reach(addr, MemHeadJSObj))) {
+      return false;
+    }
+  }
+  return true;
+}
+
+// An ArrayBuffer's bytes may be shared with DataViews.
+bool HeapImage::WalkArrayByte(void *slot) {
+  void *addr;
+  if (!AddPointer(slot, kAreaHeap, &addr)) {
+    return false;
+  }
+  if (!addr || !visited_.insert(addr).second) {
+    return true;
+  }
+  __jsarraybyte *arrayByte = (__jsarraybyte *)addr;
+  return AddPointer(&arrayByte->arrayRaw, kAreaHeap);
+}
+
+bool HeapImage::WalkObject(__jsobject *obj) {
+  void *addr;
+  if (!AddPointer(&obj->prop_list, kAreaHeap)) {
+    return false;
+  }
+  for (__jsprop *prop = obj->prop_list; prop; prop = prop->next) {
+    if (!WalkProp(prop)) {
+      return false;
+    }
+  }
+#ifdef USE_PROP_MAP
+  // the maps are malloc'd and keyed by address; Read() builds new ones
+  if (obj->prop_index_map || obj->prop_string_map) {
+    PropMaps maps;
+    maps.offset = memory_manager->HeapOffset(obj);
+    maps.maps = (obj->prop_index_map ? 1 : 0) | (obj->prop_string_map ? 2 : 0);
+    prop_maps_.push_back(maps);
+  }
+#endif
+  if (!obj->proto_is_builtin) {
+    if (!AddPointer(&obj->prototype.obj, kAreaHeap, &addr) || (addr && !Reach(addr, MemHeadJSObj))) {
+      return false;
+    }
+  }
+
+  switch (obj->object_class) {
+    case JSSTRING:
+      return AddPointer(&obj->shared.prim_string, kAreaHeap, &addr) && (!addr || Reach(addr, MemHeadJSString));
+    case JSARRAY: {
+      if (obj->object_type != JSREGULAR_ARRAY || !obj->shared.array_props) {
+        return true;
+      }
+      if (!AddPointer(&obj->shared.array_props, kAreaHeap)) {
+        return false;
+      }
+      TValue *array = obj->shared.array_props;
+      uint32 arrlen = (uint32)__jsval_to_number(array[0]);
+      for (uint32 i = 1; i <= arrlen; i++) {
+        if (!AddValue(&array[i], kAreaHeap)) {
+          return false;
+        }
+      }
+      return true;
+    }
+    case JSFUNCTION: {
+      if (!AddPointer(&obj->shared.fun, kAreaHeap, &addr)) {
+        return false;
+      }
+      if (!addr) {
+        return true;
+      }
+      __jsfunction *fun = (__jsfunction *)addr;
+      if (fun->attrs & JSFUNCPROP_BOUND) {
+        // fp is the target function and env the bound arguments
+        if (!AddPointer(&fun->fp, kAreaHeap, &addr) || (addr && !Reach(addr, MemHeadJSObj)) ||
+            !AddPointer(&fun->env, kAreaHeap)) {
+          return false;
+        }
+        TValue *bound_args = (TValue *)fun->env;
+        uint32 bound_argc = ((fun->attrs >> 16) & 0xff);
+        for (uint32 i = 0; bound_args && i < bound_argc; i++) {
+          if (!AddValue(&bound_args[i], kAreaHeap)) {
+            return false;
+          }
+        }
+      } else if (!AddPointer(&fun->fp, kAreaHeap) || !AddPointer(&fun->env, kAreaHeap, &addr) ||
+                 (addr && !Reach(addr, MemHeadEnv))) {
+        return false;
+      }
+      // thisObject holds no count; it is only followed while live
+      if (!AddPointer(&fun->thisObject, kAreaHeap, &addr)) {
+        return false;
+      }
+      if (addr && memory_manager->IsHeap(addr) && memory_manager->IsHeapBlockLive(addr)) {
+        return Reach(addr, MemHeadJSObj);
+      }
+      return true;
+    }
+    case JSARRAYBUFFER:
+      return WalkArrayByte(&obj->shared.arrayByte);
+    case JSDATAVIEW: {
+      if (!AddPointer(&obj->shared.dataView, kAreaHeap, &addr)) {
+        return false;
+      }
+      __jsdataview *dataView = (__jsdataview *)addr;
+      return !dataView || WalkArrayByte(&dataView->arrayByte);
+    }
+    default:
+      return true;
+  }
+}
+
+bool HeapImage::WalkEnv(void *env) {
+  uint64 *ptr = (uint64 *)env;
+  uint32 argnums = *(uint32 *)ptr;
+  ptr++;
+  // the parent may be a boxed or a plain pointer; either way it is the payload
+  void *parent = (void *)(uintptr_t)(*ptr & HEAP_IMAGE_PAYLOAD_MASK);
+  if (parent && (!AddSlot(ptr, kAreaHeap, parent) || !Reach(parent, MemHeadEnv))) {
+    return false;
+  }
+  ptr++;
+  for (uint32 i = 0; i < argnums; i++, ptr++) {
+    if (!AddValue(ptr, kAreaHeap)) {
+      return false;
+    }
+  }
+  return true;
+}
+
+bool HeapImage::Walk() {
+  while (!pending_.empty()) {
+    std::pair<void *, MemHeadTag> block = pending_.back();
+    pending_.pop_back();
+    bool ok = block.second == MemHeadJSObj ? WalkObject((__jsobject *)block.first) : WalkEnv(block.first);
+    if (!ok) {
+      return false;
+    }
+  }
+  return true;
+}
+
+bool HeapImage::Write(const char *path) {
+#if !defined(MACHINE64) || !defined(MARK_CYCLE_ROOTS) || !defined(RC_NO_MMAP)
+  return Fail("heap images need a 64-bit build with MARK_CYCLE_ROOTS and RC_NO_MMAP");
+#else
+  MemoryManager *mm = memory_manager;
+  if (!IdentifyLibrary((const void *)__jsobj_get_or_create_builtin, &libs_[kTargetRuntime])) {
+    return false;
+  }
+  // garbage is freed first rather than saved with the heap
+  mm->DrainLazyFree(UINT32_MAX);
+  if (mm->CanCollect() && !mm->crc_in_progress_) {
+    mm->RecallCycle();
+  }
+  if (mm->crc_in_progress_ || cycle_roots || mm->lazy_free_num_ > 0) {
+    return Fail("the heap is in the middle of a collection");
+  }
+  if (!mm->los_blocks_.empty()) {
+    return Fail("the heap has %zu large objects", mm->los_blocks_.size());
+  }
+
+  relocs_.clear();
+  prop_maps_.clear();
+  chunks_.clear();
+  overflow_.clear();
+  visited_.clear();
+  pending_.clear();
+  Header header;
+  memset(&header, 0, sizeof(header));
+
+  for (uint32 offset = 0; offset + sizeof(TValue) <= gp_size_; offset += sizeof(TValue)) {
+    if (!AddValue(gp_ + offset, kAreaGlobals)) {
+      return false;
+    }
+  }
+  __jsobject **builtins = __jsobj_get_jsbuiltin_objects();
+  for (uint32 i = 0; i < JSBUILTIN_LAST_OBJECT; i++) {
+    if (builtins[i]) {
+      if (!Reach(builtins[i], MemHeadJSObj)) {
+        return false;
+      }
+      header.builtins[i] = mm->HeapOffset(builtins[i]) + 1;
+    }
+  }
+  if (IS_OBJECT(__js_Global_ThisBinding.x.u64) && __js_Global_ThisBinding.x.c.payload) {
+    void *global = (void *)__js_Global_ThisBinding.x.c.payload;
+    if (!Reach(global, MemHeadJSObj)) {
+      return false;
+    }
+    header.global_this = mm->HeapOffset(global) + 1;
+  }
+  if (!Walk()) {
+    return false;
+  }
+
+  for (uint32 i = 0; i < MEMHASHTABLESIZE; i++) {
+    for (MemoryChunk *chunk = mm->heap_memory_bank_->table_[i]; chunk; chunk = chunk->next) {
+      FreeChunk free_chunk = { i, chunk->offset_, chunk->size_ };
+      chunks_.push_back(free_chunk);
+    }
+  }
+  for (auto &it : mm->rc_overflow_) {
+    overflow_.push_back(std::make_pair(it.first, it.second));
+  }
+
+  uint32 page_size = (uint32)sysconf(_SC_PAGESIZE);
+  libs_[kTargetHeap].base = (uint64_t)(uintptr_t)mm->memory_;
+  libs_[kTargetGlobals].base = (uint64_t)(uintptr_t)gp_;
+  memcpy(header.magic, HEAP_IMAGE_MAGIC, sizeof(header.magic));
+  header.header_size = sizeof(Header);
+  header.page_size = page_size;
+  memcpy(header.libs, libs_, sizeof(libs_));
+  header.total_size = mm->total_size_;
+  header.total_small_size = mm->total_small_size_;
+  header.los_size = mm->los_size_;
+  header.small_end = mm->heap_free_small_offset_;
+  header.big_end = mm->heap_free_big_offset_;
+  // everything above the bump offsets reads as zero, so the sections end
+  // with the page holding them
+  header.small_size = RoundUp(header.small_end, page_size);
+  header.big_size = RoundUp(header.big_end - header.total_small_size, page_size);
+  header.free_slabs = mm->free_slabs_;
+  header.gp_size = gp_size_;
+  header.reloc_num = relocs_.size();
+  header.prop_map_num = prop_maps_.size();
+  header.chunk_num = chunks_.size();
+  header.overflow_num = overflow_.size();
+  header.zct_num = mm->zct_num_;
+  header.candidate_num = mm->crc_candidate_num_;
+  header.big_start_num = BigStartWords(header.total_small_size, header.big_end);
+  header.small_pos = RoundUp(sizeof(Header), page_size);
+  header.big_pos = header.small_pos + header.small_size;
+  header.tables_pos = header.big_pos + header.big_size;
+  memcpy(header.slab_classes, mm->slab_classes_, sizeof(header.slab_classes));
+  header.stats = mm->stats_;
+  header.global_strict = __is_global_strict;
+  return WriteFile(path, &header);
+#endif
+}
+
+// The image is written next to path and renamed over it, so a process
+// reading path never sees half of one.
+bool HeapImage::WriteFile(const char *path, Header *header) {
+  MemoryManager *mm = memory_manager;
+  std::string tmp = std::string(path) + ".tmp." + std::to_string(getpid());
+  int fd = open(tmp.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+  if (fd < 0) {
+    return Fail("cannot create %s: %s", tmp.c_str(), strerror(errno));
+  }
+  bool ok = WriteAt(fd, header, sizeof(Header), 0) &&
+            WriteAt(fd, mm->memory_, header->small_size, header->small_pos) &&
+            WriteAt(fd, (uint8_t *)mm->memory_ + header->total_small_size, header->big_size, header->big_pos);
+  struct {
+    const void *data;
+    size_t size;
+  } tables[] = {
+    { gp_, gp_size_ },
+    { relocs_.data(), relocs_.size() * sizeof(Reloc) },
+    { prop_maps_.data(), prop_maps_.size() * sizeof(PropMaps) },
+    { chunks_.data(), chunks_.size() * sizeof(FreeChunk) },
+    { overflow_.data(), overflow_.size() * sizeof(overflow_[0]) },
+    { mm->zct_, mm->zct_num_ * sizeof(uint32) },
+    { mm->crc_candidates_, mm->crc_candidate_num_ * sizeof(uint32) },
+    { mm->heap_big_starts_ + (header->total_small_size >> 7), header->big_start_num * sizeof(uint32) },
+  };
+  uint64_t pos = header->tables_pos;
+  for (auto &table : tables) {
+    ok = ok && WriteAt(fd, table.data, table.size, pos);
+    pos += table.size;
+  }
+  ok = close(fd) == 0 && ok;
+  if (!ok || rename(tmp.c_str(), path) != 0) {
+    Fail("cannot write %s: %s", path, strerror(errno));
+    unlink(tmp.c_str());
+    return false;
+  }
+  return true;
+}
+
+bool HeapImage::Read(const char *path) {
+#if !defined(MACHINE64) || !defined(MARK_CYCLE_ROOTS) || !defined(RC_NO_MMAP)
+  return Fail("heap images need a 64-bit build with MARK_CYCLE_ROOTS and RC_NO_MMAP");
+#else
+  if (!IdentifyLibrary((const void *)__jsobj_get_or_create_builtin, &libs_[kTargetRuntime])) {
+    return false;
+  }
+  int fd = open(path, O_RDONLY);
+  if (fd < 0) {
+    return Fail("cannot open %s: %s", path, strerror(errno));
+  }
+  bool ok = ReadFile(path, fd);
+  close(fd);
+  return ok;
+#endif
+}
+
+// Place the file bytes at pos over heap offsets [offset, offset + size).
+// The pages are private: they are shared with the page cache and with
+// other processes mapping the same image until written.
+bool HeapImage::Map(int fd, uint64_t pos, uint32 offset, uint32 size) {
+  if (size == 0) {
+    return true;
+  }
+  MemoryManager *mm = memory_manager;
+  void *addr = (uint8_t *)mm->memory_ + offset;
+  int flags = MAP_PRIVATE | MAP_FIXED | (mm->heap_prefault_ ? MAP_POPULATE : 0);
+  if (mmap(addr, size, PROT_READ | PROT_WRITE, flags, fd, (off_t)pos) == MAP_FAILED) {
+    // the heap reservation may already be gone under addr
+    MIR_FATAL("failed to map the heap image.\n");
+  }
+  mm->ApplyHeapPolicy(addr, size);
+  return true;
+}
+
+bool HeapImage::ReadFile(const char *path, int fd) {
+  MemoryManager *mm = memory_manager;
+  Header header;
+  if (!ReadAt(fd, &header, sizeof(header), 0) || memcmp(header.magic, HEAP_IMAGE_MAGIC, sizeof(header.magic)) != 0 ||
+      header.header_size != sizeof(Header)) {
+    return Fail("%s is not a heap image of this VM", path);
+  }
+  uint32 page_size = (uint32)sysconf(_SC_PAGESIZE);
+  if (header.page_size != page_size) {
+    return Fail("%s was written with %u-byte pages", path, header.page_size);
+  }
+  if (header.total_size != mm->total_size_ || header.total_small_size != mm->total_small_size_ ||
+      header.los_size != mm->los_size_) {
+    return Fail("%s was written for another heap size", path);
+  }
+  static const char *kLibraryNames[] = { "heap", "globals", "runtime", "module" };
+  for (uint32 t = kTargetRuntime; t < kTargetNum; t++) {
+    Library &lib = header.libs[t];
+    if (lib.size != libs_[t].size || lib.mtime != libs_[t].mtime || lib.ino != libs_[t].ino) {
+      return Fail("the %s has changed since %s was written", kLibraryNames[t], path);
+    }
+  }
+  if (header.gp_size != gp_size_) {
+    return Fail("%s was written for other module globals", path);
+  }
+  __jsobject **builtins = __jsobj_get_jsbuiltin_objects();
+  bool has_builtins = false;
+  for (uint32 i = 0; i < JSBUILTIN_LAST_OBJECT; i++) {
+    has_builtins = has_builtins || builtins[i];
+  }
+  if (mm->heap_free_small_offset_ != 0 || mm->heap_free_big_offset_ != mm->total_small_size_ || has_builtins) {
+    return Fail("the heap is in use");
+  }
+  if (header.small_end > header.small_size || header.small_size > header.total_small_size ||
+      header.big_end < header.total_small_size || header.big_end - header.total_small_size > header.big_size ||
+      header.big_size > header.total_size - header.total_small_size ||
+      header.big_start_num != BigStartWords(header.total_small_size, header.big_end)) {
+    return Fail("%s is corrupt", path);
+  }
+
+  std::vector<uint8_t> gp(header.gp_size);
+  std::vector<uint32> zct(header.zct_num);
+  std::vector<uint32> candidates(header.candidate_num);
+  std::vector<uint32> big_starts(header.big_start_num);
+  relocs_.resize(header.reloc_num);
+  prop_maps_.resize(header.prop_map_num);
+  chunks_.resize(header.chunk_num);
+  overflow_.resize(header.overflow_num);
+  struct {
+    void *data;
+    size_t size;
+  } tables[] = {
+    { gp.data(), gp.size() },
+    { relocs_.data(), relocs_.size() * sizeof(Reloc) },
+    { prop_maps_.data(), prop_maps_.size() * sizeof(PropMaps) },
+    { chunks_.data(), chunks_.size() * sizeof(FreeChunk) },
+    { overflow_.data(), overflow_.size() * sizeof(overflow_[0]) },
+    { zct.data(), zct.size() * sizeof(uint32) },
+    { candidates.data(), candidates.size() * sizeof(uint32) },
+    { big_starts.data(), big_starts.size() * sizeof(uint32) },
+  };
+  uint64_t pos = header.tables_pos;
+  for (auto &table : tables) {
+    if (!ReadAt(fd, table.data, table.size, pos)) {
+      return Fail("%s is truncated", path);
+    }
+    pos += table.size;
+  }
+  // Slots must lie in the mapped sections, so a bad image cannot write
+  // outside them.
+  auto in_image = [&header](uint32 offset, uint32 size) {
+    if (offset < header.total_small_size) {
+      return offset + size <= header.small_size;
+    }
+    return offset - header.total_small_size + size <= header.big_size;
+  };
+  for (Reloc &reloc : relocs_) {
+    bool ok = reloc.area == kAreaHeap ? in_image(reloc.offset, sizeof(uint64_t))
+                                      : (uint64_t)reloc.offset + sizeof(uint64_t) <= gp_size_;
+    if (!ok || reloc.target >= kTargetNum) {
+      return Fail("%s is corrupt", path);
+    }
+  }
+  for (PropMaps &maps : prop_maps_) {
+    if (!in_image(maps.offset, sizeof(__jsobject))) {
+      return Fail("%s is corrupt", path);
+    }
+  }
+  for (FreeChunk &chunk : chunks_) {
+    if (chunk.bucket >= MEMHASHTABLESIZE) {
+      return Fail("%s is corrupt", path);
+    }
+  }
+  for (uint32 i = 0; i < JSBUILTIN_LAST_OBJECT; i++) {
+    if (header.builtins[i] && !in_image(header.builtins[i] - 1, sizeof(__jsobject))) {
+      return Fail("%s is corrupt", path);
+    }
+  }
+  if (header.global_this && !in_image(header.global_this - 1, sizeof(__jsobject))) {
+    return Fail("%s is corrupt", path);
+  }
+
+  // Nothing fails from here on.
+  Map(fd, header.small_pos, 0, header.small_size);
+  Map(fd, header.big_pos, header.total_small_size, header.big_size);
+  mm->heap_free_small_offset_ = header.small_end;
+  mm->heap_free_big_offset_ = header.big_end;
+  memcpy(mm->heap_big_starts_ + (header.total_small_size >> 7), big_starts.data(),
+         big_starts.size() * sizeof(uint32));
+  if (mm->heap_small_committed_ < header.small_size) {
+    mm->heap_small_committed_ = header.small_size;
+  }
+  if (mm->heap_big_committed_ < header.total_small_size + header.big_size) {
+    mm->heap_big_committed_ = header.total_small_size + header.big_size;
+  }
+  mm->heap_image_big_end_ = header.total_small_size + header.big_size;
+  memcpy(mm->slab_classes_, header.slab_classes, sizeof(header.slab_classes));
+  mm->free_slabs_ = header.free_slabs;
+  // prepending in reverse keeps each list in the order it was saved
+  for (size_t i = chunks_.size(); i-- > 0;) {
+    MemoryChunk **head = &mm->heap_memory_bank_->table_[chunks_[i].bucket];
+    *head = mm->NewMemoryChunk(chunks_[i].offset, chunks_[i].size, *head);
+  }
+  for (auto &it : overflow_) {
+    mm->rc_overflow_[it.first] = it.second;
+  }
+  for (uint32 offset : zct) {
+    if (mm->zct_num_ == mm->zct_cap_) {
+      mm->GrowZct();
+    }
+    mm->zct_[mm->zct_num_++] = offset;
+  }
+  for (uint32 offset : candidates) {
+    if (mm->crc_candidate_num_ == mm->crc_candidate_cap_) {
+      mm->GrowCycleCandidates();
+    }
+    mm->crc_candidates_[mm->crc_candidate_num_++] = offset;
+  }
+  // the internal memory is this process's own
+  MemStats stats = header.stats;
+  stats.internal_used_bytes = mm->stats_.internal_used_bytes;
+  stats.internal_peak_bytes = mm->stats_.internal_peak_bytes;
+  stats.internal_mapped_bytes = mm->stats_.internal_mapped_bytes;
+  stats.internal_chunks = mm->stats_.internal_chunks;
+  mm->stats_ = stats;
+  memcpy(gp_, gp.data(), gp_size_);
+
+  // Slots pointing somewhere that moved get the difference added to their
+  // payload; with the same bases nothing is written and the pages stay
+  // shared.
+  uint64_t delta[kTargetNum];
+  libs_[kTargetHeap].base = (uint64_t)(uintptr_t)mm->memory_;
+  libs_[kTargetGlobals].base = (uint64_t)(uintptr_t)gp_;
+  for (uint32 t = 0; t < kTargetNum; t++) {
+    delta[t] = libs_[t].base - header.libs[t].base;
+  }
+  for (Reloc &reloc : relocs_) {
+    uint64_t d = delta[reloc.target];
+    if (d == 0) {
+      continue;
+    }
+    uint8_t *slot = reloc.area == kAreaHeap ? (uint8_t *)mm->memory_ + reloc.offset : gp_ + reloc.offset;
+    uint64_t v;
+    memcpy(&v, slot, sizeof(v));
+    v = (v & ~HEAP_IMAGE_PAYLOAD_MASK) | ((v + d) & HEAP_IMAGE_PAYLOAD_MASK);
+    memcpy(slot, &v, sizeof(v));
+  }
+#ifdef USE_PROP_MAP
+  for (PropMaps &maps : prop_maps_) {
+    __jsobject *obj = (__jsobject *)((uint8_t *)mm->memory_ + maps.offset);
+    __jsobj_rebuild_prop_maps(obj, (maps.maps & 1) != 0, (maps.maps & 2) != 0);
+  }
+#endif
+  for (uint32 i = 0; i < JSBUILTIN_LAST_OBJECT; i++) {
+    if (header.builtins[i]) {
+      builtins[i] = (__jsobject *)((uint8_t *)mm->memory_ + header.builtins[i] - 1);
+    }
+  }
+  if (header.global_this) {
+    __js_Global_ThisBinding = __object_value((__jsobject *)((uint8_t *)mm->memory_ + header.global_this - 1));
+    __js_ThisBinding = __js_Global_ThisBinding;
+  }
+  __is_global_strict = header.global_strict != 0;
+  return true;
+}
@@ -0,0 +1,446 @@
+/*
+ * Copyright (C) [2021] Futurewei Technologies, Inc. All rights reserved.
+ *
+ * OpenArkCompiler is licensed under the Mulan Permissive Software License v2.
+ * You can use this software according to the terms and conditions of the MulanPSL - 2.0.
+ * You may obtain a copy of MulanPSL - 2.0 at:
+ *
+ *   https://opensource.org/licenses/MulanPSL-2.0
+ *
+ * THIS SOFTWARE IS PROVIDED ON AN "AS IS" BASIS, WITHOUT WARRANTIES OF ANY KIND, EITHER
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO NON-INFRINGEMENT, MERCHANTABILITY OR
+ * FIT FOR A PARTICULAR PURPOSE.
+ * See the MulanPSL - 2.0 for more details.
+ */
+
+#include "vmheapsnapshot.h"
+#include "jsobject.h"
+#include "jsobjectinline.h"
+#include "jsvalueinline.h"
+#include "jsstring.h"
+#include "jsfunction.h"
+#include "jsdataview.h"
+
+// Node names are cut at this many characters; DevTools only shows a prefix.
+#define SNAPSHOT_NAME_LENGTH 128
+
+static const char *kSnapshotClassNames[] = {
+  "global", "Object", "Function", "Array", "String", "Boolean", "Number", "Math", "Date", "RegExp", "JSON", "Error",
+  "Arguments", "Intl.Collator", "Intl.NumberFormat", "Intl.DateTimeFormat", "(class last)", "Number", "ArrayBuffer",
+  "DataView",
+};
+
+HeapSnapshot::HeapSnapshot() : next_synthetic_id_(2) {
+  String("");
+  // Node 0 is the root of the snapshot; every root group hangs off it.
+  AddNode(nullptr, kKindSynthetic);
+  nodes_[0].name = String("(GC roots)");
+}
+
+void HeapSnapshot::BeginRoots(const char *name) {
+  RootGroup group;
+  group.name = String(name);
+  groups_.push_back(group);
+}
+
+void HeapSnapshot::AddRoot(const char *name, TValue val) {
+  if (groups_.empty()) {
+    BeginRoots("(Roots)");
+  }
+  if (!IS_NEEDRC(val.x.u64)) {
+    return;
+  }
+  groups_.back().roots.push_back(std::make_pair(name ? (int32_t)String(name) : -1, val));
+}
+
+void HeapSnapshot::AddRoots(TValue *begin, TValue *end) {
+  for (TValue *slot = begin; slot < end; slot++) {
+    AddRoot(nullptr, *slot);
+  }
+}
+
+void HeapSnapshot::AddStackRoots(TValue *begin, TValue *end) {
+  for (TValue *slot = begin; slot < end; slot++) {
+    if (IsLiveHeapRef(*slot)) {
+      AddRoot(nullptr, *slot);
+    }
+  }
+}
+
+// The heap block tag a reference of val's type must carry.
+static MemHeadTag RefTag(uint64_t v) {
+  return IS_STRING(v) ? MemHeadJSString : (IS_OBJECT(v) ? MemHeadJSObj : MemHeadEnv);
+}
+
+// Whether val names an allocated heap block of the kind its type says.  The
+// block is validated exactly before its header is read, so a word that only
+// looks like a reference never makes the snapshot read freed memory.
+bool HeapSnapshot::IsLiveHeapRef(TValue val) {
+  uint64_t v = val.x.u64;
+  if (!IS_NEEDRC(v)) {
+    return false;
+  }
+  void *addr = (void *)(uintptr_t)val.x.c.payload;
+  return memory_manager->IsHeap(addr) && memory_manager->IsHeapBlockLive(addr) &&
+         memory_manager->GetMemHeader(addr).memheadtag == RefTag(v);
+}
+
+uint32 HeapSnapshot::String(const std::string &s) {
+  auto it = string_index_.find(s);
+  if (it != string_index_.end()) {
+    return it->second;
+  }
+  uint32 index = strings_.size();
+  strings_.push_back(s);
+  string_index_[s] = index;
+  return index;
+}
+
+// Return the string table index of str converted to UTF-8.
+uint32 HeapSnapshot::JsString(__jsstring *str, uint32 max_length) {
+  std::string s;
+  uint32 length = __jsstr_get_length(str);
+  uint32 n = length < max_length ? length : max_length;
+  for (uint32 i = 0; i < n; i++) {
+    uint16_t c = __jsstr_get_char(str, i);
+    if (c < 0x80) {
+      s += (char)c;
+    } else if (c < 0x800) {
+      s += (char)(0xC0 | (c >> 6));
+      s += (char)(0x80 | (c & 0x3F));
+    } else {
+      // Lone surrogates are written as they are; the viewers tolerate it.
+      s += (char)(0xE0 | (c >> 12));
+      s += (char)(0x80 | ((c >> 6) & 0x3F));
+      s += (char)(0x80 | (c & 0x3F));
+    }
+  }
+  if (n < length) {
+    s += "...";
+  }
+  return String(s);
+}
+
+uint32 HeapSnapshot::AddNode(void *addr, uint32 kind) {
+  Node node;
+  node.addr = addr;
+  node.kind = kind;
+  node.type = kSynthetic;
+  node.name = 0;
+  node.self_size = 0;
+  node.edge_count = 0;
+  if (addr && memory_manager->IsHeap(addr)) {
+    // Heap blocks get odd ids derived from their offset, so that the same
+    // block keeps its id across snapshots until it is freed.
+    node.id = (uint64_t)memory_manager->HeapOffset(addr) * 2 + 1;
+  } else {
+    node.id = next_synthetic_id_;
+    next_synthetic_id_ += 2;
+  }
+  uint32 index = nodes_.size();
+  nodes_.push_back(node);
+  if (addr) {
+    node_index_[addr] = index;
+  }
+  return index;
+}
+
+// Return the node for a heap reference, creating it on first sight, or -1
+// if val does not point to something the snapshot can describe.
+int32_t HeapSnapshot::NodeFor(TValue val) {
+  uint64_t v = val.x.u64;
+  if (!IS_NEEDRC(v)) {
+    return -1;
+  }
+  void *addr = (void *)(uintptr_t)val.x.c.payload;
+  if (!addr) {
+    return -1;
+  }
+  auto it = node_index_.find(addr);
+  if (it != node_index_.end()) {
+    return it->second;
+  }
+  MemHeadTag tag = RefTag(v);
+  if (memory_manager->IsHeap(addr)) {
+    if (!IsLiveHeapRef(val)) {
+      return -1;
+    }
+  } else if (tag != MemHeadJSString) {
+    // Only builtin strings live outside the heap.
+    return -1;
+  }
+  switch (tag) {
+    case MemHeadJSString:
+      return AddNode(addr, kKindString);
+    case MemHeadJSObj:
+      return AddNode(addr, kKindObject);
+    default:
+      return AddNode(addr, kKindEnv);
+  }
+}
+
+void HeapSnapshot::AddEdgeTo(uint32 type, uint32 name_or_index, uint32 to) {
+  Edge edge;
+  edge.type = type;
+  edge.name_or_index = name_or_index;
+  edge.to = to;
+  edges_.push_back(edge);
+}
+
+void HeapSnapshot::AddEdge(uint32 type, uint32 name_or_index, TValue val) {
+  int32_t to = NodeFor(val);
+  if (to >= 0) {
+    AddEdgeTo(type, name_or_index, to);
+  }
+}
+
+uint32 HeapSnapshot::ObjectSize(__jsobject *obj) {
+  uint32 size = MALLOCHEADSIZE + sizeof(__jsobject);
+  for (__jsprop *prop = obj->prop_list; prop; prop = prop->next) {
+    size += MALLOCHEADSIZE + sizeof(__jsprop);
+  }
+  switch (obj->object_class) {
+    case JSARRAY:
+      if (obj->object_type == JSREGULAR_ARRAY) {
+        uint32 arrlen = (uint32)__jsval_to_number(obj->shared.array_props[0]);
+        size += MALLOCHEADSIZE + (arrlen + 1) * sizeof(TValue);
+      }
+      break;
+    case JSFUNCTION:
+      if (obj->shared.fun) {
+        size += MALLOCHEADSIZE + sizeof(__jsfunction);
+      }
+      break;
+    case JSARRAYBUFFER:
+      if (obj->shared.arrayByte) {
+        size += MALLOCHEADSIZE + (uint32)__jsval_to_number(obj->shared.arrayByte->length);
+      }
+      break;
+    default:
+      break;
+  }
+  return size;
+}
+
+void HeapSnapshot::AddObjectEdges(__jsobject *obj) {
+  for (__jsprop *prop = obj->prop_list; prop; prop = prop->next) {
+    uint32 type = kProperty;
+    uint32 name;
+    if (prop->isIndex) {
+      type = kElement;
+      name = prop->n.index;
+    } else {
+      name = JsString(prop->n.name, SNAPSHOT_NAME_LENGTH);
+    }
+    __jsprop_desc desc = prop->desc;
+    if (__has_value(desc)) {
+      AddEdge(type, name, __get_value(desc));
+    }
+    // Accessors are shown as "get x" / "set x" so they can be told apart.
+    std::string prop_name = prop->isIndex ? std::to_string(prop->n.index) : strings_[name];
+    if (__has_get(desc) && __get_get(desc)) {
+      AddEdge(kProperty, String("get " + prop_name), __object_value(__get_get(desc)));
+    }
+    if (__has_set(desc) && __get_set(desc)) {
+      AddEdge(kProperty, String("set " + prop_name), __object_value(__get_set(desc)));
+    }
+  }
+
+  if (obj->proto_is_builtin) {
+    __jsobject **builtins = __jsobj_get_jsbuiltin_objects();
+    if (obj->prototype.id < JSBUILTIN_LAST_OBJECT && builtins[obj->prototype.id]) {
+      AddEdge(kProperty, String("__proto__"), __object_value(builtins[obj->prototype.id]));
+    }
+  } else if (obj->prototype.obj) {
+    AddEdge(kProperty, String("__proto__"), __object_value(obj->prototype.obj));
+  }
+
+  switch (obj->object_class) {
+    case JSSTRING:
+      if (obj->shared.prim_string) {
+        AddEdge(kInternal, String("value"), __string_value(obj->shared.prim_string));
+      }
+      break;
+    case JSARRAY:
+      if (obj->object_type == JSREGULAR_ARRAY) {
+        TValue *array = obj->shared.array_props;
+        uint32 arrlen = (uint32)__jsval_to_number(array[0]);
+        for (uint32 i = 0; i < arrlen; i++) {
+          AddEdge(kElement, i, array[i + 1]);
+        }
+      }
+      break;
+    case JSFUNCTION: {
+      __jsfunction *fun = obj->shared.fun;
+      if (!fun) {
+        break;
+      }
+      if (fun->attrs & JSFUNCPROP_BOUND) {
+        AddEdge(kInternal, String("bound_function"), __object_value((__jsobject *)fun->fp));
+        uint32 bound_argc = ((fun->attrs >> 16) & 0xff);
+        TValue *bound_args = (TValue *)fun->env;
+        for (uint32 i = 0; bound_args && i < bound_argc; i++) {
+          AddEdge(kInternal, String("bound_argument_" + std::to_string(i)), bound_args[i]);
+        }
+      } else if (fun->env) {
+        AddEdge(kInternal, String("context"), __env_value(fun->env));
+      }
+      break;
+    }
+    default:
+      break;
+  }
+}
+
+void HeapSnapshot::AddEnvEdges(void *env) {
+#ifdef MACHINE64
+  uint64 *ptr = (uint64 *)env;
+  uint32 argnums = *(uint32 *)ptr;
+  ptr++;
+  TValue parent = {.x.u64 = *ptr};
+  if (parent.x.c.payload) {
+    AddEdge(kContext, String("(parent scope)"), __env_value((void *)parent.x.c.payload));
+  }
+  ptr++;
+  for (uint32 i = 1; i <= argnums; i++, ptr++) {
+    TValue val = {.x.u64 = *ptr};
+    AddEdge(kContext, String("var" + std::to_string(i)), val);
+  }
+#endif
+}
+
+bool HeapSnapshot::Write(const char *path) {
+  // Group nodes come right after the root so that its edges are first.
+  uint32 first_group = nodes_.size();
+  for (RootGroup &group : groups_) {
+    uint32 index = AddNode(nullptr, kKindSynthetic);
+    nodes_[index].name = group.name;
+    AddEdgeTo(kElement, index - first_group + 1, index);
+  }
+  nodes_[0].edge_count = groups_.size();
+
+  // Nodes are expanded in index order, so each node's edges are contiguous
+  // in edges_ as the format requires.
+  for (uint32 i = first_group; i < nodes_.size(); i++) {
+    uint32 edge_start = edges_.size();
+    switch (nodes_[i].kind) {
+      case kKindSynthetic: {
+        RootGroup &group = groups_[i - first_group];
+        uint32 element = 1;
+        for (auto &root : group.roots) {
+          if (root.first >= 0) {
+            AddEdge(kProperty, root.first, root.second);
+          } else {
+            AddEdge(kElement, element++, root.second);
+          }
+        }
+        break;
+      }
+      case kKindObject: {
+        __jsobject *obj = (__jsobject *)nodes_[i].addr;
+        uint32 cls = obj->object_class;
+        nodes_[i].type = cls == JSFUNCTION ? kClosure : (cls == JSREGEXP ? kRegExp : kObject);
+        nodes_[i].name = String(cls < sizeof(kSnapshotClassNames) / sizeof(kSnapshotClassNames[0])
+                                  ? kSnapshotClassNames[cls] : "Object");
+        nodes_[i].self_size = ObjectSize(obj);
+        AddObjectEdges(obj);
+        break;
+      }
+      case kKindString: {
+        __jsstring *str = (__jsstring *)nodes_[i].addr;
+        nodes_[i].type = kString;
+        nodes_[i].name = JsString(str, SNAPSHOT_NAME_LENGTH);
+        nodes_[i].self_size = __jsstr_get_bytesize(str) +
+                              (memory_manager->IsHeap(str) ? MALLOCHEADSIZE : 0);
+        break;
+      }
+      case kKindEnv: {
+        void *env = nodes_[i].addr;
+        uint32 argnums = *(uint32 *)env;
+        nodes_[i].type = kHidden;
+        nodes_[i].name = String("(closure scope)");
+        nodes_[i].self_size = MALLOCHEADSIZE + sizeof(uint64) + sizeof(void *) + argnums * sizeof(TValue);
+        AddEnvEdges(env);
+        break;
+      }
+    }
+    nodes_[i].edge_count = edges_.size() - edge_start;
+  }
+
+  FILE *out = fopen(path, "w");
+  if (!out) {
+    return false;
+  }
+  WriteJson(out);
+  bool ok = !ferror(out);
+  return fclose(out) == 0 && ok;
+}
+
+static void WriteJsonString(FILE *out, const std::string &s) {
+  fputc('"', out);
+  for (unsigned char c : s) {
+    switch (c) {
+      case '"':
+        fputs("\\\"", out);
+        break;
+      case '\\':
+        fputs("\\\\", out);
+        break;
+      case '\n':
+        fputs("\\n", out);
+        break;
+      case '\r':
+        fputs("\\r", out);
+        break;
+      case '\t':
+        fputs("\\t", out);
+        break;
+      default:
+        if (c < 0x20) {
+          fprintf(out, "\\u%04x", c);
+        } else {
+          fputc(c, out);
+        }
+    }
+  }
+  fputc('"', out);
+}
+
+void HeapSnapshot::WriteJson(FILE *out) {
+  fprintf(out,
+          "{\"snapshot\":{\"meta\":{"
+          "\"node_fields\":[\"type\",\"name\",\"id\",\"self_size\",\"edge_count\",\"trace_node_id\"],"
+          "\"node_types\":[[\"hidden\",\"array\",\"string\",\"object\",\"code\",\"closure\",\"regexp\",\"number\","
+          "\"native\",\"synthetic\",\"concatenated string\",\"sliced string\"],"
+          "\"string\",\"number\",\"number\",\"number\",\"number\"],"
+          "\"edge_fields\":[\"type\",\"name_or_index\",\"to_node\"],"
+          "\"edge_types\":[[\"context\",\"element\",\"property\",\"internal\",\"hidden\",\"shortcut\",\"weak\"],"
+          "\"string_or_number\",\"node\"],"
+          "\"trace_function_info_fields\":[\"function_id\",\"name\",\"script_name\",\"script_id\",\"line\",\"column\"],"
+          "\"trace_node_fields\":[\"id\",\"function_info_index\",\"count\",\"size\",\"children\"],"
+          "\"sample_fields\":[\"timestamp_us\",\"last_assigned_id\"],"
+          "\"location_fields\":[\"object_index\",\"script_id\",\"line\",\"column\"]},"
+          "\"node_count\":%zu,\"edge_count\":%zu,\"trace_function_count\":0},\n",
+          nodes_.size(), edges_.size());
+
+  fputs("\"nodes\":[", out);
+  for (size_t i = 0; i < nodes_.size(); i++) {
+    const Node &node = nodes_[i];
+    fprintf(out, "%s%u,%u,%llu,%u,%u,0", i ? ",\n" : "", node.type, node.name, (unsigned long long)node.id,
+            node.self_size, node.edge_count);
+  }
+  fputs("],\n\"edges\":[", out);
+  const uint32 node_field_count = 6;
+  for (size_t i = 0; i < edges_.size(); i++) {
+    const Edge &edge = edges_[i];
+    fprintf(out, "%s%u,%u,%u", i ? ",\n" : "", edge.type, edge.name_or_index, edge.to * node_field_count);
+  }
+  fputs("],\n\"trace_function_infos\":[],\"trace_tree\":[],\"samples\":[],\"locations\":[],\n\"strings\":[", out);
+  for (size_t i = 0; i < strings_.size(); i++) {
+    if (i) {
+      fputs(",\n", out);
+    }
+    WriteJsonString(out, strings_[i]);
+  }
+  fputs("]}\n", out);
+}
@@ -14,6 +14,12 @@
  */
 
 #include <string.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+#include <signal.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
 #include "vmmemory.h"
 #include "jsobject.h"
 #include "jsobjectinline.h"
@@ -25,6 +31,8 @@
 #include "securec.h"
 #include "jsdataview.h"
 #include <cmath>
+#include <iterator>
+#include <string>
 // This module performs memory management for both the app's heap space and the
 // VM's own dynamic memory space.  For memory blocks allocated in the app's
 // heap space, we rely on reference counting in order to know when a memory
@@ -36,28 +44,43 @@
 // all memory blocks allocated there are enlarged by a 32 bit header
 // (MemHeader) that precedes the memory space returned to the user program.
 //
-// In both memory spaces, MemoryChunk is used to keep track of an allocated
+// Small heap blocks (below the MemoryHash big size) come from size-class
+// slabs instead: each slab keeps a free bitmap in its header, so allocation
+// and release are O(1) and need no MemoryChunk.
+//
+// For the other blocks, MemoryChunk is used to keep track of an allocated
 // block.  When a block is being used, there does not need to be a MemoryChunk
 // to record it.  Its MemoryChunk is created only when the block is to be
 // recycled.  To recycle a block, its MemoryChunk is kept inside MemoryHash,
-// which groups them based on size. Thus, there are 2 MemoryHash instances, one
-// for the app's heap space (heap_memory_bank_) and one for the VM's own
-// dynamic memory space (vm_memory_bank_).
+// which groups them based on size (heap_memory_bank_).
+//
+// The VM's own dynamic memory space is an arena of VM_ARENA_CHUNK_SIZE
+// chunks mapped as it grows.  Blocks are carved from the newest chunk and,
+// once freed, kept on per-size free lists (vm_free_lists_) for reuse.
 //
 // MemoryChunk nodes are VM's own dynamic data structures, so their allocation
 // are in the VM's own dynamic memory space, and their re-uses are managed by
 // the VM.  The list of MemoryChunk nodes available for re-use is maintained
 // in free_memory_chunk_.
+//
+// The app's heap space is a PROT_NONE address range reserved by the caller.
+// Its small and big regions are committed in HEAP_COMMIT_GRANULE steps as
+// their bump offsets grow (CommitHeap), and large free runs are handed back
+// to the OS after cycle collection (ReleaseFreeHeap).  As no bookkeeping is
+// kept inside free heap blocks, their pages can be discarded at any time.
+// Blocks of at least LARGE_OBJECT_SIZE bytes are placed in the large-object
+// space above the heap instead, one mapping per block (LargeAlloc).  How the
+// heap pages are backed is chosen with MAPLE_HEAP_POLICY (InitHeapPolicy).
 using namespace maple;
 
-MemoryManager *memory_manager = NULL;
+VM_TLS MemoryManager *memory_manager = NULL;
 #ifdef MARK_CYCLE_ROOTS
-CycleRoot *cycle_roots = NULL;
-CycleRoot *garbage_roots = NULL;
+VM_TLS CycleRoot *cycle_roots = NULL;
+VM_TLS CycleRoot *garbage_roots = NULL;
 #else
-__jsobject *obj_list = NULL;
+VM_TLS __jsobject *obj_list = NULL;
 #endif
-bool is_sweep = false;
+VM_TLS bool is_sweep = false;
 
 void *VMMallocGC(uint32 size, MemHeadTag tag, bool init_p) {
   uint32 alignedsize = memory_manager->Bytes4Align(size);
@@ -81,6 +104,14 @@ void *VMMallocGC(uint32 size, MemHeadTag tag, bool init_p) {
   memheaderp->memheadtag = tag;
   memheaderp->refcount = 0;
   memheaderp->in_roots = false;
+  memheaderp->in_zct = false;
+  memory_manager->CountAlloc(tag, alignedsize + head_size);
+#ifdef RC_DEFER_STACK
+  // a new object may never be stored anywhere but in uncounted stack slots
+  if (tag == MemHeadJSObj || tag == MemHeadJSString || tag == MemHeadEnv || tag == MemHeadJSIter) {
+    memory_manager->ZctAdd((uint8 *)memory + head_size);
+  }
+#endif
   if (memory_manager->IsDebugGC()) {
     printf("memory %p was allocated with header %d size %d\n", ((void *)((uint8 *)memory + head_size)), tag, alignedsize);
   }
@@ -97,6 +128,8 @@ void *VMReallocGC(void *origptr, uint32 origsize, uint32 newsize) {
   uint32 alignedorigsize = memory_manager->Bytes4Align(origsize);
   uint32 alignednewsize = memory_manager->Bytes4Align(newsize);
   void *memory = memory_manager->Realloc(origptr, alignedorigsize, alignednewsize);
+  memory_manager->CountAlloc((MemHeadTag)memory_manager->GetMemHeader((uint8 *)memory + MALLOCHEADSIZE).memheadtag,
+                             alignednewsize + MALLOCHEADSIZE);
 #ifdef MM_DEBUG
   int tag = memory_manager->GetMemHeader((uint8*)memory+MALLOCHEADSIZE).memheadtag;
   memory_manager->mem_alloc_bytes_by_tag[(int)tag] += alignednewsize + MALLOCHEADSIZE;
@@ -233,116 +266,110 @@ MemoryChunk *MemoryHash::GetFreeChunk(uint32 size) {
   }
 }
 
-#if MACHINE64
-void MemoryManager::SetF64Builtin() {
-  // from 0 to 6, there are Math.E, LN10, LN2, LOG10E, LOG2E, PI, SQRT1_2, SQRT2
-  f64ToU32Vec.push_back(0);
-  f64ToU32Vec.push_back(MathE);
-  f64ToU32Vec.push_back(MathLn10);
-  f64ToU32Vec.push_back(MathLn2);
-  f64ToU32Vec.push_back(MathLog10e);
-  f64ToU32Vec.push_back(MathLog2e);
-  f64ToU32Vec.push_back(MathPi);
-  f64ToU32Vec.push_back(MathSqrt1_2);
-  f64ToU32Vec.push_back(MathSqrt2);
-  f64ToU32Vec.push_back(NumberMaxValue);
-  f64ToU32Vec.push_back(NumberMinValue);
-}
 
-#if 0
-TValue MemoryManager::GetF64Builtin(uint32_t index) {
-  assert(index <= MATH_LAST_INDEX && "error");
-  if (f64ToU32Vec.size() == 0) {
-    SetF64Builtin();
+// Size class of a VM internal block: pointer-size multiples up to
+// VM_ARENA_EXACT_SIZE, powers of two above.  The class size is returned in
+// class_size.
+static inline uint32 ArenaClass(uint32 size, uint32 *class_size) {
+  if (size <= VM_ARENA_EXACT_SIZE) {
+    uint32 aligned = (size + sizeof(void *) - 1) & ~(uint32)(sizeof(void *) - 1);
+    if (aligned == 0) {
+      aligned = sizeof(void *);
+    }
+    *class_size = aligned;
+    return aligned / sizeof(void *) - 1;
   }
-  TValue jsval;
-  jsval.ptyp = JSTYPE_DOUBLE;
-  jsval.x.u32 = index;
-  return jsval;
+  uint32 log = 32 - __builtin_clz(size - 1);
+  *class_size = 1u << log;
+  return VM_ARENA_EXACT_SIZE / sizeof(void *) + log - __builtin_ctz(VM_ARENA_EXACT_SIZE) - 1;
 }
-#endif
 
-double MemoryManager::GetF64FromU32 (uint32 index) {
-  assert(index < f64ToU32Vec.size() && "false");
-  return f64ToU32Vec[index];
+static uint32 ArenaPageAlign(uint32 size) {
+  static const uint32 page_size = (uint32)sysconf(_SC_PAGESIZE);
+  return (size + page_size - 1) / page_size * page_size;
 }
 
-#if 0
-uint32_t MemoryManager::SetF64ToU32 (double f64) {
-  // std::map<double, uint32>::iterator it = f64ToU32Map.find(f64);
-  uint32 size = f64ToU32Vec.size();
-  if (size == 0) {
-    SetF64Builtin();
-    size = f64ToU32Vec.size();
-    assert(size == MATH_LAST_INDEX + 1 && "error");
-    if (f64 == 0) {
-      return DOUBLE_ZERO_INDEX;
-    }
-    // f64ToU32Vec.push_back(f64);
-    // return f64ToU32Vec.size() - 1;
-  }
-  assert(size > MATH_LAST_INDEX && "error");
-  for (uint32 i = 0; i < size; i++) {
-    if (fabs(f64ToU32Vec[i] - f64) < NumberMinValue) {
-      return i;
-    }
-  }
-  f64ToU32Vec.push_back(f64);
-  return size;
-  /*
-  if (it == f64ToU32Map.end()) {
-    uint32 index = f64ToU32Vec.size();
-    f64ToU32Map.insert(std::pair<double, uint32>(f64, index));
-    f64ToU32Vec.push_back(f64);
-    return index;
-  } else {
-    return it->second;
+// Hand what is left of the newest chunk to the free lists, largest class
+// first, so that starting a new chunk wastes nothing.
+void MemoryManager::ArenaRecycleTail() {
+  uint32 rest = (uint32)(vm_arena_end_ - vm_arena_top_);
+  while (rest >= sizeof(void *)) {
+    uint32 size = rest <= VM_ARENA_EXACT_SIZE ? rest & ~(uint32)(sizeof(void *) - 1)
+                                              : 1u << (31 - __builtin_clz(rest));
+    if (size > VM_ARENA_MAX_BLOCK) {
+      size = VM_ARENA_MAX_BLOCK;
+    }
+    uint32 class_size;
+    uint32 c = ArenaClass(size, &class_size);
+    *(void **)vm_arena_top_ = vm_free_lists_[c];
+    vm_free_lists_[c] = vm_arena_top_;
+    vm_arena_top_ += size;
+    rest -= size;
   }
-  */
 }
-#endif
-#endif
 
-// malloc memory in VM internal memory region, re-cycled via MemoryChunk nodes
+// Carve size bytes from the newest chunk, mapping a new chunk when it is
+// used up.
+void *MemoryManager::ArenaCarve(uint32 size) {
+  if (vm_arena_top_ + size > vm_arena_end_) {
+    ArenaRecycleTail();
+    int populate = heap_prefault_ ? MAP_POPULATE : 0;
+    void *chunk = mmap(NULL, VM_ARENA_CHUNK_SIZE, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | populate, -1, 0);
+    if (chunk == MAP_FAILED) {
+      MIR_FATAL("run out of VM internal memory.\n");
+    }
+    vm_arena_top_ = (uint8 *)chunk;
+    vm_arena_end_ = vm_arena_top_ + VM_ARENA_CHUNK_SIZE;
+    vm_arena_mapped_ += VM_ARENA_CHUNK_SIZE;
+    vm_arena_chunks_++;
+    vm_arena_chunk_list_.push_back(chunk);
+  }
+  void *ptr = vm_arena_top_;
+  vm_arena_top_ += size;
+  return ptr;
+}
+
+// malloc memory in VM internal memory arena, re-cycled via the free lists
 void *MemoryManager::MallocInternal(uint32 malloc_size) {
-  uint32 alignedsize = Bytes4Align(malloc_size);
-  MemoryChunk *mchunk = vm_memory_bank_->GetFreeChunk(alignedsize);
-  void *return_ptr = NULL;
-  if (!mchunk) {
-    if (vm_memory_bank_->IsBigSize(alignedsize)) {
-      if (alignedsize + vm_free_big_offset_ > vm_memory_size_) {
-        // merge the big memory chunk
-        vm_memory_bank_->MergeBigFreeChunk();
-        mchunk = vm_memory_bank_->GetFreeChunk(malloc_size);
-        if (!mchunk) {
-          MIR_FATAL("run out of VM heap memory.\n");
-        }
-        return_ptr = (void *)((uint8 *)vm_memory_ + mchunk->offset_);
-        DeleteMemoryChunk(mchunk);
-      } else {
-        uint32 free_offset = vm_free_big_offset_;
-        vm_free_big_offset_ += alignedsize;
-        return (void *)((uint8 *)vm_memory_ + free_offset);
-      }
+  void *return_ptr;
+  uint32 size;
+  if (malloc_size > VM_ARENA_MAX_BLOCK) {
+    size = ArenaPageAlign(malloc_size);
+    return_ptr = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (return_ptr == MAP_FAILED) {
+      MIR_FATAL("run out of VM internal memory.\n");
+    }
+    vm_arena_mapped_ += size;
+    vm_big_blocks_[return_ptr] = size;
+  } else {
+    uint32 c = ArenaClass(malloc_size, &size);
+    return_ptr = vm_free_lists_[c];
+    if (return_ptr) {
+      vm_free_lists_[c] = *(void **)return_ptr;
     } else {
-      if (alignedsize + vm_free_small_offset_ > vm_memory_small_size_) {
-        MIR_FATAL("TODO run out of VM internal small memory.\n");
-      }
-      return_ptr = (void *)((char *)vm_memory_ + vm_free_small_offset_);
-      vm_free_small_offset_ += alignedsize;
+      return_ptr = ArenaCarve(size);
     }
-  } else {
-    return_ptr = (void *)((uint8 *)vm_memory_ + mchunk->offset_);
-    DeleteMemoryChunk(mchunk);
+  }
+  vm_arena_used_ += size;
+  if (vm_arena_used_ > vm_arena_peak_) {
+    vm_arena_peak_ = vm_arena_used_;
   }
   return return_ptr;
 }
 
-void MemoryManager::FreeInternal(void *addr, uint32 size) {
-  uint32 alignedsize = Bytes4Align(size);
-  uint32 offset = (uint32)((uint8 *)addr - (uint8 *)vm_memory_);
-  MemoryChunk *mchunk = NewMemoryChunk(offset, alignedsize, NULL);
-  vm_memory_bank_->PutFreeChunk(mchunk);
+void MemoryManager::FreeInternal(void *addr, uint32 free_size) {
+  uint32 size;
+  if (free_size > VM_ARENA_MAX_BLOCK) {
+    size = ArenaPageAlign(free_size);
+    munmap(addr, size);
+    vm_arena_mapped_ -= size;
+    vm_big_blocks_.erase(addr);
+  } else {
+    uint32 c = ArenaClass(free_size, &size);
+    *(void **)addr = vm_free_lists_[c];
+    vm_free_lists_[c] = addr;
+  }
+  vm_arena_used_ -= size;
 }
 
 void MemoryManager::ReleaseVariables(uint8_t *base, uint8_t *typetagged, uint8_t *refcounted, uint32_t size,
@@ -375,6 +402,8 @@ void MemoryManager::DumpMMStats() {
 #ifdef MM_RC_STATS
   DumpRCStats();
 #endif
+  DumpSlabStats();
+  DumpCRCStats();
 }
 
 // A VM self-check for memory-leak.
@@ -428,12 +457,13 @@ void MemoryManager::AppMemLeakCheck() {
 #endif
 
   printf("\nChecking mem leak...\n");
-  printf("Size of cycle_candidate_roots= %lu\n", crc_candidate_roots.size());
+  printf("Size of cycle_candidate_roots= %u\n", crc_candidate_num_);
 
   printf("Releasing builtin, app_mem_usage= %u alloc= %u release= %u max= %u\n", app_mem_usage, mem_allocated, mem_released, max_app_mem_usage);
   uint32 released_b4 = mem_released;
 
   __jsobj_release_builtin();
+  DrainLazyFree(UINT32_MAX);
 
   printf("After releasing builtin, app_mem_usage= %u alloc= %u release= %u max= %u\n", app_mem_usage, mem_allocated, mem_released, max_app_mem_usage);
   printf("  Released builtin: %u B\n", mem_released - released_b4);
@@ -443,16 +473,18 @@ void MemoryManager::AppMemLeakCheck() {
   size_t live_objs_b4 =  live_objects.size();
 
   BatchRCDec(mainSP, mainFP);
+  DrainLazyFree(UINT32_MAX);
 
   printf("After releasing main(), app_mem_usage= %u alloc= %u release= %u max= %u\n", app_mem_usage, mem_allocated, mem_released, max_app_mem_usage);
   printf("  Released main() variables: %u B released objects= %lu\n", mem_released - released_b4, live_objs_b4 - live_objects.size());
 
   printf("Releasing global variables\n");
   BatchRCDec(mainGP, mainTopGP);
+  DrainLazyFree(UINT32_MAX);
 
   DumpAllocReleaseStats();
 
-  printf("After builtin, main, global, size of cycle_candidate_roots= %lu\n", crc_candidate_roots.size());
+  printf("After builtin, main, global, size of cycle_candidate_roots= %u\n", crc_candidate_num_);
 
   //------------------------------------------------
   //live objects
@@ -514,8 +546,8 @@ void MemoryManager::AppMemLeakCheck() {
 void MemoryManager::AppMemUsageSummary() {
   printf("\n");
   printf("[Memory Manager] max app heap memory usage is %d Bytes\n", app_mem_usage);
-  printf("[Memory Manager] vm internal memory usage is %d Bytes\n\n",
-         vm_free_small_offset_ + (vm_free_big_offset_ - vm_memory_small_size_));
+  printf("[Memory Manager] vm internal memory usage is %lu Bytes (peak %lu, mapped %lu)\n\n",
+         (unsigned long)vm_arena_used_, (unsigned long)vm_arena_peak_, (unsigned long)vm_arena_mapped_);
 }
 
 void MemoryManager::AppMemAccessSummary() {
@@ -618,12 +650,7 @@ MemoryChunk *MemoryManager::NewMemoryChunk(uint32 offset, uint32 size, MemoryChu
     new_chunk = free_memory_chunk_;
     free_memory_chunk_ = new_chunk->next;
   } else {
-    // new_chunk = (MemoryChunk *) MallocInternal(sizeof(MemoryChunk));
-    new_chunk = (MemoryChunk *)((uint8 *)vm_memory_ + vm_free_small_offset_);
-    vm_free_small_offset_ += Bytes4Align(sizeof(MemoryChunk));
-    if (vm_free_small_offset_ > vm_memory_small_size_) {
-      MIR_FATAL("TODO run out of VM internal memory.\n");
-    }
+    new_chunk = (MemoryChunk *)MallocInternal(sizeof(MemoryChunk));
   }
   new_chunk->offset_ = offset;
   new_chunk->size_ = size;
@@ -631,43 +658,125 @@ MemoryChunk *MemoryManager::NewMemoryChunk(uint32 offset, uint32 size, MemoryChu
   return new_chunk;
 }
 
-void MemoryManager::Init(void *app_memory, uint32 app_memory_size, void *vm_memory, uint32 vm_memory_size) {
+// Every isolate has its own memory manager, which may be disposed of on
+// another thread at any time, so the handler touches no manager: it only
+// bumps a count that each manager compares with the last one it handled.
+std::atomic<uint32> mem_signal_count(0);
+
+// SIGUSR2 only flags the requests; the statistics are dumped at the next
+// allocation and the heap snapshot is written at the next interpreter safe
+// point.
+static void MemSignalHandler(int) {
+  mem_signal_count.fetch_add(1, std::memory_order_relaxed);
+}
+
+MemoryManager::~MemoryManager() {
+  for (std::map<void *, uint32>::iterator it = vm_big_blocks_.begin(); it != vm_big_blocks_.end(); it++) {
+    munmap(it->first, it->second);
+  }
+  for (uint32 i = 0; i < vm_arena_chunk_list_.size(); i++) {
+    munmap(vm_arena_chunk_list_[i], VM_ARENA_CHUNK_SIZE);
+  }
+  munmap(heap_big_starts_, total_size_ / 32);
+}
+
+void MemoryManager::Init(void *app_memory, uint32 app_memory_size, uint32 los_size) {
   memory_ = app_memory;
   total_small_size_ = app_memory_size / 2;
 #if DEBUGGC
-  assert((total_small_size_ % 4) == 0 && (VM_MEMORY_SIZE % 4) == 0 && "make sure HEAP SIZE is aligned to 4B");
+  assert((total_small_size_ % 4) == 0 && "make sure HEAP SIZE is aligned to 4B");
 #endif
   total_size_ = app_memory_size;
-  heap_end = (void *)((uint8 *)memory_ + app_memory_size);
-  vm_memory_ = vm_memory;
-  vm_memory_size_ = vm_memory_size;
-  vm_memory_small_size_ = VM_MEMORY_SMALL_SIZE;
-  vm_free_small_offset_ = 0;
-  vm_free_big_offset_ = vm_memory_small_size_;
+  heap_end = (void *)((uint8 *)memory_ + app_memory_size + los_size);
+  los_size_ = los_size;
+  los_blocks_.clear();
+  los_free_.clear();
+  if (los_size > 0) {
+    los_free_[app_memory_size] = los_size;
+  }
+  los_mapped_ = 0;
+  vm_arena_top_ = NULL;
+  vm_arena_end_ = NULL;
+  for (uint32 i = 0; i < VM_ARENA_FREE_LISTS; i++) {
+    vm_free_lists_[i] = NULL;
+  }
+  vm_arena_used_ = 0;
+  vm_arena_peak_ = 0;
+  vm_arena_mapped_ = 0;
+  vm_arena_chunks_ = 0;
   heap_free_small_offset_ = 0;
 
   heap_free_big_offset_ = total_small_size_;
+  heap_small_committed_ = 0;
+  heap_big_committed_ = total_small_size_;
+  heap_released_size_ = 0;
+  heap_image_big_end_ = 0;
+  // only the words covering the big region are ever touched
+  heap_big_starts_ = (uint32 *)mmap(NULL, total_size_ / 32, PROT_READ | PROT_WRITE,
+                                    MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+  if (heap_big_starts_ == MAP_FAILED) {
+    MIR_FATAL("failed to map the big block start bits");
+  }
+  uint32 page_size = (uint32)sysconf(_SC_PAGESIZE);
+  heap_commit_granule_ = (HEAP_COMMIT_GRANULE + page_size - 1) / page_size * page_size;
+  InitHeapPolicy(app_memory_size + los_size);
+  InitSlabClasses();
   free_memory_chunk_ = NULL;
 
   crc_alloc_size = 0;
+  zct_ = NULL;
+  zct_num_ = 0;
+  zct_cap_ = 0;
+  zct_peak_ = 0;
+  zct_limit_ = ZCT_RECONCILE_SIZE;
+  rc_safepoint_pending_ = false;
+  crc_collect_pending_ = false;
+  rc_reconciling_ = false;
+  rc_overflow_.clear();
+  rc_overflow_peak_ = 0;
+  lazy_free_ = NULL;
+  lazy_free_num_ = 0;
+  lazy_free_cap_ = 0;
+  lazy_free_peak_ = 0;
+  lazy_freeing_ = false;
+  crc_candidates_ = NULL;
+  crc_candidate_num_ = 0;
+  crc_candidate_cap_ = 0;
+  crc_candidate_peak_ = 0;
+  crc_trigger_size_ = CRC_TRIGGER_BY_ALLOC_SIZE;
+  crc_pause_budget_us_ = CRC_PAUSE_BUDGET_US;
+  const char *pause_env = getenv("MAPLE_GC_PAUSE_US");
+  if (pause_env != nullptr && atoi(pause_env) > 0) {
+    crc_pause_budget_us_ = atoi(pause_env);
+  }
+  crc_slice_roots_ = 256;
+  crc_freed_size_ = 0;
+  memset(&stats_, 0, sizeof(stats_));
+  stats_dump_enabled_ = getenv("MAPLE_MEM_STATS") != nullptr;
+  heap_snapshot_prefix_ = getenv("MAPLE_HEAP_SNAPSHOT");
+  heap_snapshot_count_ = 0;
+  // signals sent before this manager existed are not for it
+  stats_dump_seen_ = heap_snapshot_seen_ = mem_signal_count.load(std::memory_order_relaxed);
+  if (stats_dump_enabled_ || heap_snapshot_prefix_) {
+    signal(SIGUSR2, MemSignalHandler);
+  }
+  crc_in_progress_ = false;
+  crc_num_pauses_ = 0;
+  crc_total_pause_us_ = 0;
+  crc_max_pause_us_ = 0;
+  for (uint32 i = 0; i < CRC_PAUSE_BUCKETS; i++) {
+    crc_pause_histogram_[i] = 0;
+  }
 #ifndef RC_NO_MMAP
   free_mmaps_ = NULL;
   free_mmap_nodes_ = NULL;
 #endif
   // avail_link_ = NewMemoryChunk(0, app_memory_size, NULL);
-  heap_memory_bank_ = (MemoryHash *)((uint8 *)vm_memory_ + vm_free_small_offset_);
-  uint32 alignedsize = Bytes4Align(sizeof(MemoryHash));
-  vm_free_small_offset_ += alignedsize;
-  errno_t mem_ret1 = memset_s(heap_memory_bank_, alignedsize, 0, alignedsize);
+  heap_memory_bank_ = (MemoryHash *)MallocInternal(sizeof(MemoryHash));
+  errno_t mem_ret1 = memset_s(heap_memory_bank_, sizeof(MemoryHash), 0, sizeof(MemoryHash));
   if (mem_ret1 != EOK) {
     MIR_FATAL("call memset_s firstly failed in MemoryManager::Init");
   }
-  vm_memory_bank_ = (MemoryHash *)((uint8 *)vm_memory_ + vm_free_small_offset_);
-  vm_free_small_offset_ += alignedsize;
-  errno_t mem_ret2 = memset_s(vm_memory_bank_, alignedsize, 0, alignedsize);
-  if (mem_ret2 != EOK) {
-    MIR_FATAL("call memset_s secondly failed in MemoryManager::Init");
-  }
 
 #ifdef MM_DEBUG
   app_mem_usage = 0;
@@ -690,10 +799,497 @@ void MemoryManager::Init(void *app_memory, uint32 app_memory_size, void *vm_memo
   num_rcinc = 0;
   num_rcdec = 0;
 #endif  // MM_DEBUG
-#ifdef MACHINE64
-  addrMap.push_back(NULL);
-  addrOffset = addrMap.size();
+}
+
+// Make the heap pages in [committed, end) readable and writable.  A region
+// grows by whole granules, clamped to its limit, so most bump allocations
+// never reach the system call.
+void MemoryManager::CommitHeap(uint32 &committed, uint32 end, uint32 limit) {
+  if (end <= committed) {
+    return;
+  }
+  uint32 newend = (end + heap_commit_granule_ - 1) / heap_commit_granule_ * heap_commit_granule_;
+  if (newend > limit) {
+    newend = limit;
+  }
+  if (mprotect((uint8 *)memory_ + committed, newend - committed, PROT_READ | PROT_WRITE) != 0) {
+    MIR_FATAL("failed to commit VM heap memory.\n");
+  }
+  if (heap_prefault_) {
+    PrefaultHeap((uint8 *)memory_ + committed, newend - committed);
+  }
+  committed = newend;
+}
+
+#ifndef MADV_POPULATE_WRITE
+#define MADV_POPULATE_WRITE 23
+#endif
+#ifndef MPOL_LOCAL
+#define MPOL_LOCAL 4
 #endif
+
+// MAPLE_HEAP_POLICY is a comma separated list of
+//   hugepage       back the heap with transparent huge pages, committed
+//                  HEAP_HUGE_PAGE_SIZE at a time, to cut TLB misses
+//   prefault[=MB]  populate heap pages when they are committed instead of
+//                  faulting them in one by one, and commit MB of each heap
+//                  region at start-up
+//   numa-local     allocate heap pages on the NUMA node of the thread that
+//                  first touches them, whatever the process policy says
+// The policy covers the heap and the large-object space; internal arena
+// chunks are populated as well with prefault.
+void MemoryManager::InitHeapPolicy(uint32 reserved_size) {
+  heap_hugepage_ = false;
+  heap_prefault_ = false;
+  heap_numa_local_ = false;
+  uint32 prefault_size = 0;
+  const char *policy_env = getenv("MAPLE_HEAP_POLICY");
+  if (policy_env == nullptr) {
+    return;
+  }
+  std::string policy(policy_env);
+  size_t pos = 0;
+  while (pos <= policy.size()) {
+    size_t end = policy.find(',', pos);
+    if (end == std::string::npos) {
+      end = policy.size();
+    }
+    std::string item = policy.substr(pos, end - pos);
+    if (item == "hugepage") {
+      heap_hugepage_ = true;
+    } else if (item == "prefault" || item.compare(0, 9, "prefault=") == 0) {
+      heap_prefault_ = true;
+      if (item.size() > 9) {
+        prefault_size = (uint32)atoi(item.c_str() + 9) * 1024 * 1024;
+      }
+    } else if (item == "numa-local") {
+      heap_numa_local_ = true;
+    } else if (!item.empty()) {
+      fprintf(stderr, "MAPLE_HEAP_POLICY: unknown option %s\n", item.c_str());
+    }
+    pos = end + 1;
+  }
+  if (heap_hugepage_ && heap_commit_granule_ < HEAP_HUGE_PAGE_SIZE) {
+    heap_commit_granule_ = HEAP_HUGE_PAGE_SIZE;
+  }
+  ApplyHeapPolicy(memory_, reserved_size);
+  if (prefault_size > 0) {
+    uint32 small_end = prefault_size < total_small_size_ ? prefault_size : total_small_size_;
+    uint32 big_end = total_small_size_ + prefault_size < total_size_ ? total_small_size_ + prefault_size : total_size_;
+    CommitHeap(heap_small_committed_, small_end, total_small_size_);
+    CommitHeap(heap_big_committed_, big_end, total_size_);
+  }
+}
+
+// Set the huge page and NUMA advice on a heap range.  A fresh mapping placed
+// over part of the reservation (the large-object space) needs it again.
+void MemoryManager::ApplyHeapPolicy(void *addr, uint32 size) {
+  if (heap_hugepage_ && madvise(addr, size, MADV_HUGEPAGE) != 0) {
+    fprintf(stderr, "MAPLE_HEAP_POLICY: transparent huge pages are not available\n");
+    heap_hugepage_ = false;
+  }
+  if (heap_numa_local_ && syscall(SYS_mbind, addr, (unsigned long)size, MPOL_LOCAL, NULL, 0UL, 0U) != 0) {
+    fprintf(stderr, "MAPLE_HEAP_POLICY: cannot set the NUMA policy of the heap\n");
+    heap_numa_local_ = false;
+  }
+}
+
+// Fault in the (zero) pages of a freshly committed range in one go.
+void MemoryManager::PrefaultHeap(void *addr, uint32 size) {
+  if (madvise(addr, size, MADV_POPULATE_WRITE) == 0) {
+    return;
+  }
+  // kernels before 5.14: touch every page, the range is known to be zero
+  static const uint32 page_size = (uint32)sysconf(_SC_PAGESIZE);
+  for (uint32 i = 0; i < size; i += page_size) {
+    ((volatile uint8 *)addr)[i] = 0;
+  }
+}
+
+static uint32 HeapPageSize() {
+  static const uint32 page_size = (uint32)sysconf(_SC_PAGESIZE);
+  return page_size;
+}
+
+// Drop the whole pages inside heap offsets [begin, end); they read back as
+// zero.  Returns the number of bytes released.
+static uint32 DiscardHeapPages(void *base, uint32 begin, uint32 end) {
+  uint32 page_size = HeapPageSize();
+  begin = (begin + page_size - 1) / page_size * page_size;
+  end = end / page_size * page_size;
+  if (begin >= end) {
+    return 0;
+  }
+  if (madvise((uint8 *)base + begin, end - begin, MADV_DONTNEED) != 0) {
+    memset((uint8 *)base + begin, 0, end - begin);
+    return 0;
+  }
+  return end - begin;
+}
+
+// Hand free heap memory back to the OS.  The big free chunks are merged first;
+// a run ending at the big bump offset is returned to the bump region, and the
+// interior pages of any other run of at least HEAP_RELEASE_THRESHOLD bytes are
+// discarded.  The pages stay committed and fault back in zero-filled.
+void MemoryManager::ReleaseFreeHeap() {
+  heap_memory_bank_->MergeBigFreeChunk();
+  heap_released_size_ = 0;
+  MemoryChunk **link = &heap_memory_bank_->table_[MEMHASHTABLESIZE - 1];
+  while (MemoryChunk *node = *link) {
+    uint32 begin = node->offset_;
+    uint32 end = node->offset_ + node->size_;
+    if (end == heap_free_big_offset_) {
+      // bump allocations are handed out without memset, so everything above
+      // the big bump offset must read as zero: clear the partial page in
+      // front of the discarded range by hand
+      heap_free_big_offset_ = begin;
+      *link = node->next;
+      DeleteMemoryChunk(node);
+      uint32 page_end = (begin + HeapPageSize() - 1) / HeapPageSize() * HeapPageSize();
+      memset((uint8 *)memory_ + begin, 0, page_end - begin);
+      if (page_end < heap_image_big_end_) {
+        // discarded pages of a heap image read back as the image
+        memset((uint8 *)memory_ + page_end, 0, heap_image_big_end_ - page_end);
+        page_end = heap_image_big_end_;
+      }
+      heap_released_size_ += DiscardHeapPages(memory_, page_end, heap_big_committed_);
+      break;
+    }
+    if (node->size_ >= HEAP_RELEASE_THRESHOLD) {
+      heap_released_size_ += DiscardHeapPages(memory_, begin, end);
+    }
+    link = &node->next;
+  }
+}
+
+// The large-object space is the address range [total_size_, total_size_ +
+// los_size_) right above the heap, so IsHeap() and HeapOffset() cover it as
+// well.  The range stays reserved PROT_NONE, and each large block is its own
+// anonymous mapping of whole pages placed over it: the pages come in
+// zero-filled, go straight back to the OS when the block is freed, and a
+// resize moves the pages with mremap instead of copying them.  Free ranges
+// are kept coalesced in los_free_.
+
+static uint32 LargePageAlign(uint32 size) {
+  return (size + HeapPageSize() - 1) / HeapPageSize() * HeapPageSize();
+}
+
+// Take len bytes of address space, first fit.  Returns 0 when the space is
+// exhausted; offset 0 is never part of it.
+uint32 MemoryManager::LargeTake(uint32 len) {
+  for (auto it = los_free_.begin(); it != los_free_.end(); ++it) {
+    if (it->second >= len) {
+      uint32 offset = it->first;
+      uint32 rest = it->second - len;
+      los_free_.erase(it);
+      if (rest > 0) {
+        los_free_[offset + len] = rest;
+      }
+      return offset;
+    }
+  }
+  return 0;
+}
+
+// Unmap [offset, offset + len), keeping the address range reserved, and
+// merge it into the free ranges.
+void MemoryManager::LargeGive(uint32 offset, uint32 len) {
+  if (mmap((uint8 *)memory_ + offset, len, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE | MAP_FIXED, -1,
+           0) == MAP_FAILED) {
+    MIR_FATAL("failed to unmap a large object.\n");
+  }
+  auto next = los_free_.lower_bound(offset);
+  if (next != los_free_.end() && offset + len == next->first) {
+    len += next->second;
+    next = los_free_.erase(next);
+  }
+  if (next != los_free_.begin()) {
+    auto prev = std::prev(next);
+    if (prev->first + prev->second == offset) {
+      prev->second += len;
+      return;
+    }
+  }
+  los_free_[offset] = len;
+}
+
+// Map a block of size bytes in the large-object space.  Returns NULL when
+// the space is exhausted, and the caller falls back to the big region.
+void *MemoryManager::LargeAlloc(uint32 size) {
+  uint32 len = LargePageAlign(size);
+  uint32 offset = LargeTake(len);
+  if (offset == 0) {
+    return NULL;
+  }
+  void *addr = (uint8 *)memory_ + offset;
+  if (mmap(addr, len, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_FIXED, -1, 0) == MAP_FAILED) {
+    LargeGive(offset, len);
+    return NULL;
+  }
+  ApplyHeapPolicy(addr, len);
+  if (heap_prefault_) {
+    PrefaultHeap(addr, len);
+  }
+  los_blocks_[offset] = len;
+  los_mapped_ += len;
+  return addr;
+}
+
+void MemoryManager::LargeFree(uint32 offset) {
+  auto it = los_blocks_.find(offset);
+  if (it == los_blocks_.end()) {
+    MIR_FATAL("free of an unknown large object.\n");
+  }
+  uint32 len = it->second;
+  los_blocks_.erase(it);
+  los_mapped_ -= len;
+  LargeGive(offset, len);
+}
+
+// Resize the large block holding mem: shrink by unmapping its tail, grow in
+// place over a free range right behind it, or else move its pages to a new
+// range with mremap.  Returns the new block, or NULL if no range is big
+// enough.
+void *MemoryManager::LargeRealloc(void *mem, uint32 origsize, uint32 newsize) {
+  uint8 *block = (uint8 *)mem - MALLOCHEADSIZE;
+  uint32 offset = HeapOffset(block);
+  uint32 len = los_blocks_[offset];
+  uint32 newlen = LargePageAlign(newsize + MALLOCHEADSIZE);
+  if (newlen < len) {
+    LargeGive(offset + newlen, len - newlen);
+  } else if (newlen > len) {
+    auto next = los_free_.find(offset + len);
+    if (next != los_free_.end() && next->second >= newlen - len) {
+      uint32 rest = next->second - (newlen - len);
+      los_free_.erase(next);
+      if (rest > 0) {
+        los_free_[offset + newlen] = rest;
+      }
+      if (mmap(block + len, newlen - len, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_FIXED, -1, 0) ==
+          MAP_FAILED) {
+        LargeGive(offset + len, newlen - len);
+        return NULL;
+      }
+      ApplyHeapPolicy(block + len, newlen - len);
+    } else {
+      uint32 newoffset = LargeTake(newlen);
+      if (newoffset == 0) {
+        return NULL;
+      }
+      uint8 *newblock = (uint8 *)memory_ + newoffset;
+      if (mremap(block, len, newlen, MREMAP_MAYMOVE | MREMAP_FIXED, newblock) == MAP_FAILED) {
+        LargeGive(newoffset, newlen);
+        return NULL;
+      }
+      // mremap left a hole where the block was; reserve it again
+      los_blocks_.erase(offset);
+      LargeGive(offset, len);
+      LargeRelocate(mem, newblock + MALLOCHEADSIZE);
+      offset = newoffset;
+      block = newblock;
+    }
+  }
+  los_mapped_ = los_mapped_ - len + newlen;
+  los_blocks_[offset] = newlen;
+  // the old pages may hold stale bytes past origsize; the new ones are zero
+  uint32 stale_end = len - MALLOCHEADSIZE < newsize ? len - MALLOCHEADSIZE : newsize;
+  if (stale_end > origsize) {
+    memset(block + MALLOCHEADSIZE + origsize, 0, stale_end - origsize);
+  }
+  return block;
+}
+
+// Re-key the side tables of a large block whose pages moved from the
+// object at |from| to |to|.
+void MemoryManager::LargeRelocate(void *from, void *to) {
+  MemHeader &header = GetMemHeader(to);
+  uint32 from_offset = HeapOffset(from);
+  uint32 to_offset = HeapOffset(to);
+  if (header.refcount == UINT14_MAX) {
+    auto it = rc_overflow_.find(from_offset);
+    if (it != rc_overflow_.end()) {
+      uint32 count = it->second;
+      rc_overflow_.erase(it);
+      rc_overflow_[to_offset] = count;
+    }
+  }
+  if (header.in_zct) {
+    for (uint32 i = 0; i < zct_num_; i++) {
+      if (zct_[i] == from_offset) {
+        zct_[i] = to_offset;
+      }
+    }
+  }
+  if (header.in_roots) {
+    for (uint32 i = 0; i < crc_candidate_num_; i++) {
+      if (crc_candidates_[i] == from_offset) {
+        crc_candidates_[i] = to_offset;
+      }
+    }
+  }
+}
+
+// Build the size classes: 4-byte steps up to 64 bytes, then eight classes
+// per power of two up to the MemoryHash big size.
+void MemoryManager::InitSlabClasses() {
+  uint32 num = 0;
+  uint32 size = 0;
+  while (size < (MEMHASHTABLESIZE << 2)) {
+    size += size < 64 ? 4 : size < 128 ? 8 : size < 256 ? 16 : size < 512 ? 32 : 64;
+    uint32 n = (SLAB_SIZE - sizeof(Slab)) / size;
+    while (sizeof(Slab) + ((n + 31) >> 5) * 4 + n * size > SLAB_SIZE) {
+      n--;
+    }
+    SlabClass &cls = slab_classes_[num++];
+    cls.size = size;
+    cls.num_blocks = n;
+    cls.first = sizeof(Slab) + ((n + 31) >> 5) * 4;
+    cls.partial = SLAB_NIL;
+    cls.num_slabs = 0;
+    cls.live_blocks = 0;
+    cls.live_bytes = 0;
+  }
+  assert(num == SLAB_NUM_CLASSES && "size class table mismatch");
+  uint32 c = 0;
+  for (uint32 i = 0; i < MEMHASHTABLESIZE; i++) {
+    while (slab_classes_[c].size < (i << 2)) {
+      c++;
+    }
+    slab_class_index_[i] = c;
+  }
+  free_slabs_ = SLAB_NIL;
+}
+
+// Get an empty slab for size class c and put it at the head of the class's
+// partial list.  Returns SLAB_NIL when the small region is exhausted.
+uint32 MemoryManager::NewSlab(uint32 c) {
+  uint32 offset = free_slabs_;
+  if (offset != SLAB_NIL) {
+    free_slabs_ = SlabAt(offset)->next;
+  } else {
+    if (heap_free_small_offset_ + SLAB_SIZE > total_small_size_) {
+      // try to use big size heap space if it has not been used
+      if (heap_free_big_offset_ == total_small_size_ &&
+          heap_free_big_offset_ < total_size_ - (1024 * 1024)) {
+        total_small_size_ += 1024 * 1024;
+        heap_free_big_offset_ = total_small_size_;
+        if (heap_big_committed_ < total_small_size_) {
+          heap_big_committed_ = total_small_size_;
+        }
+      } else {
+        return SLAB_NIL;
+      }
+    }
+    offset = heap_free_small_offset_;
+    heap_free_small_offset_ += SLAB_SIZE;
+    CommitHeap(heap_small_committed_, heap_free_small_offset_, total_small_size_);
+  }
+  SlabClass &cls = slab_classes_[c];
+  Slab *slab = SlabAt(offset);
+  slab->prev = SLAB_NIL;
+  slab->next = cls.partial;
+  if (cls.partial != SLAB_NIL) {
+    SlabAt(cls.partial)->prev = offset;
+  }
+  cls.partial = offset;
+  slab->size_class = c;
+  slab->num_free = cls.num_blocks;
+  slab->hint = 0;
+  uint32 *bitmap = (uint32 *)(slab + 1);
+  uint32 words = (cls.num_blocks + 31) >> 5;
+  memset(bitmap, 0xff, words * 4);
+  if (cls.num_blocks & 31) {
+    bitmap[words - 1] = (1u << (cls.num_blocks & 31)) - 1;
+  }
+  cls.num_slabs++;
+  return offset;
+}
+
+void *MemoryManager::SlabAlloc(uint32 size) {
+  SlabClass &cls = slab_classes_[slab_class_index_[size >> 2]];
+  uint32 offset = cls.partial;
+  if (offset == SLAB_NIL) {
+    offset = NewSlab(slab_class_index_[size >> 2]);
+    if (offset == SLAB_NIL) {
+      return NULL;
+    }
+  }
+  Slab *slab = SlabAt(offset);
+  uint32 *bitmap = (uint32 *)(slab + 1);
+  uint32 w = slab->hint;
+  while (bitmap[w] == 0) {
+    w++;
+  }
+  uint32 bit = __builtin_ctz(bitmap[w]);
+  bitmap[w] &= ~(1u << bit);
+  slab->hint = w;
+  if (--slab->num_free == 0) {
+    // a full slab leaves the partial list until one of its blocks is freed
+    cls.partial = slab->next;
+    if (cls.partial != SLAB_NIL) {
+      SlabAt(cls.partial)->prev = SLAB_NIL;
+    }
+  }
+  cls.live_blocks++;
+  cls.live_bytes += size;
+  return (uint8 *)slab + cls.first + ((w << 5) + bit) * cls.size;
+}
+
+// Free the slab block at heap offset |offset|; |size| is the requested size.
+void MemoryManager::SlabFree(uint32 offset, uint32 size) {
+  uint32 slab_offset = offset & ~(uint32)(SLAB_SIZE - 1);
+  Slab *slab = SlabAt(slab_offset);
+  SlabClass &cls = slab_classes_[slab->size_class];
+  uint32 index = (offset - slab_offset - cls.first) / cls.size;
+  uint32 *bitmap = (uint32 *)(slab + 1);
+#ifdef MM_DEBUG
+  assert(!(bitmap[index >> 5] & (1u << (index & 31))) && "double free");
+#endif
+  bitmap[index >> 5] |= 1u << (index & 31);
+  if ((index >> 5) < slab->hint) {
+    slab->hint = index >> 5;
+  }
+  cls.live_blocks--;
+  cls.live_bytes -= size;
+  if (slab->num_free++ == 0) {
+    slab->prev = SLAB_NIL;
+    slab->next = cls.partial;
+    if (cls.partial != SLAB_NIL) {
+      SlabAt(cls.partial)->prev = slab_offset;
+    }
+    cls.partial = slab_offset;
+  } else if (slab->num_free == cls.num_blocks && slab_offset != cls.partial) {
+    // keep the head slab to avoid churn, hand other empty slabs to all classes
+    SlabAt(slab->prev)->next = slab->next;
+    if (slab->next != SLAB_NIL) {
+      SlabAt(slab->next)->prev = slab->prev;
+    }
+    slab->next = free_slabs_;
+    free_slabs_ = slab_offset;
+    cls.num_slabs--;
+  }
+}
+
+// Per size class occupancy.  Internal waste is the rounding of requests up to
+// the class size; external waste is free blocks plus slab tails and headers.
+void MemoryManager::DumpSlabStats() {
+  uint32 num_free_slabs = 0;
+  for (uint32 offset = free_slabs_; offset != SLAB_NIL; offset = SlabAt(offset)->next) {
+    num_free_slabs++;
+  }
+  printf("[SLAB] slab_size= %u free_slabs= %u\n", SLAB_SIZE, num_free_slabs);
+  for (uint32 c = 0; c < SLAB_NUM_CLASSES; c++) {
+    SlabClass &cls = slab_classes_[c];
+    if (cls.num_slabs == 0) {
+      continue;
+    }
+    uint32 capacity = cls.num_slabs * cls.num_blocks;
+    uint32 internal = cls.live_blocks * cls.size - cls.live_bytes;
+    uint32 external = cls.num_slabs * SLAB_SIZE - cls.live_blocks * cls.size;
+    printf("[SLAB] size= %4u slabs= %6u live= %8u free= %8u occupancy= %6.2f%% internal= %u external= %u\n",
+           cls.size, cls.num_slabs, cls.live_blocks, capacity - cls.live_blocks,
+           100.0 * cls.live_blocks / capacity, internal, external);
+  }
 }
 
 void *MemoryManager::Malloc(uint32 size, bool init_p) {
@@ -709,46 +1305,81 @@ void *MemoryManager::Malloc(uint32 size, bool init_p) {
 #if DEBUGGC
   assert((IsAlignedBy4(size)) && "memory doesn't align by 4 bytes");
 #endif
+  if (StatsDumpPending()) {
+    stats_dump_seen_ = mem_signal_count.load(std::memory_order_relaxed);
+    DumpMemStats(stderr);
+  }
+  if (lazy_free_num_ > 0) {
+    DrainLazyFree(LAZY_FREE_STEP);
+  }
   crc_alloc_size += size;
-  if (crc_alloc_size > CRC_TRIGGER_BY_ALLOC_SIZE) {
+  if (crc_alloc_size > crc_trigger_size_ && !crc_in_progress_) {
     crc_alloc_size = 0;
-    RecallCycle();
+    if (CanCollect()) {
+      IncrementalRecallCycle();
+      ReleaseFreeHeap();
+    } else {
+      crc_collect_pending_ = true;
+      rc_safepoint_pending_ = true;
+    }
   }
 
-  mchunk = heap_memory_bank_->GetFreeChunk(size);
   void *retmem = NULL;
+  if (!heap_memory_bank_->IsBigSize(size)) {
+    retmem = SlabAlloc(size);
+    if (!retmem) {
+      // finish the lazy frees and collect garbage cycles before giving up
+      DrainLazyFree(UINT32_MAX);
+      RecallCycle();
+      retmem = SlabAlloc(size);
+      if (!retmem) {
+        MIR_FATAL("run out of VM heap memory, try a larger MAPLE_HEAP_SIZE.\n");
+      }
+    }
+    if (init_p) {
+      errno_t ret = memset_s(retmem, size, 0, size);
+      if (ret != EOK) {
+        MIR_FATAL("call memset_s failed in MemoryManager::Malloc");
+      }
+    }
+    return retmem;
+  }
+
+  if (IsLargeObjectSize(size)) {
+    // a fresh mapping reads as zero, no memset needed
+    retmem = LargeAlloc(size);
+    if (retmem) {
+      return retmem;
+    }
+  }
+
+  // for big size we merge the free chunk to see if we can get a big memory
+  mchunk = heap_memory_bank_->GetFreeChunk(size);
   if (!mchunk) {
-    uint32 heap_free_offset = 0;
-    if (heap_memory_bank_->IsBigSize(size)) {  // for big size we merge the free chunk to see if we can get a big memory
-      if (size + heap_free_big_offset_ > total_size_) {
-        // try to merge some free chunk;
-        heap_memory_bank_->MergeBigFreeChunk();
+    if (size + heap_free_big_offset_ > total_size_) {
+      // try to merge some free chunk, then collect garbage cycles before giving up
+      heap_memory_bank_->MergeBigFreeChunk();
+      mchunk = heap_memory_bank_->GetFreeChunk(size);
+      if (!mchunk) {
+        DrainLazyFree(UINT32_MAX);
+        RecallCycle();
+        ReleaseFreeHeap();
         mchunk = heap_memory_bank_->GetFreeChunk(size);
-        if (!mchunk) {
-          MIR_FATAL("run out of VM heap memory.\n");
-        }
-      } else {
-        heap_free_offset = heap_free_big_offset_;
-        heap_free_big_offset_ += size;
-        return (void *)((uint8 *)memory_ + heap_free_offset);
       }
-    } else {
-      if (size + heap_free_small_offset_ > total_small_size_) {
-        // try to use big size heap space if it has not been used
-        if (heap_free_big_offset_ == total_small_size_ &&
-            heap_free_big_offset_ < total_size_ - (1024 * 1024)) {
-            total_small_size_ += 1024 * 1024;
-            heap_free_big_offset_ = total_small_size_;
-        } else {
-          MIR_FATAL("TODO run out of VM heap memory.\n");
-        }
+    }
+    if (!mchunk) {
+      if (size + heap_free_big_offset_ > total_size_) {
+        MIR_FATAL("run out of VM heap memory, try a larger MAPLE_HEAP_SIZE.\n");
       }
-      heap_free_offset = heap_free_small_offset_;
-      heap_free_small_offset_ += size;
+      uint32 heap_free_offset = heap_free_big_offset_;
+      heap_free_big_offset_ += size;
+      CommitHeap(heap_big_committed_, heap_free_big_offset_, total_size_);
+      SetBigStart(heap_free_offset);
       return (void *)((uint8 *)memory_ + heap_free_offset);
     }
   }
   retmem = (void *)((uint8 *)memory_ + mchunk->offset_);
+  SetBigStart(mchunk->offset_);
   if (init_p) {
     errno_t ret = memset_s(retmem, size, 0, size);
     if (ret != EOK) {
@@ -771,6 +1402,14 @@ void *MemoryManager::Realloc(void *origptr, uint32 origsize, uint32 newsize) {
 #ifdef MM_DEBUG
   num_Realloc_calls++;
 #endif
+  if (IsLargeObject(HeapOffset(origptr) - MALLOCHEADSIZE) && IsLargeObjectSize(newsize + MALLOCHEADSIZE)) {
+    MemHeadTag tag = (MemHeadTag)GetMemHeader(origptr).memheadtag;
+    void *block = LargeRealloc(origptr, origsize, newsize);
+    if (block) {
+      CountFree(tag, origsize + MALLOCHEADSIZE);
+      return block;
+    }
+  }
   void *newptr = Malloc(newsize + MALLOCHEADSIZE);
   if (!newptr) {
     MIR_FATAL("out of memory");
@@ -862,10 +1501,46 @@ void MemoryManager::RecallMem(void *mem, uint32 size) {
   if (GetMemHeader(mem).memheadtag == MemHeadJSObj) {
     if (GetMemHeader(mem).in_roots == true) {
       GetMemHeader(mem).in_roots = false;
-      crc_candidate_roots.erase(mem);
+      if (offset >= total_small_size_) {
+        // outside the slabs a stale entry cannot be recognized later, drop it now
+        for (uint32 i = 0; i < crc_candidate_num_; i++) {
+          if (crc_candidates_[i] == HeapOffset(mem)) {
+            crc_candidates_[i] = crc_candidates_[--crc_candidate_num_];
+            break;
+          }
+        }
+      }
     }
   }
 
+  if (GetMemHeader(mem).refcount == UINT14_MAX) {
+    // swept as cyclic garbage while its count was in the overflow table
+    rc_overflow_.erase(HeapOffset(mem));
+  }
+  if (GetMemHeader(mem).in_zct) {
+    GetMemHeader(mem).in_zct = false;
+    if (offset >= total_small_size_) {
+      for (uint32 i = 0; i < zct_num_; i++) {
+        if (zct_[i] == HeapOffset(mem)) {
+          zct_[i] = zct_[--zct_num_];
+          break;
+        }
+      }
+    }
+  }
+  CountFree((MemHeadTag)GetMemHeader(mem).memheadtag, alignedsize + head_size);
+  if (is_sweep) {
+    crc_freed_size_ += alignedsize + head_size;
+  }
+  if (offset < total_small_size_) {
+    SlabFree(offset, alignedsize + head_size);
+    return;
+  }
+  if (IsLargeObject(offset)) {
+    LargeFree(offset);
+    return;
+  }
+  ClearBigStart(offset);
   MemoryChunk *mchunk = NewMemoryChunk(offset, alignedsize + head_size, NULL);
   // InsertMemoryChunk(mchunk);
   heap_memory_bank_->PutFreeChunk(mchunk);
@@ -935,6 +1610,139 @@ void MemoryManager::RecallList(__json_list *list) {
 }
 
 // decrease the memory, recall it if necessary
+void MemoryManager::RecallZeroCount(void *addr) {
+  MemHeader &header = GetMemHeader(addr);
+  switch (header.memheadtag) {
+    case MemHeadJSObj: {
+      ManageObject((__jsobject *)addr, RECALL);
+      return;
+    }
+    case MemHeadJSString: {
+      RecallString((__jsstring *)addr);
+      return;
+    }
+    case MemHeadEnv: {
+      ManageEnvironment(addr, RECALL);
+      return;
+    }
+    case MemHeadJSIter: {
+      RecallMem(addr, sizeof(__jsiterator));
+      return;
+    }
+    default:
+      MIR_FATAL("unknown GC object type");
+  }
+}
+
+void MemoryManager::GrowZct() {
+  uint32 cap = zct_cap_ ? zct_cap_ * 2 : 1024;
+  uint32 *zct = (uint32 *)realloc(zct_, cap * sizeof(uint32));
+  if (!zct) {
+    MIR_FATAL("run out of memory for the zero-count table");
+  }
+  zct_ = zct;
+  zct_cap_ = cap;
+}
+
+void MemoryManager::GrowLazyFree() {
+  uint32 cap = lazy_free_cap_ ? lazy_free_cap_ * 2 : 1024;
+  uint32 *list = (uint32 *)realloc(lazy_free_, cap * sizeof(uint32));
+  if (!list) {
+    MIR_FATAL("run out of memory for the lazy free list");
+  }
+  lazy_free_ = list;
+  lazy_free_cap_ = cap;
+}
+
+// Free up to budget queued blocks.  Children released by them are queued
+// as well and wait for a later step.
+void MemoryManager::DrainLazyFree(uint32 budget) {
+  if (lazy_freeing_) {
+    return;
+  }
+  lazy_freeing_ = true;
+  while (lazy_free_num_ > 0 && budget-- > 0) {
+    RecallZeroCount(HeapAddr(lazy_free_[--lazy_free_num_]));
+  }
+  lazy_freeing_ = false;
+}
+
+// Count (or uncount) a reference held by a stack, frame, register or retval
+// slot during a safe point.  Stale slots are filtered with IsHeapBlockLive;
+// an object left at zero by the uncount goes back to the zero-count table.
+void MemoryManager::CountStackRoot(TValue &val, bool count) {
+  if (!IS_NEEDRC(val.x.u64)) {
+    return;
+  }
+  void *addr = (void *)val.x.c.payload;
+  if (!IsHeap(addr) || !IsHeapBlockLive(addr)) {
+    return;
+  }
+  if (count) {
+    IncRefCount(addr);
+  } else if (DecRefCount(addr) && !GetMemHeader(addr).in_zct) {
+    ZctAdd(addr);
+  }
+}
+
+// Called by the interpreter at a safe point, where no native frame holds an
+// uncounted reference.  scan_roots counts (or uncounts) every stack, frame,
+// register and retval slot.  With the stack counted, the zero-count objects
+// still unreferenced are freed and the cycle collection deferred by Malloc
+// runs; zero counts reached meanwhile are freed at once.
+void MemoryManager::ReconcileZct(void (*scan_roots)(bool count)) {
+  scan_roots(true);
+  rc_reconciling_ = true;
+  while (zct_num_ > 0) {
+    void *addr = HeapAddr(zct_[--zct_num_]);
+    // a stale entry fails the check, and clearing in_zct skips duplicates
+    if (!IsHeapBlockLive(addr) || !GetMemHeader(addr).in_zct) {
+      continue;
+    }
+    GetMemHeader(addr).in_zct = false;
+    if (GetMemHeader(addr).refcount == 0) {
+      RecallZeroCount(addr);
+    }
+  }
+  if (crc_collect_pending_) {
+    crc_collect_pending_ = false;
+    IncrementalRecallCycle();
+    ReleaseFreeHeap();
+  }
+  rc_reconciling_ = false;
+  scan_roots(false);
+  // objects only the stack refers to stay in the table; do not ask again
+  // before it has grown well past them
+  zct_limit_ = zct_num_ * 2 > ZCT_RECONCILE_SIZE ? zct_num_ * 2 : ZCT_RECONCILE_SIZE;
+  rc_safepoint_pending_ = false;
+}
+
+// The header count reached UINT14_MAX: the references beyond it are kept in
+// rc_overflow_ until the count falls back.
+void MemoryManager::IncOverflowRefCount(void *addr) {
+  MemHeader &header = GetMemHeader(addr);
+  if (header.refcount == UINT14_MAX) {
+    rc_overflow_[HeapOffset(addr)]++;
+    return;
+  }
+  header.refcount = UINT14_MAX;
+  rc_overflow_[HeapOffset(addr)] = 0;
+  if (rc_overflow_.size() > rc_overflow_peak_) {
+    rc_overflow_peak_ = rc_overflow_.size();
+  }
+}
+
+void MemoryManager::DecOverflowRefCount(void *addr) {
+  auto it = rc_overflow_.find(HeapOffset(addr));
+  MIR_ASSERT(it != rc_overflow_.end());
+  if (it->second > 0) {
+    it->second--;
+    return;
+  }
+  rc_overflow_.erase(it);
+  GetMemHeader(addr).refcount = UINT14_MAX - 1;
+}
+
 void MemoryManager::GCDecRf(void *addr) {
   if (TurnoffGC())
     return;
@@ -944,40 +1752,36 @@ void MemoryManager::GCDecRf(void *addr) {
 #ifdef MM_RC_STATS
   num_rcdec++;
 #endif
+  stats_.rc_dec++;
   MemHeader &header = GetMemHeader(addr);
 //  MIR_ASSERT(header.refcount > 0);  // must > 0
-  if(header.refcount < UINT14_MAX)
-    header.refcount--;
   // DEBUG
   // printf("address: 0x%x   rf - to: %d\n", true_addr, header.refcount);
-  if (header.refcount == 0) {
-    switch (header.memheadtag) {
-      case MemHeadJSObj: {
-        ManageObject((__jsobject *)addr, RECALL);
-        return;
-      }
-      case MemHeadJSString: {
-        RecallString((__jsstring *)addr);
-        return;
-      }
-      case MemHeadEnv: {
-        ManageEnvironment(addr, RECALL);
-        return;
-      }
-      case MemHeadJSIter: {
-        MemHeader &header = memory_manager->GetMemHeader(addr);
-        RecallMem(addr, sizeof(__jsiterator));
-        return;
+  if (DecRefCount(addr)) {
+#ifdef RC_LAZY_FREE
+    // the cycle collector frees its garbage itself, keep it synchronous
+    if (!crc_in_progress_ && !is_sweep) {
+      LazyFree(addr);
+      return;
+    }
+#endif
+#ifdef RC_DEFER_STACK
+    if (!rc_reconciling_) {
+      // the stack may still refer to it, wait for the next safe point
+      if (!header.in_zct) {
+        ZctAdd(addr);
       }
-      default:
-        MIR_FATAL("unknown GC object type");
+      return;
     }
+#endif
+    RecallZeroCount(addr);
+    return;
   }
 
   // RC != 0 after decrease; if it's jsobject, then possible root of cycle
   if (GetMemHeader(addr).memheadtag == MemHeadJSObj && GetMemHeader(addr).in_roots == false) {
     GetMemHeader(addr).in_roots = true;
-    crc_candidate_roots.insert(addr);
+    AddCycleCandidate(addr);
   }
 }
 
@@ -1035,9 +1839,8 @@ void MemoryManager::DebugMemory() {
   printf("heap small offset: %d\n", heap_free_small_offset_);
   printf("heap memory table:\n");
   heap_memory_bank_->Debug();
-  printf("vm memory offset: small offset = %d, big offset = %d\n", vm_free_small_offset_, vm_free_big_offset_);
-  printf("vm memory table:\n");
-  vm_memory_bank_->Debug();
+  printf("vm memory: used = %lu, mapped = %lu, chunks = %u\n", (unsigned long)vm_arena_used_,
+         (unsigned long)vm_arena_mapped_, vm_arena_chunks_);
   printf("chunk memory usage:\n");
   for (MemoryChunk *chunk = free_memory_chunk_; chunk; chunk = chunk->next) {
     printf("memory offset:%u, memory size:%u\n", chunk->offset_, chunk->size_);
@@ -1051,6 +1854,17 @@ void MemoryManager::DebugMemory() {
 bool MemoryManager::CheckAddress(void *ptr) {
   if (IsHeap(ptr)) {
     uint32 offset = (uint8 *)ptr - (uint8 *)memory_;
+    if (offset < total_small_size_) {
+      uint32 slab_offset = offset & ~(uint32)(SLAB_SIZE - 1);
+      Slab *slab = SlabAt(slab_offset);
+      SlabClass &cls = slab_classes_[slab->size_class];
+      uint32 index = (offset - slab_offset - cls.first) / cls.size;
+      return !(((uint32 *)(slab + 1))[index >> 5] & (1u << (index & 31)));
+    }
+    if (IsLargeObject(offset)) {
+      auto it = los_blocks_.upper_bound(offset);
+      return it != los_blocks_.begin() && offset < std::prev(it)->first + std::prev(it)->second;
+    }
     return heap_memory_bank_->CheckOffset(offset);
   }
   return false;
@@ -1134,6 +1948,45 @@ void MemoryManager::UpdateAddrMap(uint32_t *origptr, uint32_t *newptr, uint32_t
 
 #endif
 
+void MemoryManager::GetMemStats(MemStats *stats) {
+  *stats = stats_;
+  stats->crc_runs = crc_num_pauses_;
+  stats->crc_freed_bytes = crc_freed_size_;
+  stats->los_objects = los_blocks_.size();
+  stats->los_mapped_bytes = los_mapped_;
+  stats->internal_used_bytes = vm_arena_used_;
+  stats->internal_peak_bytes = vm_arena_peak_;
+  stats->internal_mapped_bytes = vm_arena_mapped_;
+  stats->internal_chunks = vm_arena_chunks_;
+}
+
+static const char *MemHeadTagName[MemHeadLast] = {
+  "any", "function", "object", "string", "property", "list", "env", "iterator",
+};
+
+void MemoryManager::DumpMemStats(FILE *out) {
+  MemStats stats;
+  GetMemStats(&stats);
+  fprintf(out, "[MM] live= %lu peak= %lu heap committed= %u\n", (unsigned long)stats.live_bytes,
+          (unsigned long)stats.peak_bytes, CommittedHeapSize());
+  for (uint32 i = 0; i < MemHeadLast; i++) {
+    if (stats.alloc_count[i] == 0) {
+      continue;
+    }
+    fprintf(out, "[MM] %-8s alloc= %lu (%lu B) free= %lu (%lu B)\n", MemHeadTagName[i],
+            (unsigned long)stats.alloc_count[i], (unsigned long)stats.alloc_bytes[i],
+            (unsigned long)stats.free_count[i], (unsigned long)stats.free_bytes[i]);
+  }
+  fprintf(out, "[RC] inc= %lu dec= %lu\n", (unsigned long)stats.rc_inc, (unsigned long)stats.rc_dec);
+  fprintf(out, "[CRC] runs= %lu freed= %lu B\n", (unsigned long)stats.crc_runs,
+          (unsigned long)stats.crc_freed_bytes);
+  fprintf(out, "[LOS] objects= %lu mapped= %lu B\n", (unsigned long)stats.los_objects,
+          (unsigned long)stats.los_mapped_bytes);
+  fprintf(out, "[VM] internal used= %lu peak= %lu mapped= %lu B chunks= %lu\n",
+          (unsigned long)stats.internal_used_bytes, (unsigned long)stats.internal_peak_bytes,
+          (unsigned long)stats.internal_mapped_bytes, (unsigned long)stats.internal_chunks);
+}
+
 #ifdef MARK_CYCLE_ROOTS
 void MemoryManager::AddCycleRootNode(CycleRoot **roots_head, __jsobject *obj) {
   CycleRoot *root = (CycleRoot *)VMMallocGC(sizeof(CycleRoot));
@@ -1172,7 +2025,7 @@ void MemoryManager::ManageChildObj(__jsobject *obj, ManageType flag) {
       ManageObject(obj, flag);
     }
 #endif
-    GetMemHeader(obj).refcount--;  // parent just marked red, do RC-- regardless of color
+    DecRefCount(obj);  // parent just marked red, do RC-- regardless of color
     if (GetMemHeader(obj).color != CRC_RED) { // if already red, nothing to do
       GetMemHeader(obj).color = CRC_RED;
       ManageObject(obj, flag); // continue MARK_RED with children
@@ -1193,7 +2046,7 @@ void MemoryManager::ManageChildObj(__jsobject *obj, ManageType flag) {
       ManageObject(obj, flag);
     }
 #endif
-    GetMemHeader(obj).refcount++; // RC++ regardless of color
+    IncRefCount(obj); // RC++ regardless of color
     if (GetMemHeader(obj).color != CRC_GREEN) {
       GetMemHeader(obj).color = CRC_GREEN;
       ManageObject(obj, SCAN_GREEN); // continue SCAN_GREEN with children
@@ -1277,7 +2130,7 @@ void MemoryManager::ManageEnvironment(void *envptr, ManageType flag) {
   ManageType childFlag = flag;  // childFlag is for child objects
   bool child_no_action = false;
   if (flag == MARK_RED) {
-    GetMemHeader(obj).refcount--;  // parent just marked red, do RC-- regardless of color
+    DecRefCount(obj);  // parent just marked red, do RC-- regardless of color
     if (GetMemHeader(obj).color != CRC_RED) { // if already red, nothing to do
       GetMemHeader(obj).color = CRC_RED;
       // continue MARK_RED with children
@@ -1298,7 +2151,7 @@ void MemoryManager::ManageEnvironment(void *envptr, ManageType flag) {
     else
       child_no_action = true;
   } else if (flag == SCAN_GREEN) { // parent just turned green, so children turn green too
-    GetMemHeader(obj).refcount++; // RC++ regardless of color
+    IncRefCount(obj); // RC++ regardless of color
     if (GetMemHeader(obj).color != CRC_GREEN) {
       GetMemHeader(obj).color = CRC_GREEN;
       // continue SCAN_GREEN with children
@@ -1552,17 +2405,184 @@ void MemoryManager::DumpClosures() {
 }
 #endif
 
+void MemoryManager::GrowCycleCandidates() {
+  uint32 cap = crc_candidate_cap_ ? crc_candidate_cap_ * 2 : 1024;
+  uint32 *candidates = (uint32 *)realloc(crc_candidates_, cap * sizeof(uint32));
+  if (!candidates) {
+    MIR_FATAL("run out of memory for cycle candidates");
+  }
+  crc_candidates_ = candidates;
+  crc_candidate_cap_ = cap;
+}
+
+// Whether a heap address (past its MemHeader) names an allocated block: it
+// must head an allocated slab block, a big block whose start bit is set, or
+// a large-object mapping.
+bool MemoryManager::IsHeapBlockLive(void *addr) {
+  uint32 offset = (uint32)((uint8 *)addr - (uint8 *)memory_) - MALLOCHEADSIZE;
+  if (offset < total_small_size_) {
+    if (offset >= heap_free_small_offset_) {
+      return false;
+    }
+    uint32 slab_offset = offset & ~(uint32)(SLAB_SIZE - 1);
+    Slab *slab = SlabAt(slab_offset);
+    SlabClass &cls = slab_classes_[slab->size_class];
+    uint32 block = offset - slab_offset;
+    if (block < cls.first || (block - cls.first) % cls.size != 0) {
+      return false;
+    }
+    uint32 index = (block - cls.first) / cls.size;
+    if (index >= cls.num_blocks || (((uint32 *)(slab + 1))[index >> 5] & (1u << (index & 31)))) {
+      return false;
+    }
+    return true;
+  }
+  if (IsLargeObject(offset)) {
+    return los_blocks_.count(offset) != 0;
+  }
+  return (offset & 3) == 0 && offset < heap_free_big_offset_ && IsBigStart(offset);
+}
+
+// A buffered candidate may have been freed, and its block reused, since it
+// was appended.  Candidates are JS objects, which live in the slabs, so the
+// entry is still good only if it heads an allocated slab block whose header
+// says JSObj with in_roots set.  Entries outside the slabs are removed when
+// their object is freed.
+bool MemoryManager::IsCycleCandidate(void *addr) {
+  if (!IsHeapBlockLive(addr)) {
+    return false;
+  }
+  MemHeader &header = GetMemHeader(addr);
+  return header.memheadtag == MemHeadJSObj && header.in_roots;
+}
+
+// Squeeze out stale and duplicate entries before a collection.  in_roots is
+// cleared on the kept entries while scanning so a second entry for the same
+// object fails the check, and set again afterwards.
+void MemoryManager::CompactCycleCandidates() {
+  uint32 num = 0;
+  for (uint32 i = 0; i < crc_candidate_num_; i++) {
+    void *a = HeapAddr(crc_candidates_[i]);
+    if (IsCycleCandidate(a)) {
+      GetMemHeader(a).in_roots = false;
+      crc_candidates_[num++] = crc_candidates_[i];
+    }
+  }
+  for (uint32 i = 0; i < num; i++) {
+    GetMemHeader(HeapAddr(crc_candidates_[i])).in_roots = true;
+  }
+  crc_candidate_num_ = num;
+}
+
+static uint64_t NowMicros() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+// Collect cycles over all the candidate roots in one go.
 void MemoryManager::RecallCycle() {
-  if (crc_candidate_roots.empty()) {
+  if (crc_in_progress_ || !CanCollect()) {
+    return;
+  }
+  CompactCycleCandidates();
+  RecallCycleSlice(crc_candidate_num_);
+}
+
+// One pause of the incremental cycle collector.  Candidate roots are taken
+// crc_slice_roots_ at a time, and every slice is a complete synchronous
+// collection over its roots: nodes referenced from outside the slice's
+// closure stay green, so processing a subset is conservative but sound, and
+// the mutator never sees a half-colored graph.  Slices run until the
+// candidates are drained or the pause budget is used up.  Afterwards the
+// slice size is tuned to the measured slice time, and the allocation trigger
+// follows the garbage yield: a backlog or a rich yield collects sooner, a
+// poor yield backs off.
+void MemoryManager::IncrementalRecallCycle() {
+  CompactCycleCandidates();
+  if (crc_candidate_num_ == 0) {
+    return;
+  }
+  uint64_t start = NowMicros();
+  uint64_t now = start;
+  uint32 freed_before = crc_freed_size_;
+  do {
+    uint64_t slice_start = now;
+    RecallCycleSlice(crc_slice_roots_);
+    now = NowMicros();
+    uint64_t slice_us = now - slice_start;
+    if (slice_us > crc_pause_budget_us_ / 2 && crc_slice_roots_ > CRC_SLICE_MIN) {
+      crc_slice_roots_ /= 2;
+    } else if (slice_us < crc_pause_budget_us_ / 8 && crc_slice_roots_ < CRC_SLICE_MAX) {
+      crc_slice_roots_ *= 2;
+    }
+  } while (crc_candidate_num_ > 0 && now - start < crc_pause_budget_us_);
+
+  uint32 pause_us = (uint32)(now - start);
+  uint32 bucket = 0;
+  while ((pause_us >> bucket) > 1 && bucket < CRC_PAUSE_BUCKETS - 1) {
+    bucket++;
+  }
+  crc_pause_histogram_[bucket]++;
+  crc_num_pauses_++;
+  crc_total_pause_us_ += pause_us;
+  if (pause_us > crc_max_pause_us_) {
+    crc_max_pause_us_ = pause_us;
+  }
+
+  uint32 freed = crc_freed_size_ - freed_before;
+  if (crc_candidate_num_ > 0 || freed > crc_trigger_size_ / 4) {
+    if (crc_trigger_size_ > CRC_TRIGGER_MIN) {
+      crc_trigger_size_ /= 2;
+    }
+  } else if (freed < crc_trigger_size_ / 16) {
+    if (crc_trigger_size_ < CRC_TRIGGER_MAX) {
+      crc_trigger_size_ *= 2;
+    }
+  }
+}
+
+void MemoryManager::DumpCRCStats() {
+  printf("[CRC] pauses= %u total= %lu us max= %u us budget= %u us trigger= %u slice= %u freed= %u\n",
+         crc_num_pauses_, (unsigned long)crc_total_pause_us_, crc_max_pause_us_, crc_pause_budget_us_,
+         crc_trigger_size_, crc_slice_roots_, crc_freed_size_);
+  printf("[CRC] candidates= %u peak= %u capacity= %u\n", crc_candidate_num_, crc_candidate_peak_,
+         crc_candidate_cap_);
+  printf("[RC] overflowed counts= %u peak= %u\n", (uint32)rc_overflow_.size(), rc_overflow_peak_);
+#ifdef RC_DEFER_STACK
+  printf("[RC] zero-count table= %u peak= %u\n", zct_num_, zct_peak_);
+#endif
+#ifdef RC_LAZY_FREE
+  printf("[RC] lazy free list= %u peak= %u\n", lazy_free_num_, lazy_free_peak_);
+#endif
+  for (uint32 i = 0; i < CRC_PAUSE_BUCKETS; i++) {
+    if (crc_pause_histogram_[i]) {
+      printf("[CRC] pause < %6u us: %u\n", 2u << i, crc_pause_histogram_[i]);
+    }
+  }
+}
+
+void MemoryManager::RecallCycleSlice(uint32 max_roots) {
+  if (crc_candidate_num_ == 0) {
     return;
   }
+  crc_in_progress_ = true;
 
 #ifdef MM_DEBUG
   // for (auto a : crc_candidate_roots)
     // printf("candidate: %p rc= %d\n", (void*)a, (int)GetMemHeader(a).refcount);
 int num_roots = 0;
 #endif
-  for (auto a : crc_candidate_roots) {
+  // Taking a candidate clears its in_roots bit, so a duplicate entry left by
+  // a freed and reused block is skipped, and the object can be buffered again.
+  uint32 num_taken = 0;
+  while (crc_candidate_num_ > 0 && num_taken < max_roots) {
+    void *a = HeapAddr(crc_candidates_[--crc_candidate_num_]);
+    if (!IsCycleCandidate(a)) {
+      continue;
+    }
+    GetMemHeader(a).in_roots = false;
+    num_taken++;
     if (GetMemHeader(a).refcount > 0) { // if RC=0, it's garbage already
       AddCycleRootNode(&cycle_roots, (__jsobject*)a);
 #ifdef MM_DEBUG
@@ -1570,9 +2590,9 @@ int num_roots = 0;
 #endif
     }
   }
-  crc_candidate_roots.clear();
 
   if (!cycle_roots) {
+    crc_in_progress_ = false;
     return;
   }
 
@@ -1665,6 +2685,7 @@ int num_roots = 0;
  
   RecallRoots(garbage_roots);
   garbage_roots = nullptr;
+  crc_in_progress_ = false;
 }
 
 #else